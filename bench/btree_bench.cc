@@ -0,0 +1,570 @@
+/** @file btree_bench.cc
+    @brief Benchmark of the BTree and the ConcurrentBTree against std::multiset.
+
+    Every run builds one structure, runs one workload on it from a number of threads, and prints one line: the throughput, the percentiles of the latency of single operations
+    (every 16th operation is timed on its own) and the bytes of the structure per key.
+    Workloads:
+        insert  every key is added to an empty structure.
+        lookup  keys are looked up in the structure holding all of them.
+        scan    range scans of SCAN_LENGTH keys from a lower bound.
+        delete  every key is removed, in random order.
+        mixed   80% lookups, 10% inserts and 10% deletes on the structure holding half of the keys.
+    Key sets, all of (w_id, d_id, cust_id) keys:
+        sequential  keys added in increasing order.
+        uniform     keys drawn uniformly at random.
+        zipf        the keys of uniform, but looked up, scanned and changed following a Zipfian distribution (theta 0.99), so that a few keys are hot.
+        tpcc        TPC-C shaped: every key goes to a random warehouse and district, and gets the next customer id of that district, so there are many sequential streams.
+    The StringBTree indexes every key as a TPC-C customer by last name key (warehouse, district, last name, id) built from it, so it measures string keys of 19 to 25 bytes.
+    The BTree, the BTreeMap and the StringBTree (whose keys are unique, so duplicate keys of a key set are only added once) are only run from one thread; the ConcurrentBTree and std::multiset (behind a shared_mutex) from any number of threads.
+
+    Usage: btree_bench [--keys 1000,100000,1000000] [--threads 1,4] [--dists sequential,uniform,zipf,tpcc] [--workloads insert,lookup,scan,delete,mixed]
+                       [--structures btree,btreemap,strings,concurrent,map] [--seed 1]
+*/
+
+#include "btree.h"
+#include <chrono>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <endian.h>
+
+using namespace std;
+
+#define SCAN_LENGTH 100 // Number of keys read by a scan.
+#define SAMPLE_EVERY 16 // Every how many operations one is timed on its own for the latency percentiles.
+#define MIN_OPERATIONS 1000000 // Lookups, scans and mixed operations run at least this many operations, and inserts and deletes are repeated up to it, so that small trees are timed long enough.
+
+typedef chrono::steady_clock bench_clock;
+
+/// Orders primary keys for std::multiset the way the BTree orders them.
+struct key_less
+{
+    bool operator()(const primary_key& a, const primary_key& b) const
+    {
+        return key_traits<primary_key>::normalize(a) < key_traits<primary_key>::normalize(b);
+    }
+};
+
+/// Bytes allocated by all std::multiset nodes, to measure the bytes per key of the std::multiset.
+atomic<size_t> map_bytes(0);
+
+/// An allocator which counts the bytes it hands out in map_bytes.
+template <class T> struct counting_allocator
+{
+    typedef T value_type;
+
+    counting_allocator() {}
+    template <class U> counting_allocator(const counting_allocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        map_bytes += n * sizeof(T);
+        return (T*)::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T* pointer, size_t n)
+    {
+        map_bytes -= n * sizeof(T);
+        ::operator delete(pointer);
+    }
+
+    template <class U> bool operator==(const counting_allocator<U>&) const { return true; }
+    template <class U> bool operator!=(const counting_allocator<U>&) const { return false; }
+};
+
+/// The BTree behind the interface used by the workloads. Only used from one thread.
+class btree_structure
+{
+public:
+    typedef BTree<primary_key> tree_type;
+
+    void insert(primary_key& key) { tree.add_key(&key); }
+    bool lookup(const primary_key& key) { return tree.find(key) != tree.end(); }
+    bool erase(primary_key& key) { return tree.delete_key(&key); }
+
+    size_t scan(const primary_key& from)
+    {
+        size_t read = 0;
+        for (tree_type::iterator it = tree.lower_bound(from); it != tree.end() && read < SCAN_LENGTH; ++it)
+            read++;
+        return read;
+    }
+
+    double bytes_per_key() { return tree.size() == 0 ? 0.0 : (double)tree.node_allocator().used_blocks() * BLOCK_SIZE / tree.size(); }
+
+private:
+    tree_type tree;
+};
+
+/// The BTreeMap behind the interface used by the workloads, with an 8 byte value (like a row id) for every key. Only used from one thread.
+class btreemap_structure
+{
+public:
+    typedef BTreeMap<primary_key, uint64_t> tree_type;
+
+    void insert(primary_key& key) { tree.insert(key, (uint64_t)key.cust_id); }
+    bool lookup(const primary_key& key) { return tree.find(key) != NULL; }
+    bool erase(primary_key& key) { return tree.erase(key); }
+
+    size_t scan(const primary_key& from)
+    {
+        size_t read = 0;
+        for (tree_type::iterator it = tree.lower_bound(from); it != tree.end() && read < SCAN_LENGTH; ++it)
+            read++;
+        return read;
+    }
+
+    double bytes_per_key()
+    {
+        size_t bytes = tree.node_allocator().used_blocks() * BLOCK_SIZE + tree.values().used_blocks() * tree_type::geometry::value_block_size;
+        return tree.size() == 0 ? 0.0 : (double)bytes / tree.size();
+    }
+
+private:
+    tree_type tree;
+};
+
+/// A StringBTree indexing customers by (warehouse, district, last name, id) like the customer by last name index of TPC-C, with the id as the value. Only used from one thread.
+/** Every primary_key is turned into such a key: the warehouse and district as big endian bytes, the TPC-C last name of the customer id modulo 1000, and the id. */
+class strings_structure
+{
+public:
+    typedef StringBTree<uint64_t> tree_type;
+
+    void insert(primary_key& key) { tree.insert(string_key(key), (uint64_t)key.cust_id); }
+    bool lookup(const primary_key& key) { return tree.contains(string_key(key)); }
+    bool erase(primary_key& key) { return tree.erase(string_key(key)); }
+
+    size_t scan(const primary_key& from)
+    {
+        size_t read = 0;
+        for (tree_type::iterator it = tree.lower_bound(string_key(from)); it != tree.end() && read < SCAN_LENGTH; ++it)
+            read++;
+        return read;
+    }
+
+    double bytes_per_key() { return tree.size() == 0 ? 0.0 : (double)tree.node_allocator().used_blocks() * BLOCK_SIZE / tree.size(); }
+
+private:
+    /// Function to build the string key of a primary key in a buffer of the calling thread.
+    static string_view string_key(const primary_key& key)
+    {
+        static const char* const syllables[] = { "BAR", "OUGHT", "ABLE", "PRI", "PRES", "ESE", "ANTI", "CALLY", "ATION", "EING" };
+        thread_local char buffer[32];
+        uint32_t w_id = htobe32((uint32_t)key.w_id), cust_id = htobe32((uint32_t)key.cust_id);
+        memcpy(buffer, &w_id, 4);
+        buffer[4] = (char)key.d_id;
+        size_t length = 5;
+        int name = (int)((uint32_t)key.cust_id % 1000);
+        for (int divisor = 100; divisor > 0; divisor /= 10)
+        {
+            const char* syllable = syllables[name / divisor % 10];
+            memcpy(buffer + length, syllable, strlen(syllable));
+            length += strlen(syllable);
+        }
+        buffer[length++] = 0;
+        memcpy(buffer + length, &cust_id, 4);
+        return string_view(buffer, length + 4);
+    }
+
+    tree_type tree;
+};
+
+/// The ConcurrentBTree behind the interface used by the workloads.
+class concurrent_structure
+{
+public:
+    void insert(primary_key& key) { tree.add_key(&key); }
+    bool erase(primary_key& key) { return tree.delete_key(&key); }
+
+    bool lookup(const primary_key& key)
+    {
+        primary_key found;
+        return tree.find(key, found);
+    }
+
+    size_t scan(const primary_key& from)
+    {
+        thread_local vector<primary_key> out;
+        out.clear();
+        return tree.scan(from, SCAN_LENGTH, out);
+    }
+
+    double bytes_per_key() { return size == 0 ? 0.0 : (double)tree.used_nodes() * BLOCK_SIZE / size; }
+
+    size_t size = 0; /**< Number of keys, kept by the workloads as the tree does not count them. */
+
+private:
+    ConcurrentBTree<primary_key> tree;
+};
+
+/// std::multiset behind the interface used by the workloads, with a shared_mutex so that it can be used from several threads.
+class map_structure
+{
+public:
+    map_structure() { map_bytes = 0; }
+
+    void insert(primary_key& key)
+    {
+        unique_lock<shared_mutex> guard(lock);
+        keys.insert(key);
+    }
+
+    bool lookup(const primary_key& key)
+    {
+        shared_lock<shared_mutex> guard(lock);
+        return keys.find(key) != keys.end();
+    }
+
+    bool erase(primary_key& key)
+    {
+        unique_lock<shared_mutex> guard(lock);
+        multiset<primary_key, key_less, counting_allocator<primary_key> >::iterator found = keys.find(key);
+        if (found == keys.end())
+            return false;
+        keys.erase(found);
+        return true;
+    }
+
+    size_t scan(const primary_key& from)
+    {
+        shared_lock<shared_mutex> guard(lock);
+        size_t read = 0;
+        for (multiset<primary_key, key_less, counting_allocator<primary_key> >::iterator it = keys.lower_bound(from); it != keys.end() && read < SCAN_LENGTH; ++it)
+            read++;
+        return read;
+    }
+
+    double bytes_per_key() { return keys.empty() ? 0.0 : (double)map_bytes / keys.size(); }
+
+private:
+    multiset<primary_key, key_less, counting_allocator<primary_key> > keys;
+    shared_mutex lock;
+};
+
+/// Draws ranks between 0 and n - 1 following a Zipfian distribution, rank 0 being the most frequent (the method of Gray et al., as used by YCSB).
+class zipf_generator
+{
+public:
+    zipf_generator(size_t n, double theta) : items(n), theta(theta)
+    {
+        double zeta_n = 0;
+        for (size_t i = 1; i <= n; i++)
+            zeta_n += 1.0 / pow((double)i, theta);
+        double zeta_2 = 1.0 + 1.0 / pow(2.0, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta_2 / zeta_n);
+        half_pow_theta = 1.0 + pow(0.5, theta);
+        zeta = zeta_n;
+    }
+
+    template <class Random> size_t operator()(Random& random)
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(random);
+        double uz = u * zeta;
+        if (uz < 1.0)
+            return 0;
+        if (uz < half_pow_theta)
+            return 1;
+        size_t rank = (size_t)(items * pow(eta * u - eta + 1.0, alpha));
+        return rank < items ? rank : items - 1;
+    }
+
+private:
+    size_t items;
+    double theta, zeta, alpha, eta, half_pow_theta;
+};
+
+/// The keys and the order of the operations of one run.
+struct key_set
+{
+    vector<primary_key> keys; /**< The keys, in the order in which they are inserted. */
+    vector<size_t> accesses; /**< Indices into keys, in the order in which lookups, scans and mixed operations use them. */
+};
+
+/// Function to build the keys of a key set and the order in which they are accessed.
+key_set make_keys(const string& dist, size_t n, unsigned seed)
+{
+    key_set set;
+    mt19937_64 random(seed);
+    set.keys.resize(n);
+    if (dist == "sequential")
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            set.keys[i].w_id = (int)(i / 30000);
+            set.keys[i].d_id = (int)(i / 3000 % 10);
+            set.keys[i].cust_id = (int)(i % 3000);
+        }
+    }
+    else if (dist == "tpcc")
+    {
+        int warehouses = (int)max((size_t)1, n / 30000);
+        vector<int> next_customer(warehouses * 10, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            int district = (int)(random() % next_customer.size());
+            set.keys[i].w_id = district / 10;
+            set.keys[i].d_id = district % 10;
+            set.keys[i].cust_id = next_customer[district]++;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            set.keys[i].w_id = (int)(random() & 0xffffff); // warehouse ids in 24 bits, the range of primary_key_packed_traits.
+            set.keys[i].d_id = (int)(random() % 10);
+            set.keys[i].cust_id = (int)(random() & 0x7fffffff);
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+        set.keys[i].valid = true;
+    size_t count = max(n, (size_t)MIN_OPERATIONS);
+    set.accesses.resize(count);
+    if (dist == "zipf")
+    {
+        zipf_generator zipf(n, 0.99);
+        for (size_t i = 0; i < count; i++)
+            set.accesses[i] = (zipf(random) * 0x9e3779b97f4a7c15ull) % n; // the hot ranks are spread over the key space rather than all at its start.
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+            set.accesses[i] = random() % n;
+    }
+    return set;
+}
+
+/// The result of one run.
+struct run_result
+{
+    double seconds = 0;
+    size_t operations = 0;
+    vector<uint64_t> samples; /**< Latencies in nanoseconds of the operations timed on their own. */
+    double bytes_per_key = 0;
+};
+
+/// Function to run work(thread, begin, end, samples) over the operations [0, count), split into contiguous runs between the threads, and time it.
+template <class Work> void run_threads(int threads, size_t count, run_result& result, Work work)
+{
+    vector<vector<uint64_t> > samples(threads);
+    vector<thread> workers;
+    bench_clock::time_point start = bench_clock::now();
+    for (int t = 0; t < threads; t++)
+        workers.push_back(thread(work, t, count * t / threads, count * (t + 1) / threads, ref(samples[t])));
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+    result.seconds += chrono::duration<double>(bench_clock::now() - start).count();
+    result.operations += count;
+    for (int t = 0; t < threads; t++)
+        result.samples.insert(result.samples.end(), samples[t].begin(), samples[t].end());
+}
+
+/// Function to do one operation, timing it if it is one of the sampled ones.
+template <class Operation> inline void timed(size_t index, vector<uint64_t>& samples, Operation operation)
+{
+    if (index % SAMPLE_EVERY != 0)
+    {
+        operation();
+        return;
+    }
+    bench_clock::time_point start = bench_clock::now();
+    operation();
+    samples.push_back(chrono::duration_cast<chrono::nanoseconds>(bench_clock::now() - start).count());
+}
+
+atomic<size_t> checksum(0); /**< Results of lookups and scans, so that they cannot be optimised away. */
+
+/// Function to insert keys [begin, end) of a key set into a structure from the calling thread.
+template <class Structure> void load(Structure& structure, key_set& set, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; i++)
+        structure.insert(set.keys[i]);
+    if constexpr (is_same<Structure, concurrent_structure>::value)
+        structure.size += end - begin;
+}
+
+/// Function to run one workload on one structure.
+template <class Structure> run_result run_workload(const string& workload, key_set& set, int threads)
+{
+    run_result result;
+    size_t n = set.keys.size();
+    if (workload == "insert" || workload == "delete")
+    {
+        size_t rounds = max((size_t)1, (size_t)MIN_OPERATIONS / 10 / n);
+        vector<size_t> order(n);
+        for (size_t i = 0; i < n; i++)
+            order[i] = i;
+        shuffle(order.begin(), order.end(), mt19937(7));
+        for (size_t round = 0; round < rounds; round++)
+        {
+            Structure structure;
+            if (workload == "insert")
+            {
+                run_threads(threads, n, result, [&](int, size_t begin, size_t end, vector<uint64_t>& samples)
+                {
+                    for (size_t i = begin; i < end; i++)
+                        timed(i, samples, [&]() { structure.insert(set.keys[i]); });
+                });
+                if constexpr (is_same<Structure, concurrent_structure>::value)
+                    structure.size = n;
+            }
+            else
+            {
+                load(structure, set, 0, n);
+                result.bytes_per_key = structure.bytes_per_key();
+                run_threads(threads, n, result, [&](int, size_t begin, size_t end, vector<uint64_t>& samples)
+                {
+                    for (size_t i = begin; i < end; i++)
+                        timed(i, samples, [&]() { structure.erase(set.keys[order[i]]); });
+                });
+            }
+            if (workload == "insert")
+                result.bytes_per_key = structure.bytes_per_key();
+        }
+        return result;
+    }
+    Structure structure;
+    size_t loaded = workload == "mixed" ? n / 2 : n;
+    load(structure, set, 0, loaded);
+    result.bytes_per_key = structure.bytes_per_key();
+    size_t count = workload == "scan" ? set.accesses.size() / 10 : set.accesses.size();
+    atomic<size_t> next_insert(loaded);
+    run_threads(threads, count, result, [&](int, size_t begin, size_t end, vector<uint64_t>& samples)
+    {
+        size_t sum = 0;
+        for (size_t i = begin; i < end; i++)
+        {
+            primary_key& key = set.keys[set.accesses[i] % (workload == "mixed" ? loaded : n)];
+            if (workload == "lookup")
+                timed(i, samples, [&]() { sum += structure.lookup(key); });
+            else if (workload == "scan")
+                timed(i, samples, [&]() { sum += structure.scan(key); });
+            else if (i % 10 == 0)
+            {
+                size_t fresh = next_insert.fetch_add(1);
+                timed(i, samples, [&]() { structure.insert(set.keys[fresh < n ? fresh : fresh % n]); });
+            }
+            else if (i % 10 == 1)
+                timed(i, samples, [&]() { sum += structure.erase(key); });
+            else
+                timed(i, samples, [&]() { sum += structure.lookup(key); });
+        }
+        checksum += sum;
+    });
+    return result;
+}
+
+/// Function to get a percentile of the latency samples, in nanoseconds.
+uint64_t percentile(vector<uint64_t>& samples, double fraction)
+{
+    if (samples.empty())
+        return 0;
+    size_t index = min(samples.size() - 1, (size_t)(fraction * samples.size()));
+    nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+/// Function to split a comma separated list.
+vector<string> split_list(const string& list)
+{
+    vector<string> items;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t comma = list.find(',', start);
+        if (comma == string::npos)
+            comma = list.size();
+        if (comma > start)
+            items.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+int main(int argc, char** argv)
+{
+    vector<string> sizes = split_list("1000,100000,1000000");
+    vector<string> thread_counts = split_list("1");
+    vector<string> dists = split_list("sequential,uniform,zipf,tpcc");
+    vector<string> workloads = split_list("insert,lookup,scan,delete,mixed");
+    vector<string> structures = split_list("btree,btreemap,strings,concurrent,map");
+    unsigned seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        string option = argv[i];
+        if (option == "--keys")
+            sizes = split_list(argv[i + 1]);
+        else if (option == "--threads")
+            thread_counts = split_list(argv[i + 1]);
+        else if (option == "--dists")
+            dists = split_list(argv[i + 1]);
+        else if (option == "--workloads")
+            workloads = split_list(argv[i + 1]);
+        else if (option == "--structures")
+            structures = split_list(argv[i + 1]);
+        else if (option == "--seed")
+            seed = (unsigned)atoi(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "Unknown option %s. Options: --keys, --threads, --dists, --workloads, --structures, --seed.\n", argv[i]);
+            return 1;
+        }
+    }
+    printf("%-10s %10s %-10s %-8s %7s %10s %8s %8s %8s %10s\n", "structure", "keys", "dist", "workload", "threads", "Mops/s", "p50 ns", "p99 ns", "p99.9 ns", "bytes/key");
+    for (size_t s = 0; s < sizes.size(); s++)
+    {
+        size_t n = (size_t)atoll(sizes[s].c_str());
+        for (size_t d = 0; d < dists.size(); d++)
+        {
+            key_set set = make_keys(dists[d], n, seed);
+            for (size_t w = 0; w < workloads.size(); w++)
+            {
+                for (size_t t = 0; t < thread_counts.size(); t++)
+                {
+                    int threads = atoi(thread_counts[t].c_str());
+                    for (size_t k = 0; k < structures.size(); k++)
+                    {
+                        run_result result;
+                        if (structures[k] == "btree")
+                        {
+                            if (threads != 1)
+                                continue;
+                            result = run_workload<btree_structure>(workloads[w], set, threads);
+                        }
+                        else if (structures[k] == "btreemap")
+                        {
+                            if (threads != 1)
+                                continue;
+                            result = run_workload<btreemap_structure>(workloads[w], set, threads);
+                        }
+                        else if (structures[k] == "strings")
+                        {
+                            if (threads != 1)
+                                continue;
+                            result = run_workload<strings_structure>(workloads[w], set, threads);
+                        }
+                        else if (structures[k] == "concurrent")
+                            result = run_workload<concurrent_structure>(workloads[w], set, threads);
+                        else if (structures[k] == "map")
+                            result = run_workload<map_structure>(workloads[w], set, threads);
+                        else
+                        {
+                            fprintf(stderr, "Unknown structure %s.\n", structures[k].c_str());
+                            return 1;
+                        }
+                        printf("%-10s %10zu %-10s %-8s %7d %10.3f %8llu %8llu %8llu %10.1f\n", structures[k].c_str(), n, dists[d].c_str(), workloads[w].c_str(), threads,
+                            result.operations / result.seconds / 1e6, (unsigned long long)percentile(result.samples, 0.5), (unsigned long long)percentile(result.samples, 0.99),
+                            (unsigned long long)percentile(result.samples, 0.999), result.bytes_per_key);
+                        fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+    return checksum == 42 ? 2 : 0;
+}
@@ -0,0 +1,8108 @@
+/** @file btree.h
+    @brief Contains a modular implementation of a BTree.
+
+    The BTree can use any sort of primary key, which allows us to use this btree for any data which has a total ordering defined on it. The data will be defined as a part of the struct
+    primary_key. Node_Btree is the datastructure defined for every node of the Btree. We have tried keeping the size of each node close to the size of a page to ensure optimal utilisation
+     of BTree.
+    The library is header only: include this file and link with the thread library. btree.cc holds a demo of it, tests/ the tests and bench/ the benchmark.
+
+    @author Utkarsh Sharma
+    @bug No known bugs
+*/
+
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <new>
+#include <type_traits>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdexcept>
+#include <unordered_map>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <cmath>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <cerrno>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#define BLOCK_SIZE 4096 // Default target size of a node in bytes. Can be changed per tree through the NodeSize template parameter of BTree.
+#define CACHE_LINE_SIZE 64
+#define PAGE_BYTES 4096
+#define LINEAR_SEARCH_BYTES 256 // Nodes whose search keys take more than this many bytes are first narrowed down with a binary search before being scanned.
+#define SLAB_BYTES (2 * 1024 * 1024) // Nodes are allocated from slabs of this size. Matches the size of a huge page on x86-64.
+#define MIN_FILL_FACTOR 0.4 // Default fraction of its capacity below which a node which lost keys borrows from or is merged with a sibling.
+#define TOMBSTONE_LIMIT 0.25 // Default fraction of the keys of a tree which may be tombstones of lazy deletes before the whole tree is compacted.
+#define MAX_THREADS 256 // Number of threads which can use concurrent trees at the same time.
+#define RUN_MIN_LENGTH 8 // Number of keys a leaf has to get one right after the other before a split follows them as an ascending run rather than cutting the leaf in halves.
+#define MULTI_GET_GROUP 16 // Number of lookups of a multi_get which go down the tree together, so that the cache misses of one level of all of them overlap.
+#define FILTER_FALSE_POSITIVE_RATE 0.01 // Default fraction of the lookups of absent keys which the filter of a tree lets through, see BTree::set_filter.
+#define FILTER_MIN_KEYS 1024 // Number of keys for which the filter of a tree is sized at least, so that a small tree does not rebuild it over and over while it grows.
+#define PAGE_FILE_RESERVE (1ull << 36) // Bytes of address space reserved for a page file when it is mapped, which is as large as the file can grow while it is open.
+#define PAGE_FILE_MAGIC 0x45455254424750ull // "PGBTREE" in little endian, at the start of every page file.
+#define PAGE_FILE_VERSION 1 // Version of the layout of page files.
+#define WAL_FLUSH_INTERVAL_MS 5 // Interval at which the write-ahead log of a durable tree is flushed under the async policy, and the size of the log is checked for a checkpoint.
+#define CHECKPOINT_LOG_BYTES (64ull << 20) // Default size of the write-ahead log of a durable tree beyond which a checkpoint is taken.
+#define CHECKPOINT_MAGIC 0x544e494f504b4843ull // "CHKPOINT" in little endian, at the start of every checkpoint file.
+#define POSTING_INLINE_BYTES 30 // Bytes of delta coded row ids which the posting list of a key of a PostingBTree holds in itself before it spills to overflow pages.
+#define CLOCK_MAX_USAGE 5 // Largest usage count of a frame of a buffer pool. A page read this many times more survives as many more sweeps of the clock hand.
+#ifndef BTREE_TRACE_LEVEL
+#define BTREE_TRACE_LEVEL 0 // Trace messages written to cerr by trees: 0 for none, which compiles them out, 1 for changes to the shape of a tree (splits, new roots), 2 for every key too.
+#endif
+#ifndef BTREE_STATS
+#define BTREE_STATS 1 // Whether trees count their lookups, comparisons, splits and shifts (see Tree_stats). 0 compiles the counting out.
+#endif
+#define RECLAIM_BATCH 64 // Number of nodes a concurrent tree retires between two attempts to reuse the retired nodes which no thread can see anymore.
+
+#if BTREE_TRACE_LEVEL > 0
+#define BTREE_TRACE(level, message) do { if ((level) <= BTREE_TRACE_LEVEL) std::cerr << message << std::endl; } while (0) // Writes a message streamed to cerr if its level is traced.
+#else
+#define BTREE_TRACE(level, message) do { } while (0)
+#endif
+
+
+/// The structure of a primary key which constitutes an entry in a node of the BTree.
+/** The primary key must contain a bool 'valid' and helper functions 'LT' (less than) and 'EQ' (equal to) to define the total ordering among the keys in the tree. Since we move
+    a lot of the data around in a BTree, many times nearby memory locations will contain old values. Instead of always overwriting the entire primary key memory when it is removed,
+    we just set the valid bit to 0, which results in it being treated as an empty space by the BTree.
+    The keys are ordered on (w_id, d_id, cust_id). How the tree compares keys is decided by the key traits it is given (see key_traits), so the same key can also be indexed through
+    its normalized forms.
+
+*/
+struct primary_key
+{
+    bool valid; /// The part of primary key which checks whether the data in key is valid. Set to false by default (through constructor).
+    int cust_id;
+    int w_id;
+    int d_id;
+    int compare(const primary_key& a) const // Three way comparison on (w_id, d_id, cust_id). Negative if the calling key is smaller, zero if equal and positive if larger.
+    {
+        if (w_id != a.w_id)
+            return w_id < a.w_id ? -1 : 1;
+        if (d_id != a.d_id)
+            return d_id < a.d_id ? -1 : 1;
+        if (cust_id != a.cust_id)
+            return cust_id < a.cust_id ? -1 : 1;
+        return 0;
+    }
+    bool LT(const primary_key& a) const // A LT function on this scheme will be present in every primary key. If calling key < called key then true
+    {
+        return compare(a) < 0;
+    }
+
+    bool EQ(const primary_key& a) const // A equal to function on this scheme will be present in every primary key. If calling key = called key then true
+    {
+        return compare(a) == 0;
+    }
+  /*  void operator=(const primary_key &other) // an overload for = will have to be defined in primary key class.
+    {
+        this->cust_id = other.cust_id;
+        this->w_id = other.w_id;
+        this->d_id = other.d_id;
+        return;
+    }  */
+    void equateTo(primary_key a)
+    {
+        valid = a.valid;
+        cust_id = a.cust_id;
+        w_id = a.w_id;
+        d_id = a.d_id;
+        return;
+    }
+    primary_key() // constructor for the primary key
+    {
+        valid = false;
+    }
+};
+
+/// Prefix of a primary_key naming a warehouse. Can be used to look up all keys of a warehouse without building a full primary_key.
+struct warehouse_prefix
+{
+    int w_id;
+};
+
+/// Prefix of a primary_key naming a district of a warehouse.
+struct district_prefix
+{
+    int w_id;
+    int d_id;
+};
+
+
+/// A key normalized into a string of Size bytes whose order under memcmp is the order of the keys.
+/** Normalizing a composite key once when it is stored means that every later comparison is a single memcmp, no matter how many fields the key has. */
+template <int Size> struct normalized_bytes
+{
+    unsigned char bytes[Size];
+
+    bool operator<(const normalized_bytes& other) const { return compare(other) < 0; }
+    bool operator==(const normalized_bytes& other) const { return memcmp(bytes, other.bytes, Size) == 0; }
+    bool operator<=(const normalized_bytes& other) const { return compare(other) <= 0; }
+
+    /// Three way comparison in the order of memcmp, done eight and then four bytes at a time as big endian integers, so that it is inlined rather than a call to memcmp.
+    int compare(const normalized_bytes& other) const
+    {
+        int offset = 0;
+        for (; offset + 8 <= Size; offset += 8)
+        {
+            uint64_t mine, theirs;
+            memcpy(&mine, bytes + offset, 8);
+            memcpy(&theirs, other.bytes + offset, 8);
+            if (mine != theirs)
+                return be64toh(mine) < be64toh(theirs) ? -1 : 1;
+        }
+        for (; offset + 4 <= Size; offset += 4)
+        {
+            uint32_t mine, theirs;
+            memcpy(&mine, bytes + offset, 4);
+            memcpy(&theirs, other.bytes + offset, 4);
+            if (mine != theirs)
+                return be32toh(mine) < be32toh(theirs) ? -1 : 1;
+        }
+        return offset < Size ? memcmp(bytes + offset, other.bytes + offset, Size - offset) : 0;
+    }
+
+    /// Writes a signed integer at the given offset, big endian and with the sign bit flipped, so that memcmp orders the bytes like the integers.
+    void put(int offset, int value)
+    {
+        uint32_t biased = (uint32_t)value ^ 0x80000000u;
+        bytes[offset] = (unsigned char)(biased >> 24);
+        bytes[offset + 1] = (unsigned char)(biased >> 16);
+        bytes[offset + 2] = (unsigned char)(biased >> 8);
+        bytes[offset + 3] = (unsigned char)biased;
+    }
+};
+
+
+/// The key traits tell a BTree how to order its keys.
+/** Every key traits class has a static 'normalized' flag.
+    If it is false, the tree compares keys with the static three way function compare(const KeyType&, const Probe&), which returns a negative value, zero or a positive value if
+    the key is smaller than, equal to or larger than the probe. The probe is a full key for insertions, but lookups take any probe type for which compare has an overload, such as
+    a prefix of the key.
+    If it is true, every key is stored along with normalize(key), a normalized_type value whose natural order is the order of the keys. normalized_type has to be an integer (which
+    the nodes search with the vectorised kernel) or a memcmp ordered normalized_bytes. A lookup for a probe is done on the normalized range [normalize_lower(probe),
+    normalize_upper(probe)], which for a full key is just its normalized value.
+    The default traits, used when a BTree is not given any, compare keys through their LT and EQ functions. */
+template <class KeyType> struct key_traits
+{
+    static const bool normalized = false;
+
+    static int compare(const KeyType& key, const KeyType& probe)
+    {
+        if (key.LT(probe))
+            return -1;
+        return key.EQ(probe) ? 0 : 1;
+    }
+};
+
+/// Key traits ordering primary keys on (w_id, d_id, cust_id) by comparing the fields one after the other. Lookups can also be done with a warehouse_prefix or a district_prefix.
+struct primary_key_traits
+{
+    static const bool normalized = false;
+
+    static int compare(const primary_key& key, const primary_key& probe)
+    {
+        return key.compare(probe);
+    }
+
+    static int compare(const primary_key& key, const warehouse_prefix& probe)
+    {
+        return key.w_id == probe.w_id ? 0 : (key.w_id < probe.w_id ? -1 : 1);
+    }
+
+    static int compare(const primary_key& key, const district_prefix& probe)
+    {
+        if (key.w_id != probe.w_id)
+            return key.w_id < probe.w_id ? -1 : 1;
+        return key.d_id == probe.d_id ? 0 : (key.d_id < probe.d_id ? -1 : 1);
+    }
+};
+
+/// Key traits storing primary keys normalized into one 64 bit integer, so that a comparison of composite keys is a single (vectorised) integer comparison.
+/** The key is packed as w_id (24 bits), d_id (8 bits) and cust_id (32 bits), with cust_id biased so that negative values still sort first, and the top bit flipped so that the
+    signed order of the result is the order of the keys. This covers the TPC-C ranges of the fields (d_id is at most 10, w_id at most a few thousands), but keys outside of
+    them (a negative w_id or d_id, a w_id of 2^24 or more, a d_id of 256 or more) share their packed form with other keys and sort out of order, which is only checked by an
+    assert. So these traits are not the default: a tree has to be given them, e.g. BTree<primary_key, BLOCK_SIZE, primary_key_packed_traits>, by a caller who knows that its keys
+    stay in these ranges. */
+struct primary_key_packed_traits
+{
+    static const bool normalized = true;
+    typedef int64_t normalized_type;
+
+    static int64_t pack(int w_id, int d_id, int cust_id)
+    {
+        uint64_t packed = ((uint64_t)(uint32_t)w_id << 40) | ((uint64_t)(uint32_t)d_id << 32) | (uint64_t)((uint32_t)cust_id ^ 0x80000000u);
+        return (int64_t)(packed ^ 0x8000000000000000ull);
+    }
+
+    static int64_t normalize(const primary_key& key)
+    {
+        assert(key.w_id >= 0 && key.w_id < (1 << 24) && key.d_id >= 0 && key.d_id < (1 << 8));
+        return pack(key.w_id, key.d_id, key.cust_id);
+    }
+
+    static int64_t normalize_lower(const primary_key& probe) { return normalize(probe); }
+    static int64_t normalize_upper(const primary_key& probe) { return normalize(probe); }
+    static int64_t normalize_lower(const warehouse_prefix& probe) { return pack(probe.w_id, 0, INT32_MIN); }
+    static int64_t normalize_upper(const warehouse_prefix& probe) { return pack(probe.w_id, 255, INT32_MAX); }
+    static int64_t normalize_lower(const district_prefix& probe) { return pack(probe.w_id, probe.d_id, INT32_MIN); }
+    static int64_t normalize_upper(const district_prefix& probe) { return pack(probe.w_id, probe.d_id, INT32_MAX); }
+};
+
+/// Key traits storing primary keys normalized into a memcmp ordered string of 12 bytes. Works for the whole range of the fields, at the cost of comparing two words rather than one.
+struct primary_key_bytes_traits
+{
+    static const bool normalized = true;
+    typedef normalized_bytes<12> normalized_type;
+
+    static normalized_type pack(int w_id, int d_id, int cust_id)
+    {
+        normalized_type packed;
+        packed.put(0, w_id);
+        packed.put(4, d_id);
+        packed.put(8, cust_id);
+        return packed;
+    }
+
+    static normalized_type normalize(const primary_key& key) { return pack(key.w_id, key.d_id, key.cust_id); }
+    static normalized_type normalize_lower(const primary_key& probe) { return normalize(probe); }
+    static normalized_type normalize_upper(const primary_key& probe) { return normalize(probe); }
+    static normalized_type normalize_lower(const warehouse_prefix& probe) { return pack(probe.w_id, INT32_MIN, INT32_MIN); }
+    static normalized_type normalize_upper(const warehouse_prefix& probe) { return pack(probe.w_id, INT32_MAX, INT32_MAX); }
+    static normalized_type normalize_lower(const district_prefix& probe) { return pack(probe.w_id, probe.d_id, INT32_MIN); }
+    static normalized_type normalize_upper(const district_prefix& probe) { return pack(probe.w_id, probe.d_id, INT32_MAX); }
+};
+
+/// Primary keys are indexed through their 12 byte normalized form unless the tree is given other traits, so that every key a primary_key can hold is told apart and ordered.
+template <> struct key_traits<primary_key> : public primary_key_bytes_traits
+{
+};
+
+/// Key traits for integer keys, such as the column of a secondary index, which are their own normalized form.
+template <class Integer> struct integer_key_traits
+{
+    static const bool normalized = true;
+    typedef int64_t normalized_type;
+
+    static int64_t normalize(Integer key) { return (int64_t)key; }
+    static int64_t normalize_lower(Integer probe) { return (int64_t)probe; }
+    static int64_t normalize_upper(Integer probe) { return (int64_t)probe; }
+};
+
+/// Integer keys are indexed through integer_key_traits unless the tree is given other traits.
+template <> struct key_traits<int> : public integer_key_traits<int>
+{
+};
+
+/// Key traits for districts used as keys, such as the (w_id, d_id) columns of a secondary index, packed into one 64 bit integer. A warehouse_prefix looks up all its districts.
+template <> struct key_traits<district_prefix>
+{
+    static const bool normalized = true;
+    typedef int64_t normalized_type;
+
+    static int64_t pack(int w_id, int d_id) { return (int64_t)w_id * 4294967296ll + (int64_t)((uint32_t)d_id ^ 0x80000000u); }
+
+    static int64_t normalize(const district_prefix& key) { return pack(key.w_id, key.d_id); }
+    static int64_t normalize_lower(const district_prefix& probe) { return normalize(probe); }
+    static int64_t normalize_upper(const district_prefix& probe) { return normalize(probe); }
+    static int64_t normalize_lower(const warehouse_prefix& probe) { return pack(probe.w_id, INT32_MIN); }
+    static int64_t normalize_upper(const warehouse_prefix& probe) { return pack(probe.w_id, INT32_MAX); }
+};
+
+/// Number of bytes which the normalized form of a key takes in a node. Zero when the traits do not normalize keys.
+template <class Traits> constexpr size_t normalized_key_size()
+{
+    if constexpr (Traits::normalized)
+        return sizeof(typename Traits::normalized_type);
+    else
+        return 0;
+}
+
+/// Function to hash a key from the bytes of its normalized form, so that equal keys get equal hashes. Every bit of the hash depends on every byte of the normalized form.
+template <class Traits, class KeyType> uint64_t normalized_hash(const KeyType& key)
+{
+    typename Traits::normalized_type normalized = Traits::normalize(key);
+    static_assert(std::has_unique_object_representations<typename Traits::normalized_type>::value, "Normalized keys with padding bytes cannot be hashed through their bytes.");
+    const unsigned char* bytes = (const unsigned char*)&normalized;
+    uint64_t hash = sizeof(normalized);
+    for (size_t at = 0; at < sizeof(normalized); at += 8)
+    {
+        uint64_t word = 0;
+        memcpy(&word, bytes + at, std::min(sizeof(normalized) - at, (size_t)8));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    hash *= 0xBF58476D1CE4E5B9ull; // the last round of the splitmix64 finalizer, so that both halves of the hash depend on every byte.
+    return hash ^ (hash >> 31);
+}
+
+
+/// Counts how many of the first n values of a sorted array are smaller than target.
+/** This is the scalar fallback of the node search kernel, used for search key types for which there is no vectorised version. The loop has no branch on the outcome of the
+    comparisons, so the compiler is free to vectorise it on its own.
+    @param keys     The sorted array of search keys.
+    @param n        The number of values of the array which are looked at.
+    @param target   The value being searched for.
+    @return The number of values smaller than target, which is also the index of the first value not smaller than target. */
+template <class T> inline int count_less(const T* keys, int n, T target)
+{
+    int count = 0;
+    for (int i = 0; i < n; i++)
+        count += keys[i] < target;
+    return count;
+}
+
+/// Counts how many of the first n values of a sorted array are smaller than or equal to target. Scalar fallback, see count_less.
+template <class T> inline int count_less_equal(const T* keys, int n, T target)
+{
+    int count = 0;
+    for (int i = 0; i < n; i++)
+        count += !(target < keys[i]);
+    return count;
+}
+
+#if defined(__AVX2__)
+/// Version of count_less for 32 bit keys which compares eight keys per instruction.
+inline int count_less(const int32_t* keys, int n, int32_t target)
+{
+    __m256i wanted = _mm256_set1_epi32(target);
+    int count = 0, i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(keys + i));
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(wanted, block))));
+    }
+    for (; i < n; i++)
+        count += keys[i] < target;
+    return count;
+}
+
+/// Version of count_less_equal for 32 bit keys which compares eight keys per instruction.
+inline int count_less_equal(const int32_t* keys, int n, int32_t target)
+{
+    __m256i wanted = _mm256_set1_epi32(target);
+    int count = 0, i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(keys + i));
+        count += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(block, wanted))));
+    }
+    for (; i < n; i++)
+        count += keys[i] <= target;
+    return count;
+}
+
+/// Version of count_less for 64 bit keys which compares four keys per instruction.
+inline int count_less(const int64_t* keys, int n, int64_t target)
+{
+    __m256i wanted = _mm256_set1_epi64x(target);
+    int count = 0, i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(keys + i));
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(wanted, block))));
+    }
+    for (; i < n; i++)
+        count += keys[i] < target;
+    return count;
+}
+
+/// Version of count_less_equal for 64 bit keys which compares four keys per instruction.
+inline int count_less_equal(const int64_t* keys, int n, int64_t target)
+{
+    __m256i wanted = _mm256_set1_epi64x(target);
+    int count = 0, i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(keys + i));
+        count += 4 - __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(block, wanted))));
+    }
+    for (; i < n; i++)
+        count += keys[i] <= target;
+    return count;
+}
+#elif defined(__SSE2__)
+/// Version of count_less for 32 bit keys which compares four keys per instruction.
+inline int count_less(const int32_t* keys, int n, int32_t target)
+{
+    __m128i wanted = _mm_set1_epi32(target);
+    int count = 0, i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)(keys + i));
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(wanted, block))));
+    }
+    for (; i < n; i++)
+        count += keys[i] < target;
+    return count;
+}
+
+/// Version of count_less_equal for 32 bit keys which compares four keys per instruction.
+inline int count_less_equal(const int32_t* keys, int n, int32_t target)
+{
+    __m128i wanted = _mm_set1_epi32(target);
+    int count = 0, i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)(keys + i));
+        count += 4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(block, wanted))));
+    }
+    for (; i < n; i++)
+        count += keys[i] <= target;
+    return count;
+}
+
+#if defined(__SSE4_2__)
+/// Version of count_less for 64 bit keys which compares two keys per instruction. The 64 bit comparison needs SSE4.2.
+inline int count_less(const int64_t* keys, int n, int64_t target)
+{
+    __m128i wanted = _mm_set1_epi64x(target);
+    int count = 0, i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)(keys + i));
+        count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(wanted, block))));
+    }
+    for (; i < n; i++)
+        count += keys[i] < target;
+    return count;
+}
+
+/// Version of count_less_equal for 64 bit keys which compares two keys per instruction. The 64 bit comparison needs SSE4.2.
+inline int count_less_equal(const int64_t* keys, int n, int64_t target)
+{
+    __m128i wanted = _mm_set1_epi64x(target);
+    int count = 0, i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)(keys + i));
+        count += 2 - __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(block, wanted))));
+    }
+    for (; i < n; i++)
+        count += keys[i] <= target;
+    return count;
+}
+#endif
+#endif
+
+
+/// Finds the first of the n sorted search keys of a node which is not smaller than target (or, if upper is true, the first one which is larger than target).
+/** This is the search kernel used on every level of the tree. Small nodes are scanned as a whole with count_less / count_less_equal, which compare a whole block of keys at once
+    when the key type has a vectorised version. In large nodes a branchless binary search first narrows the range down to LINEAR_SEARCH_BYTES worth of keys, and the scan then only
+    looks at those. The binary search keeps every key before base smaller than target (not larger, if upper) and the answer at most base + length, so the remaining window always
+    holds the answer.
+    @param keys     The sorted search keys of the node.
+    @param n        The number of valid keys in the node.
+    @param target   The search key being looked for.
+    @param upper    Whether to return the upper bound instead of the lower bound.
+    @return The index of the bound, between 0 and n (both inclusive). */
+template <class T> inline int search_in_node(const T* keys, int n, T target, bool upper)
+{
+    const int window = LINEAR_SEARCH_BYTES / sizeof(T) > 0 ? LINEAR_SEARCH_BYTES / sizeof(T) : 1;
+    const T* base = keys;
+    int length = n;
+    if (upper)
+    {
+        while (length > window)
+        {
+            int half = length / 2;
+            base = !(target < base[half]) ? base + half : base;
+            length -= half;
+        }
+        return (int)(base - keys) + count_less_equal(base, length, target);
+    }
+    while (length > window)
+    {
+        int half = length / 2;
+        base = (base[half] < target) ? base + half : base;
+        length -= half;
+    }
+    return (int)(base - keys) + count_less(base, length, target);
+}
+
+
+/// A version latch for optimistic lock coupling, kept in the header of every node.
+/** The latch is one word: bit 0 marks a node which was unlinked from the tree (obsolete), bit 1 marks a node which is being written, and the other bits count the writes done to
+    the node. Readers never write to the latch. They remember the version they saw before reading a node and check that it is unchanged afterwards, and start over if it is not.
+    Writers turn a version they read into the write latch with one compare and swap, which fails (and makes them start over) if the node changed in the meantime, so no thread
+    ever waits while holding a latch and there can be no deadlock. Trees used from a single thread never touch the latch. */
+class Version_latch
+{
+private:
+    std::atomic<uint64_t> word;
+
+public:
+    Version_latch() : word(0) {}
+
+    /// Function to get the version of a node before reading it. Sets restart if the node is being written or is obsolete.
+    uint64_t read_or_restart(bool& restart) const
+    {
+        uint64_t version = word.load(std::memory_order_acquire);
+        if ((version & 3) != 0)
+            restart = true;
+        return version;
+    }
+
+    /// Function to check, after reading a node, that nobody wrote to it since version was read. Sets restart otherwise.
+    void check_or_restart(uint64_t version, bool& restart) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (word.load(std::memory_order_relaxed) != version)
+            restart = true;
+    }
+
+    /// Function to take the write latch of a node, provided that nobody wrote to it since version was read. Sets restart otherwise.
+    void upgrade_or_restart(uint64_t version, bool& restart)
+    {
+        if (!word.compare_exchange_strong(version, version + 2, std::memory_order_acquire))
+        {
+            restart = true;
+            return;
+        }
+        std::atomic_thread_fence(std::memory_order_release); // the latch has to be visible before any write to the node.
+    }
+
+    /// Function to release the write latch, which also moves the version on.
+    void unlock()
+    {
+        word.fetch_add(2, std::memory_order_release);
+    }
+
+    /// Function to release the write latch of a node which was unlinked from the tree. Readers still looking at it will start over.
+    void unlock_obsolete()
+    {
+        word.fetch_add(3, std::memory_order_release);
+    }
+};
+
+
+/// The header shared by every node of the BTree, leaf or inner.
+/** The tree walks from node to node through pointers to Node_base, and uses the level of a node to find out which of the two node layouts (leaf or inner) it actually has. */
+template <class KeyType> class Node_base
+{
+public:
+    Version_latch latch; /**< Latch of the node when it belongs to a ConcurrentBTree. */
+
+    int NumberOfValidKeys; /**< NumberOfValidKeys keeps track of how many valid entries are there in a node, and serves as an upper bound for iteration in many loops. */
+
+    int level; /**< Height of the node above the leaves. Leaves are at level 0, and every parent is one level above its children. */
+
+    uint64_t born; /**< Epoch of the BTree in which the node was created. A node born before the newest snapshot of the tree is shared with it, and is copied before it changes. */
+};
+
+
+/// The normalized keys of a node, kept in an array of their own when the key traits normalize keys.
+/** The normalized forms of all keys of a node are contiguous and separate from the rest of the keys (including their valid bits), so that a whole block of them can be compared
+    at once. Nodes whose traits do not normalize keys inherit from the empty specialisation, which takes no space. */
+template <class Traits, int Slots, bool Normalized = Traits::normalized> class Node_search_keys
+{
+public:
+    typename Traits::normalized_type search_array[Slots]; /**< The normalized forms (Traits::normalize) of the keys in key_array, at the same indices. */
+};
+
+template <class Traits, int Slots> class Node_search_keys<Traits, Slots, false>
+{
+};
+
+
+/// A template class defining a node of the BTree. Each node will contain multiple primary keys and be linked to other nodes to form the BTree.
+/** The node of a BTree is a template class which is meant to be initialised with the primary key struct as the type, the number of keys it holds and whether it is a leaf or not.
+    The capacity is worked out by node_geometry so that a whole node is nearly equal to the target node size (a few cache lines, or a page). This will ensure that the entire
+    array is read in one disk access, and also that the maximum possible length of the array is used. Leaves do not carry a children array at all, so they hold more keys than
+    inner nodes of the same size.
+*/
+template <class KeyType, class Traits, int Capacity, bool IsLeaf, size_t Alignment> class alignas(Alignment) Node_btree : public Node_base<KeyType>,
+    public Node_search_keys<Traits, Capacity + 1>
+{
+public:
+    static const int capacity = Capacity; /**< Maximum number of keys which the node holds outside of an insertion. */
+    static const bool leaf = IsLeaf;
+
+    KeyType key_array[Capacity + 1]; /**< This array contains all the primary keys which are stored in a node.
+    The +1 while defining the size of the array is to allow a buffer space during addition so that we can add a key to the array, check if array needs to be split,
+    and then take actions accordingly. The last space in the array is always empty during all operations, and split is called whenever it is filled. */
+
+    Node_base<KeyType>* children_array[Capacity + 1 + 1]; /**< This array stores all the pointers to the children nodes of the current node. Note that the size of this array
+    is +1 than that of the key array because there is one chiild more than the number of keys in a BTree. The other +1 is for a temporary space which will be utilised during the insert
+    function if the corresponding node is fully filled. Note that the last node will always be empty before a function is called or after a function returns */
+
+    /** Constructor for the Node_btree class. It sets the valid bits in the key array to zero, initialises the children array to 0 and sets NumberOfValidKeys to zero.
+    Nodes keep no pointer to their parent: the tree remembers the path from the root while it goes down, and goes back up along it.
+    @param node_level The level of the node in the tree. Inner nodes are always at level 1 or above. */
+    Node_btree(int node_level = 1)
+    {
+        for (int i = 0; i < Capacity + 1; i++)
+        {
+            key_array[i].valid = 0;
+            children_array[i] = 0;
+        }
+        children_array[Capacity + 1] = 0;
+        this->born = 0;
+        this->NumberOfValidKeys = 0;
+        this->level = node_level;
+    }
+};
+
+
+/// Specialisation of Node_btree for the leaves of the BTree.
+/** Leaves have no children, so the whole node apart from the header and the two sibling links is spent on keys. The leaves are linked to their neighbours on both sides, so that the
+    keys of the whole tree can be streamed in order without going back up through the inner nodes. */
+template <class KeyType, class Traits, int Capacity, size_t Alignment> class alignas(Alignment) Node_btree<KeyType, Traits, Capacity, true, Alignment>
+    : public Node_base<KeyType>, public Node_search_keys<Traits, Capacity + 1>
+{
+public:
+    static const int capacity = Capacity; /**< Maximum number of keys which the node holds outside of an insertion. */
+    static const bool leaf = true;
+
+    KeyType key_array[Capacity + 1]; /**< Keys stored in the leaf, with one buffer space at the end exactly like in inner nodes. */
+
+    Node_btree* next_leaf; /**< The leaf holding the keys right after the keys of this leaf. NULL for the last leaf. */
+
+    Node_btree* prev_leaf; /**< The leaf holding the keys right before the keys of this leaf. NULL for the first leaf. */
+
+    int tombstones; /**< Number of keys among the first NumberOfValidKeys whose valid bit was cleared by a lazy delete. They are skipped by lookups until the leaf is compacted. */
+
+    int16_t last_insert; /**< Position at which the last key added to the leaf was put, or -1. A key added right after it continues an ascending run of keys. */
+
+    int16_t run_length; /**< Number of keys added to the leaf one right after the other, up to the last one, counted up to RUN_MIN_LENGTH. Random inserts almost never get this above 1. */
+
+    /** Constructor for the leaves. It sets the valid bits in the key array to zero, NumberOfValidKeys to zero and both siblings of the node to NULL. */
+    Node_btree()
+    {
+        for (int i = 0; i < Capacity + 1; i++)
+            key_array[i].valid = 0;
+        next_leaf = NULL;
+        prev_leaf = NULL;
+        tombstones = 0;
+        last_insert = -1;
+        run_length = 0;
+        this->born = 0;
+        this->NumberOfValidKeys = 0;
+        this->level = 0;
+    }
+};
+
+
+/// The ways in which BTree::freeze lays a tree out in one contiguous run of nodes.
+enum class Frozen_layout
+{
+    none, /**< The tree is not frozen: its nodes are wherever they were allocated. */
+    breadth_first, /**< The inner nodes level by level from the root down, then the leaves in key order. The top levels, read by every lookup, share a few pages. */
+    van_emde_boas, /**< The inner nodes in van Emde Boas order, then the leaves in key order. Every subtree of half the height is contiguous, so a descent crosses few pages at every scale. */
+    implicit /**< Breadth first, with inner nodes which hold separators only: the children of a node are found by arithmetic on its index, so more separators fit in a node. */
+};
+
+
+/// The separators of an inner node of a BTreeMap (or of a BTree frozen in the implicit layout): only the normalized keys when the key traits normalize keys, and whole keys otherwise.
+/** Inner nodes only steer lookups, so with normalized keys they keep just the normalized forms (8 bytes for a primary_key) next to their children, and the fields of the keys
+    live in the leaves alone. Either way the array is named like in Node_btree, so the search kernels of BTree work on it unchanged. */
+template <class KeyType, class Traits, int Slots, bool Normalized = Traits::normalized> class Map_separators : public Node_search_keys<Traits, Slots>
+{
+public:
+    typedef typename Traits::normalized_type separator_type;
+};
+
+template <class KeyType, class Traits, int Slots> class Map_separators<KeyType, Traits, Slots, false>
+{
+public:
+    typedef KeyType separator_type;
+    KeyType key_array[Slots]; /**< The separators, which are keys when the traits do not normalize keys. */
+};
+
+
+/// An inner node of a BTree frozen in the implicit layout (see BTree::freeze), which holds separators and no children.
+/** The nodes of one level are stored one after the other, and the children of the node at index j are the nodes j * (Capacity + 1) to j * (Capacity + 1) + Capacity of the level
+    below. The whole node but the header is spent on separators, which are normalized keys when the traits normalize keys, like in the inner nodes of a BTreeMap. */
+template <class KeyType, class Traits, int Capacity, size_t Alignment> class alignas(Alignment) Node_implicit : public Node_base<KeyType>,
+    public Map_separators<KeyType, Traits, Capacity>
+{
+public:
+    static const int capacity = Capacity; /**< Number of separators of a full node, one less than its number of children. */
+
+    Node_implicit(int node_level)
+    {
+        this->born = 0;
+        this->NumberOfValidKeys = 0;
+        this->level = node_level;
+    }
+
+    /// Function to set the separator at an index.
+    void set_separator(int index, const KeyType& key)
+    {
+        if constexpr (Traits::normalized)
+            this->search_array[index] = Traits::normalize(key);
+        else
+            this->key_array[index] = key;
+    }
+};
+
+
+/// Compile time geometry of the nodes of a BTree whose nodes are meant to be NodeSize bytes large.
+/** The capacities are chosen so that a node, including the one key (and child) of buffer space used while splitting, fits in NodeSize bytes. Nodes of a page or more are aligned
+    to the page and smaller nodes to the cache line, so that a node never touches more cache lines or pages than it has to. For example, with 16 byte keys (and their 8 byte normalized
+    forms) a 4 KiB leaf holds 167 keys and a 4 KiB inner node 125 keys, so 50 million keys fit in a tree of 4 levels.
+*/
+template <class KeyType, size_t NodeSize, class Traits = key_traits<KeyType> > struct node_geometry
+{
+    static const size_t node_size = NodeSize;
+    static const size_t alignment = NodeSize >= PAGE_BYTES ? PAGE_BYTES : CACHE_LINE_SIZE;
+    static const size_t header_size = sizeof(Node_base<KeyType>);
+    static const size_t entry_size = sizeof(KeyType) + normalized_key_size<Traits>(); /**< Bytes taken by one key and its normalized form, if any. */
+
+    // Leaves: header + (capacity + 1) entries + 2 sibling links. Inner nodes: header + (capacity + 1) entries + (capacity + 2) children. Both with room for the padding in front
+    // of the pointers.
+    static const int leaf_capacity = (int)((NodeSize - header_size - 3 * sizeof(void*)) / entry_size) - 1;
+    static const int inner_capacity = (int)((NodeSize - header_size - 3 * sizeof(void*)) / (entry_size + sizeof(void*))) - 1;
+
+    typedef Node_btree<KeyType, Traits, leaf_capacity, true, alignment> leaf_node;
+    typedef Node_btree<KeyType, Traits, inner_capacity, false, alignment> inner_node;
+
+    // Implicit inner nodes: header + capacity search keys, with room for the padding after the header.
+    static const size_t separator_size = Traits::normalized ? normalized_key_size<Traits>() : sizeof(KeyType); /**< Bytes taken by one separator of an implicit node. */
+    static const int implicit_capacity = (int)((NodeSize - header_size - sizeof(void*)) / separator_size);
+    typedef Node_implicit<KeyType, Traits, implicit_capacity, alignment> implicit_node;
+
+    static_assert(NodeSize % alignment == 0, "The node size has to be a multiple of the cache line size.");
+    static_assert(leaf_capacity >= 3 && inner_capacity >= 3, "The node size is too small to hold three keys. Increase NodeSize.");
+    static_assert(leaf_capacity <= INT16_MAX, "Positions in a leaf are kept in 16 bits, so a leaf cannot hold more keys than that.");
+    static_assert(sizeof(leaf_node) <= NodeSize && sizeof(inner_node) <= NodeSize && sizeof(implicit_node) <= NodeSize, "Node layout does not fit in the target node size.");
+};
+
+
+/// A pool of fixed size, aligned memory blocks from which a BTree allocates all its nodes.
+/** Blocks are carved out of large slabs (SLAB_BYTES each) obtained straight from mmap, so that allocating a node is popping a free list or bumping a pointer, and nodes of the
+    same tree sit close together in memory. Freed blocks go back on an intrusive free list and are reused by the next allocation. Optionally the slabs are backed by huge pages,
+    which cuts down the TLB misses of a large tree; if the system has no huge pages reserved, transparent huge pages are asked for instead. Every slab is given back to the system
+    at once by release_all, so destroying a tree does not have to visit its nodes.
+    Every node type of a tree has to fit in BlockSize bytes, and BlockSize has to be a multiple of Alignment (which is at most the page size). */
+template <size_t BlockSize, size_t Alignment> class Node_allocator
+{
+private:
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    std::vector<std::pair<void*, size_t> > slabs; /**< Every slab obtained from the system with its size, so that they can be released together. */
+    char* bump; /**< Next never used block in the newest slab. */
+    char* bump_end; /**< End of the newest slab. */
+    free_block* free_list; /**< Blocks which were used and freed, and can be handed out again. */
+    size_t blocks_in_use; /**< Number of blocks handed out and not freed yet. */
+    size_t free_blocks; /**< Number of blocks in the free list. */
+    size_t mapped_bytes; /**< Bytes of all the slabs together. */
+    bool huge_pages; /**< Whether slabs are backed by huge pages. */
+
+public:
+    static const size_t slab_bytes = SLAB_BYTES > BlockSize ? SLAB_BYTES : BlockSize; /**< Bytes in one slab. A slab always holds at least one block. */
+
+    Node_allocator(bool use_huge_pages = false)
+    {
+        bump = NULL;
+        bump_end = NULL;
+        free_list = NULL;
+        blocks_in_use = 0;
+        free_blocks = 0;
+        mapped_bytes = 0;
+        huge_pages = use_huge_pages;
+    }
+
+    ~Node_allocator()
+    {
+        release_all();
+    }
+
+    Node_allocator(const Node_allocator&) = delete;
+    Node_allocator& operator=(const Node_allocator&) = delete;
+
+    /// Function to get a block of BlockSize bytes aligned to Alignment. The block is uninitialised.
+    void* allocate()
+    {
+        blocks_in_use++;
+        if (free_list != NULL)
+        {
+            free_block* block = free_list;
+            free_list = block->next;
+            free_blocks--;
+            return block;
+        }
+        if (bump == bump_end)
+            add_slab();
+        void* block = bump;
+        bump += BlockSize;
+        return block;
+    }
+
+    /// Function to get count blocks which follow each other in memory, from a slab mapped for them alone. The pool treats them as count blocks handed out one by one.
+    /** A tree laid out in one run (see BTree::freeze) crosses fewer pages than one whose nodes were allocated over time, and with huge pages the whole run shares a handful of
+        TLB entries. Blocks of the run are freed one by one like any other block. */
+    void* allocate_run(size_t count)
+    {
+        size_t bytes = (count * BlockSize + slab_bytes - 1) / slab_bytes * slab_bytes;
+        void* run = map_slab(bytes);
+        blocks_in_use += count;
+        return run;
+    }
+
+    /// Function to give a block back to the pool. The block is reused by a later allocation, it is never returned to the system before release_all.
+    void deallocate(void* block)
+    {
+        free_block* freed = (free_block*)block;
+        freed->next = free_list;
+        free_list = freed;
+        free_blocks++;
+        blocks_in_use--;
+    }
+
+    /// Function to give every slab back to the system. All blocks ever handed out become invalid.
+    void release_all()
+    {
+        for (size_t i = 0; i < slabs.size(); i++)
+            munmap(slabs[i].first, slabs[i].second);
+        slabs.clear();
+        mapped_bytes = 0;
+        bump = NULL;
+        bump_end = NULL;
+        free_list = NULL;
+        blocks_in_use = 0;
+        free_blocks = 0;
+    }
+
+    size_t used_blocks() const { return blocks_in_use; } /**< Number of blocks in use. */
+    size_t reusable_blocks() const { return free_blocks; } /**< Number of freed blocks waiting to be reused, a measure of fragmentation. */
+    size_t reserved_bytes() const { return mapped_bytes; } /**< Bytes obtained from the system. */
+
+private:
+    /// Function to map one more slab and start bumping through it.
+    void add_slab()
+    {
+        bump = (char*)map_slab(slab_bytes);
+        bump_end = bump + (slab_bytes / BlockSize) * BlockSize;
+    }
+
+    /// Function to map a slab of the given size (a multiple of slab_bytes) from the system, backed by huge pages if they were asked for.
+    void* map_slab(size_t bytes)
+    {
+        static_assert(BlockSize % Alignment == 0 && Alignment <= PAGE_BYTES, "Blocks must keep their alignment inside a page aligned slab.");
+        void* slab = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (huge_pages)
+            slab = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (slab == MAP_FAILED)
+        {
+            slab = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (slab == MAP_FAILED)
+                throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+            if (huge_pages)
+                madvise(slab, bytes, MADV_HUGEPAGE);
+#endif
+        }
+        slabs.push_back(std::make_pair(slab, bytes));
+        mapped_bytes += bytes;
+        return slab;
+    }
+};
+
+
+/// A histogram of counts (like comparisons per lookup), with power of two buckets: bucket 0 holds the value 0, and bucket b the values from 2^(b-1) to 2^b - 1.
+struct Histogram
+{
+    static const int bucket_count = 65;
+    uint64_t buckets[bucket_count]; /**< Number of values added in each bucket. */
+    uint64_t count; /**< Number of values added. */
+    uint64_t sum; /**< Sum of the values added. */
+    uint64_t largest; /**< Largest value added. */
+
+    Histogram()
+    {
+        memset(buckets, 0, sizeof(buckets));
+        count = 0;
+        sum = 0;
+        largest = 0;
+    }
+
+    /// Function to add a value to the histogram.
+    void add(uint64_t value)
+    {
+        buckets[value == 0 ? 0 : 64 - __builtin_clzll(value)]++;
+        count++;
+        sum += value;
+        largest = value > largest ? value : largest;
+    }
+
+    /// Mean of the values added, 0 if there is none.
+    double mean() const
+    {
+        return count == 0 ? 0.0 : (double)sum / count;
+    }
+
+    /// Function to write the histogram as a JSON object. The buckets are listed up to the last one which is not empty.
+    void write_json(std::ostream& out) const
+    {
+        int used = bucket_count;
+        while (used > 0 && buckets[used - 1] == 0)
+            used--;
+        out << "{\"count\": " << count << ", \"sum\": " << sum << ", \"max\": " << largest << ", \"mean\": " << mean() << ", \"buckets\": [";
+        for (int b = 0; b < used; b++)
+            out << (b == 0 ? "" : ", ") << buckets[b];
+        out << "]}";
+    }
+};
+
+
+/// A split block Bloom filter over 64 bit hashes, which answers whether a hash may have been added or certainly was not, reading one block of 32 bytes.
+/** Every hash picks a block with its upper half, and sets (or tests) one bit in each of the eight 32 bit words of the block, chosen by its lower half times eight odd constants.
+    As all the bits of a hash are in one block, which never straddles a cache line, a question costs a single cache miss instead of one per bit, for a false positive rate a little
+    above that of a classic Bloom filter of the same size. Hashes cannot be taken out again: the owner of the filter rebuilds it once too many of them are stale. */
+class Bloom_filter
+{
+public:
+    Bloom_filter()
+    {
+        added = 0;
+        room = 0;
+    }
+
+    /// Function to empty the filter and size it so that it answers with the given false positive rate until it holds the given number of hashes.
+    void reset(size_t capacity, double false_positive_rate)
+    {
+        double bits_per_hash = 4;
+        while (bits_per_hash < 64 && rate_at(bits_per_hash) > false_positive_rate)
+            bits_per_hash += 0.5;
+        size_t count = (size_t)ceil(capacity * bits_per_hash / block_bits);
+        blocks.assign(count > 0 ? count : 1, bloom_block());
+        added = 0;
+        room = capacity;
+    }
+
+    /// Function to add a hash to the filter.
+    void add(uint64_t hash)
+    {
+        bloom_block& block = blocks[pick(hash)];
+        for (int i = 0; i < 8; i++)
+            block.words[i] |= bit(hash, i);
+        added++;
+    }
+
+    /// Function to test a hash: false if it was certainly not added since the last reset, true if it may have been.
+    bool may_contain(uint64_t hash) const
+    {
+        const bloom_block& block = blocks[pick(hash)];
+        uint32_t missing = 0;
+        for (int i = 0; i < 8; i++)
+            missing |= ~block.words[i] & bit(hash, i);
+        return missing == 0;
+    }
+
+    size_t size() const { return added; } /**< Number of hashes added since the last reset, stale ones included. */
+    size_t capacity() const { return room; } /**< Number of hashes for which the filter was sized. */
+    size_t memory_bytes() const { return blocks.size() * sizeof(bloom_block); } /**< Bytes taken by the blocks. */
+
+    /// The false positive rate of a filter holding one hash per bits_per_hash bits: the chance that the eight bits of a new hash are set in a block which got a Poisson number of hashes.
+    static double rate_at(double bits_per_hash)
+    {
+        double mean = block_bits / bits_per_hash; // hashes per block on average.
+        double chance = exp(-mean), rate = 0;
+        for (int hashes = 0; hashes < 4 * block_bits; hashes++)
+        {
+            rate += chance * pow(1 - pow(1 - 1.0 / 32, hashes), 8);
+            chance *= mean / (hashes + 1);
+        }
+        return rate;
+    }
+
+private:
+    static const int block_bits = 256; /**< Bits of a block. */
+
+    /// A block of the filter: eight words, in half a cache line.
+    struct alignas(32) bloom_block
+    {
+        uint32_t words[8];
+    };
+
+    /// Function to pick the block of a hash, by multiplying its upper half with the number of blocks rather than by a modulo.
+    size_t pick(uint64_t hash) const
+    {
+        return (size_t)(((hash >> 32) * blocks.size()) >> 32);
+    }
+
+    /// The bit of a hash in the word i of its block.
+    static uint32_t bit(uint64_t hash, int i)
+    {
+        static const uint32_t salts[8] = { 0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du, 0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u };
+        return 1u << (((uint32_t)hash * salts[i]) >> 27);
+    }
+
+    std::vector<bloom_block> blocks; /**< The blocks of the filter. */
+    size_t added; /**< Number of hashes added since the last reset. */
+    size_t room; /**< Number of hashes for which the filter was sized. */
+};
+
+
+/// The counters of a BTree and a picture of its shape, see BTree::stats.
+/** The counters are updated as the tree is used, unless BTREE_STATS is 0. Lookups are the descents of find, lower_bound, upper_bound, equal_range, search_key and multi_get.
+    The shape (height, nodes and how full they are) is measured by stats when it is called. The fill of the nodes is given in tenths of their capacity: fill bucket i counts the
+    nodes holding from i tenths up to (but not including) i + 1 tenths of the keys they can hold, and bucket 10 the full nodes. */
+struct Tree_stats
+{
+    static const int max_levels = 32; /**< Levels for which splits, merges and borrows are counted. Trees are never nearly as high. */
+
+    uint64_t lookups; /**< Number of lookups. */
+    uint64_t inserts; /**< Number of keys added. */
+    uint64_t hinted_inserts; /**< Number of keys added to the leaf of the previous insertion without going down the tree. */
+    uint64_t deletes; /**< Number of keys removed. */
+    uint64_t filtered_lookups; /**< Number of lookups of absent keys answered by the filter of the tree, without going down the tree. Not counted in lookups. */
+    uint64_t filter_false_positives; /**< Number of lookups let through by the filter of the tree which found no key. */
+    Histogram comparisons; /**< Key comparisons done by the node searches of every lookup. */
+    Histogram nodes_visited; /**< Nodes read by every lookup: one per level, and one more when the bound is in the leaf after the one reached. */
+    Histogram shift_distance; /**< Number of keys moved inside a node to open a gap for a key, or to close the gaps of keys removed. */
+    uint64_t splits[max_levels]; /**< Number of nodes split, on every level (0 for leaves). */
+    uint64_t merges[max_levels]; /**< Number of nodes merged into a sibling, on every level. */
+    uint64_t borrows[max_levels]; /**< Number of times a node took keys from a sibling, on every level. */
+
+    int height; /**< Number of levels of the tree, 0 if it is empty. */
+    uint64_t keys; /**< Number of keys in the tree. */
+    uint64_t leaves; /**< Number of leaves. */
+    uint64_t inner_nodes; /**< Number of inner nodes. */
+    uint64_t leaf_fill[11]; /**< Number of leaves in each tenth of fill. */
+    uint64_t inner_fill[11]; /**< Number of inner nodes in each tenth of fill. */
+
+    Tree_stats()
+    {
+        lookups = 0;
+        inserts = 0;
+        hinted_inserts = 0;
+        deletes = 0;
+        filtered_lookups = 0;
+        filter_false_positives = 0;
+        memset(splits, 0, sizeof(splits));
+        memset(merges, 0, sizeof(merges));
+        memset(borrows, 0, sizeof(borrows));
+        height = 0;
+        keys = 0;
+        leaves = 0;
+        inner_nodes = 0;
+        memset(leaf_fill, 0, sizeof(leaf_fill));
+        memset(inner_fill, 0, sizeof(inner_fill));
+    }
+
+    /// Function to write the statistics as a JSON object, for tools which scrape them.
+    void write_json(std::ostream& out) const
+    {
+        out << "{\"lookups\": " << lookups << ", \"inserts\": " << inserts << ", \"hinted_inserts\": " << hinted_inserts << ", \"deletes\": " << deletes << ", \"filtered_lookups\": " << filtered_lookups
+            << ", \"filter_false_positives\": " << filter_false_positives << ", \"comparisons\": ";
+        comparisons.write_json(out);
+        out << ", \"nodes_visited\": ";
+        nodes_visited.write_json(out);
+        out << ", \"shift_distance\": ";
+        shift_distance.write_json(out);
+        write_levels(out, "splits", splits);
+        write_levels(out, "merges", merges);
+        write_levels(out, "borrows", borrows);
+        out << ", \"height\": " << height << ", \"keys\": " << keys << ", \"leaves\": " << leaves << ", \"inner_nodes\": " << inner_nodes;
+        write_array(out, "leaf_fill", leaf_fill, 11);
+        write_array(out, "inner_fill", inner_fill, 11);
+        out << "}";
+    }
+
+    /// The statistics as a JSON string.
+    std::string json() const
+    {
+        std::ostringstream out;
+        write_json(out);
+        return out.str();
+    }
+
+private:
+    /// Function to write a per level counter as a JSON array, up to the highest level with a count.
+    static void write_levels(std::ostream& out, const char* name, const uint64_t* counts)
+    {
+        int used = max_levels;
+        while (used > 0 && counts[used - 1] == 0)
+            used--;
+        write_array(out, name, counts, used);
+    }
+
+    /// Function to write a member holding a JSON array of numbers.
+    static void write_array(std::ostream& out, const char* name, const uint64_t* values, int n)
+    {
+        out << ", \"" << name << "\": [";
+        for (int i = 0; i < n; i++)
+            out << (i == 0 ? "" : ", ") << values[i];
+        out << "]";
+    }
+};
+
+
+/// A pool of threads which run the tasks of parallel scans, with a queue of tasks per thread and stealing between the queues.
+/** run splits the tasks into one contiguous share per thread of the pool, the calling thread included, which each thread works through from the front of its own queue. A
+    thread whose queue is empty steals from the back of the other queues, so that threads which got cheap tasks take over the rest of the expensive shares. Tasks are coarse
+    (whole subtrees), so every queue is a deque behind a mutex. A run without stealing leaves every task to the thread whose share it is in, so that a run with the same count
+    always gives task i to the same thread. The pool runs one run at a time, and a task must not start a run of its own. An exception thrown by a task is thrown again by run
+    once every other task is done.
+*/
+class Scan_pool
+{
+public:
+    /** Constructor for the Scan_pool. It starts threads - 1 threads, which wait for runs.
+    @param threads  Number of threads which work on a run, the thread calling run included. 0 for the number of hardware threads. */
+    explicit Scan_pool(int threads = 0)
+    {
+        thread_count = threads > 0 ? threads : std::max(1, (int)std::thread::hardware_concurrency());
+        queues.reset(new task_queue[thread_count]);
+        job = NULL;
+        stealing = true;
+        generation = 0;
+        active = 0;
+        stopping = false;
+        for (int t = 1; t < thread_count; t++)
+            workers.push_back(std::thread(&Scan_pool::work, this, t));
+    }
+
+    /** Destructor for the Scan_pool, which stops its threads. */
+    ~Scan_pool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+    }
+
+    Scan_pool(const Scan_pool&) = delete;
+    Scan_pool& operator=(const Scan_pool&) = delete;
+
+/// Function to run task(index, worker) for every index in [0, count) on the threads of the pool, and wait until they are all done.
+/** @param count    Number of tasks.
+    @param task     Called with the index of a task and the index (from 0 to size() - 1) of the thread running it. The calling thread is thread 0.
+    @param steal    Whether threads which are done with their share take tasks from the shares of others. */
+    template <class Task> void run(size_t count, Task task, bool steal = true)
+    {
+        std::function<void(size_t, int)> wrapped = [&task](size_t index, int worker) { task(index, worker); };
+        std::lock_guard<std::mutex> one_run(run_lock);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [this]() { return active == 0; }); // threads which woke up late for the previous run may still be looking for tasks.
+            for (int t = 0; t < thread_count; t++)
+            {
+                std::lock_guard<std::mutex> queue_guard(queues[t].lock);
+                for (size_t i = count * t / thread_count; i < count * (t + 1) / thread_count; i++)
+                    queues[t].tasks.push_back(i);
+            }
+            remaining = count;
+            failure = nullptr;
+            job = &wrapped;
+            stealing = steal;
+            generation++;
+        }
+        wake.notify_all();
+        drain(0, &wrapped, steal);
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [this]() { return remaining == 0 && active == 0; });
+        job = NULL;
+        if (failure)
+        {
+            std::exception_ptr thrown = failure;
+            failure = nullptr;
+            std::rethrow_exception(thrown);
+        }
+    }
+
+    int size() const { return thread_count; } /**< Number of threads working on a run, the calling thread included. */
+
+/// The pool shared by all trees, with a thread per hardware thread. It is started the first time it is used.
+    static Scan_pool& shared()
+    {
+        static Scan_pool pool;
+        return pool;
+    }
+
+private:
+    /// The tasks waiting in the queue of one thread.
+    struct task_queue
+    {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    int thread_count; /**< Number of threads working on a run, the calling thread included. */
+    std::unique_ptr<task_queue[]> queues; /**< The queue of every thread. */
+    std::vector<std::thread> workers; /**< The threads of the pool, which are threads 1 to thread_count - 1. */
+    std::mutex run_lock; /**< Held for a whole run, so that runs do not overlap. */
+    std::mutex lock; /**< Protects the fields below. */
+    std::condition_variable wake; /**< Signalled when a run starts or the pool stops. */
+    std::condition_variable finished; /**< Signalled when the last thread working on a run is done. */
+    std::function<void(size_t, int)>* job; /**< The task of the current run. */
+    bool stealing; /**< Whether the threads steal tasks in the current run. */
+    uint64_t generation; /**< Number of runs started, which tells the threads that a new one started. */
+    int active; /**< Number of threads of the pool working on a run. */
+    bool stopping; /**< Whether the pool is being destroyed. */
+    std::atomic<size_t> remaining; /**< Number of tasks of the current run not done yet. */
+    std::exception_ptr failure; /**< The first exception thrown by a task of the current run. */
+
+/// Function to take a task: the first one of the own queue of a thread, or else (when stealing) the last one of another queue.
+/** @return Whether there was a task left. */
+    bool take(int worker, size_t& index, bool steal)
+    {
+        for (int i = 0; i < (steal ? thread_count : 1); i++)
+        {
+            task_queue& queue = queues[(worker + i) % thread_count];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.tasks.empty())
+                continue;
+            if (i == 0)
+            {
+                index = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            else
+            {
+                index = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+/// Function to run tasks until there are none left.
+    void drain(int worker, std::function<void(size_t, int)>* task, bool steal)
+    {
+        size_t index;
+        while (take(worker, index, steal))
+        {
+            try
+            {
+                (*task)(index, worker);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (!failure)
+                    failure = std::current_exception();
+            }
+            remaining--;
+        }
+    }
+
+/// The loop of a thread of the pool: wait for a run, work on it until there are no tasks left, and wait again.
+    void work(int worker)
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;)
+        {
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            std::function<void(size_t, int)>* task = job;
+            bool steal = stealing;
+            active++;
+            guard.unlock();
+            if (task != NULL)
+                drain(worker, task, steal);
+            guard.lock();
+            if (--active == 0)
+                finished.notify_all();
+        }
+    }
+};
+
+
+/// A template class which implements the BTree. The template depends on the primary key being used.
+/** This class implements all the functionalities of the BTree. The main functions of the BTree are insert, search and delete. A print function is also included to
+see the BTree at any point of time for human verification of any aspect. Every node of the BTree is of the type Node_btree, with the keys in every node as the template type.
+    All keys are stored in the leaves (the tree is a B+ tree): the keys of the inner nodes are copies which only separate the children, and the leaves are linked into a list in
+    key order, which is what the iterators, lower_bound, upper_bound and equal_range walk through.
+    The second template parameter is the target size of a node in bytes (for example 256 for a few cache lines, 4096 or 16384 for a page), from which the number of keys in the leaves
+    and in the inner nodes is worked out at compile time. The third one is the key traits class which orders the keys (see key_traits).
+    All nodes of a tree come from its own Node_allocator, and are released together when the tree is destroyed.
+    Deleting a key removes it from its leaf, and a node left with fewer keys than the minimum fill borrows keys from a sibling or is merged with it, so that the tree shrinks
+    again as keys go. In lazy delete mode a delete only clears the valid bit of the key, which turns it into a tombstone that lookups skip, and the leaves are compacted later. */
+template <class KeyType, size_t NodeSize = BLOCK_SIZE, class Traits = key_traits<KeyType> > class BTree
+{
+public:
+    typedef node_geometry<KeyType, NodeSize, Traits> geometry;
+    typedef Node_base<KeyType> base_node;
+    typedef typename geometry::leaf_node leaf_node;
+    typedef typename geometry::inner_node inner_node;
+    typedef typename geometry::implicit_node implicit_node;
+    static const int leaf_capacity = geometry::leaf_capacity; /**< Number of keys held by a full leaf. */
+    static const int inner_capacity = geometry::inner_capacity; /**< Number of keys held by a full inner node. */
+    static const int implicit_fanout = geometry::implicit_capacity + 1; /**< Number of children of a full inner node in the implicit layout. */
+
+private:
+    base_node *root; /**< Pointer to the root node of the BTree. */
+    leaf_node *first_leaf; /**< The leftmost leaf, where iteration in order starts. */
+    leaf_node *last_leaf; /**< The rightmost leaf, where iteration in reverse order starts. */
+    Node_allocator<NodeSize, geometry::alignment> allocator; /**< The pool from which every node of the tree is allocated. */
+    size_t key_count; /**< Number of keys in the tree, not counting tombstones. */
+    size_t tombstone_count; /**< Number of tombstones left by lazy deletes in all leaves together. */
+    int min_leaf_keys; /**< A leaf (other than the root) with fewer keys than this is rebalanced with a sibling. */
+    int min_inner_keys; /**< An inner node (other than the root) with fewer keys than this is rebalanced with a sibling. */
+    bool lazy_delete; /**< Whether deletes leave tombstones instead of removing keys right away. */
+    double tombstone_limit; /**< Fraction of all the keys which may be tombstones before a lazy delete compacts the whole tree. */
+
+    /// The part of a snapshot shared between the tree and the snapshot handle. The tree deletes it once the handle has released it.
+    struct snapshot_state
+    {
+        base_node* root; /**< Root of the tree when the snapshot was taken. */
+        uint64_t epoch; /**< Epoch in which the snapshot was taken. It holds every node born in this epoch or before which was in the tree then. */
+        size_t keys; /**< Number of keys in the tree when the snapshot was taken. */
+        std::atomic<bool> released; /**< Set by the handle when it is done with the snapshot. */
+    };
+
+    uint64_t current_epoch; /**< Epoch of the tree, which goes up by one with every snapshot taken. New nodes are born in it. */
+    uint64_t pinned_epoch; /**< Epoch of the newest snapshot still held, or 0 if there is none. Nodes born after it can be written in place. */
+    std::vector<snapshot_state*> snapshots; /**< Every snapshot taken and not reclaimed yet, oldest first. */
+    std::vector<std::pair<base_node*, uint64_t> > retired; /**< Nodes taken out of the tree while a snapshot may still read them, with the epoch in which they were taken out. */
+    mutable Tree_stats counters; /**< The counters of stats. Lookups update them too, which is why they are mutable. */
+
+    static const int max_height = 64; /**< Bound on the height of the tree. Every inner node but the root has at least two children, so the height is at most log2 of the number of keys. */
+
+    /// The nodes on the way from the root down to a leaf, by level, with the child taken in every inner node. Nodes keep no parent pointer, so changes go back up along it.
+    struct node_path
+    {
+        base_node* nodes[max_height]; /**< The node of every level on the way: nodes[0] is the leaf and nodes[root->level] the root. */
+        int slots[max_height]; /**< For every inner level l, the index of nodes[l - 1] among the children of nodes[l]. */
+    };
+
+    /// The path of the last insertion and the range of keys which belong in its leaf, so that the next key of that range is added without going down the tree.
+    struct insert_hint
+    {
+        node_path path; /**< The path of the last insertion, from its leaf up to the root. */
+        KeyType lower; /**< Keys from lower on belong in the leaf, if has_lower. It is the separator right before the leaf in the lowest ancestor which has one. */
+        KeyType upper; /**< Keys below upper belong in the leaf, if has_upper. It is the separator right after the leaf in the lowest ancestor which has one. */
+        bool has_lower; /**< Whether the leaf has a separator before it, i.e. is not the first leaf. */
+        bool has_upper; /**< Whether the leaf has a separator after it, i.e. is not the last leaf. */
+        uint64_t version; /**< The structure_version for which the path holds. */
+    };
+
+    insert_hint hint; /**< Where the last insertion went. */
+    uint64_t structure_version; /**< Goes up whenever nodes are created or taken out of the tree, or separators move, which makes the insert hint stale. */
+    Frozen_layout layout; /**< The layout in which the tree was frozen, or none if it was changed since. See freeze. */
+    char* frozen_nodes; /**< The run of blocks of a tree frozen in the implicit layout, NULL for any other tree. */
+    size_t implicit_levels[max_height]; /**< In the implicit layout, the index in frozen_nodes of the first node of every level. The levels follow each other from the root down. */
+    Bloom_filter filter; /**< Hashes of the keys added, which exact lookups ask before going down the tree when filtering is on. See set_filter. */
+    bool filtering; /**< Whether the filter is kept up to date and asked by lookups. */
+    double filter_rate; /**< The false positive rate for which the filter is sized. */
+public:
+
+    /// An iterator over the keys of the BTree in sorted order.
+    /** The iterator points to a position in a leaf. Moving it forward or backward goes through the sibling links of the leaves, so streaming k keys after a seek costs O(k) and
+        never goes back up the tree. The end iterator has no leaf, and moving back from it starts at the last leaf. Tombstones left by lazy deletes are stepped over. Any insertion
+        or deletion invalidates all iterators, as keys move between positions and nodes. */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef KeyType value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef KeyType* pointer;
+        typedef KeyType& reference;
+
+        iterator() : tree(NULL), leaf(NULL), index(0) {}
+        iterator(const BTree* owner, leaf_node* at, int position) : tree(owner), leaf(at), index(position) {}
+
+        KeyType& operator*() const { return leaf->key_array[index]; }
+        KeyType* operator->() const { return &leaf->key_array[index]; }
+
+        iterator& operator++()
+        {
+            index++;
+            skip_tombstones();
+            return *this;
+        }
+
+        iterator& operator--()
+        {
+            if (leaf == NULL)
+            {
+                leaf = tree->last_leaf;
+                index = leaf->NumberOfValidKeys;
+            }
+            do
+            {
+                while (index == 0)
+                {
+                    leaf = leaf->prev_leaf;
+                    index = leaf->NumberOfValidKeys;
+                }
+                index--;
+            } while (leaf->tombstones != 0 && !leaf->key_array[index].valid);
+            return *this;
+        }
+
+        iterator operator++(int) { iterator old = *this; ++(*this); return old; }
+        iterator operator--(int) { iterator old = *this; --(*this); return old; }
+        bool operator==(const iterator& other) const { return leaf == other.leaf && index == other.index; }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        /// Moves the iterator forward until it is on a live key, going on to the next leaves when it is past the last key of its leaf.
+        void skip_tombstones()
+        {
+            while (leaf != NULL)
+            {
+                if (index >= leaf->NumberOfValidKeys)
+                {
+                    leaf = leaf->next_leaf;
+                    index = 0;
+                }
+                else if (leaf->tombstones != 0 && !leaf->key_array[index].valid)
+                    index++;
+                else
+                    return;
+            }
+        }
+
+        const BTree* tree; /**< The tree iterated over. Needed to step back from the end iterator. */
+        leaf_node* leaf; /**< The leaf of the current key. NULL for the end iterator. */
+        int index; /**< Index of the current key in the key array of leaf. */
+        friend class BTree;
+    };
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    /// A consistent, read-only view of the BTree as it was when the snapshot was taken, see take_snapshot.
+    /** The snapshot pins the root of the tree of that moment, and every node below it stays unchanged (and allocated) until the snapshot is released, however the tree changes in
+        the meantime. A snapshot may be read from any number of threads, also while the thread owning the tree keeps inserting and deleting. Only the fields which a writer never
+        changes on a shared node are read, which is why the iterator climbs through a stack of the inner nodes above it rather than following the sibling links of the leaves.
+        The snapshot is released by release() or by its destructor, which may run on any thread. Every snapshot has to be released before the tree is destroyed. */
+    class snapshot
+    {
+    public:
+        /// A forward iterator over the keys of a snapshot in sorted order. Tombstones are stepped over.
+        class iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef KeyType value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const KeyType* pointer;
+            typedef const KeyType& reference;
+
+            iterator() : leaf(NULL), index(0) {}
+
+            const KeyType& operator*() const { return leaf->key_array[index]; }
+            const KeyType* operator->() const { return &leaf->key_array[index]; }
+
+            iterator& operator++()
+            {
+                index++;
+                skip_tombstones();
+                return *this;
+            }
+
+            iterator operator++(int) { iterator old = *this; ++(*this); return old; }
+            bool operator==(const iterator& other) const { return leaf == other.leaf && index == other.index; }
+            bool operator!=(const iterator& other) const { return !(*this == other); }
+
+        private:
+            /// Function to go down from a node to a leaf, taking the child left of the first separator not smaller (larger, if upper) than the probe, and stopping at the bound
+            /// in the leaf. The inner nodes passed are pushed on the path.
+            template <class Probe> void seek(const base_node* current, const Probe& probe, bool upper)
+            {
+                while (current->level != 0)
+                {
+                    const inner_node* inner = (const inner_node*)current;
+                    int position = upper ? upper_index(inner, probe) : lower_index(inner, probe);
+                    path.push_back(std::make_pair(inner, position));
+                    current = inner->children_array[position];
+                }
+                leaf = (const leaf_node*)current;
+                index = upper ? upper_index(leaf, probe) : lower_index(leaf, probe);
+                skip_tombstones();
+            }
+
+            /// Function to go down from a node to its leftmost leaf, pushing the inner nodes passed on the path.
+            void leftmost(const base_node* current)
+            {
+                while (current->level != 0)
+                {
+                    const inner_node* inner = (const inner_node*)current;
+                    path.push_back(std::make_pair(inner, 0));
+                    current = inner->children_array[0];
+                }
+                leaf = (const leaf_node*)current;
+                index = 0;
+            }
+
+            /// Moves the iterator forward until it is on a live key. Past the last key of a leaf, it climbs the path up to the first inner node with a child to the right
+            /// left, and goes down to the leftmost leaf of that child.
+            void skip_tombstones()
+            {
+                while (leaf != NULL)
+                {
+                    if (index >= leaf->NumberOfValidKeys)
+                    {
+                        while (!path.empty() && path.back().second == path.back().first->NumberOfValidKeys)
+                            path.pop_back();
+                        if (path.empty())
+                        {
+                            leaf = NULL;
+                            index = 0;
+                            return;
+                        }
+                        path.back().second++;
+                        const inner_node* inner = path.back().first;
+                        leftmost(inner->children_array[path.back().second]);
+                    }
+                    else if (leaf->tombstones != 0 && !leaf->key_array[index].valid)
+                        index++;
+                    else
+                        return;
+                }
+            }
+
+            std::vector<std::pair<const inner_node*, int> > path; /**< The inner nodes from the root down to the leaf, each with the index of the child taken. */
+            const leaf_node* leaf; /**< The leaf of the current key. NULL for the end iterator. */
+            int index; /**< Index of the current key in the key array of leaf. */
+            friend class snapshot;
+        };
+
+        snapshot() : state(NULL) {}
+        snapshot(snapshot&& other) : state(other.state) { other.state = NULL; }
+        snapshot& operator=(snapshot&& other)
+        {
+            if (this != &other)
+            {
+                release();
+                state = other.state;
+                other.state = NULL;
+            }
+            return *this;
+        }
+        snapshot(const snapshot&) = delete;
+        snapshot& operator=(const snapshot&) = delete;
+
+        ~snapshot()
+        {
+            release();
+        }
+
+        /// Function to give the snapshot up. The nodes only it still holds are freed by the next write to the tree. The snapshot is empty afterwards.
+        void release()
+        {
+            if (state != NULL)
+                state->released.store(true, std::memory_order_release);
+            state = NULL;
+        }
+
+        /// Whether the snapshot still holds a view of the tree, i.e. it was taken and not released.
+        bool valid() const
+        {
+            return state != NULL;
+        }
+
+        /// Number of keys in the snapshot.
+        size_t size() const
+        {
+            return state->keys;
+        }
+
+        /// Iterator to the smallest key of the snapshot.
+        iterator begin() const
+        {
+            iterator first;
+            if (state->root != NULL)
+            {
+                first.leftmost(state->root);
+                first.skip_tombstones();
+            }
+            return first;
+        }
+
+        /// Iterator past the largest key of the snapshot.
+        iterator end() const
+        {
+            return iterator();
+        }
+
+        /// Function which returns an iterator to the first key of the snapshot which is not smaller than the given probe. Like BTree::lower_bound.
+        template <class Probe> iterator lower_bound(const Probe& probe) const
+        {
+            iterator position;
+            if (state->root != NULL)
+                position.seek(state->root, probe, false);
+            return position;
+        }
+
+        /// Function which returns an iterator to the first key of the snapshot which is larger than the given probe. Like BTree::upper_bound.
+        template <class Probe> iterator upper_bound(const Probe& probe) const
+        {
+            iterator position;
+            if (state->root != NULL)
+                position.seek(state->root, probe, true);
+            return position;
+        }
+
+        /// Function which returns an iterator to a key of the snapshot matching the given probe, or the end iterator if there is none.
+        template <class Probe> iterator find(const Probe& probe) const
+        {
+            iterator position = lower_bound(probe);
+            if (position.leaf != NULL && matches(position.leaf, position.index, probe))
+                return position;
+            return end();
+        }
+
+        /// Function which returns the range of keys of the snapshot matching the given probe, as a pair of lower_bound and upper_bound.
+        template <class Probe> std::pair<iterator, iterator> equal_range(const Probe& probe) const
+        {
+            return std::make_pair(lower_bound(probe), upper_bound(probe));
+        }
+
+    private:
+        snapshot(snapshot_state* taken) : state(taken) {}
+
+        snapshot_state* state; /**< The state shared with the tree. NULL once released. */
+        friend class BTree;
+    };
+
+    /** Constructor for the BTree. It sets the root pointer of the tree as NULL
+    @param use_huge_pages   Whether the slabs from which nodes are allocated should be backed by huge pages. */
+    BTree(bool use_huge_pages = false) : allocator(use_huge_pages)
+    {
+        root = NULL;
+        first_leaf = NULL;
+        last_leaf = NULL;
+        key_count = 0;
+        tombstone_count = 0;
+        lazy_delete = false;
+        tombstone_limit = TOMBSTONE_LIMIT;
+        set_min_fill(MIN_FILL_FACTOR);
+        current_epoch = 1;
+        pinned_epoch = 0;
+        structure_version = 1;
+        hint.version = 0;
+        layout = Frozen_layout::none;
+        frozen_nodes = NULL;
+        filtering = false;
+        filter_rate = FILTER_FALSE_POSITIVE_RATE;
+    }
+
+    /** Destructor for the BTree. The nodes are released together with the slabs of the allocator. Only keys which need a destructor make the tree visit its nodes first.
+        Every snapshot of the tree has to be released before. */
+    ~BTree()
+    {
+        reclaim_snapshots();
+        assert(snapshots.empty());
+        clear();
+    }
+
+    BTree(const BTree&) = delete;
+    BTree& operator=(const BTree&) = delete;
+
+    /// Function to look at the allocator of the tree, for its memory usage and fragmentation figures.
+    const Node_allocator<NodeSize, geometry::alignment>& node_allocator() const
+    {
+        return allocator;
+    }
+
+    /// Function to get the counters of the tree, along with its shape: its height, its number of nodes and how full they are, which are measured by visiting every node.
+    /** The counters are updated by lookups too, so a tree which is read from several threads at once should be built with BTREE_STATS set to 0. */
+    Tree_stats stats() const
+    {
+        Tree_stats result = counters;
+        result.keys = key_count;
+        result.height = root == NULL ? 0 : root->level + 1;
+        if (root != NULL)
+            measure_shape(root, result);
+        return result;
+    }
+
+    /// Function to set every counter of the tree back to 0.
+    void reset_stats()
+    {
+        counters = Tree_stats();
+    }
+
+private:
+    /// Function to count the nodes below a node, and how full they are, in the shape part of stats.
+    void measure_shape(const base_node* node, Tree_stats& result) const
+    {
+        if (node->level == 0)
+        {
+            result.leaves++;
+            result.leaf_fill[node->NumberOfValidKeys * 10 / leaf_capacity]++;
+            return;
+        }
+        result.inner_nodes++;
+        result.inner_fill[node->NumberOfValidKeys * 10 / (frozen_nodes != NULL ? implicit_fanout - 1 : inner_capacity)]++;
+        for (int i = 0; i <= node->NumberOfValidKeys; i++)
+            measure_shape(child_at(node, i), result);
+    }
+
+    /// Number of key comparisons done by the search of a node holding n keys. The node searches are branchless, so this only depends on n.
+    static int search_comparisons(int n)
+    {
+        int compared = 0;
+        int length = n;
+        if constexpr (Traits::normalized)
+        {
+            const int window = LINEAR_SEARCH_BYTES / normalized_key_size<Traits>() > 0 ? (int)(LINEAR_SEARCH_BYTES / normalized_key_size<Traits>()) : 1; // as in search_in_node.
+            for (; length > window; compared++)
+                length -= length / 2;
+            return compared + length;
+        }
+        else
+        {
+            if (n == 0)
+                return 0;
+            for (; length > 1; compared++)
+                length -= length / 2;
+            return compared + 1;
+        }
+    }
+
+    /// Function to add a lookup to the counters.
+    void count_lookup(uint64_t compared, int visited) const
+    {
+        counters.lookups++;
+        counters.comparisons.add(compared);
+        counters.nodes_visited.add(visited);
+    }
+
+    /// Function to add to a per level counter. Levels beyond the counted ones go with the highest.
+    static void count_level(uint64_t* counts, int level, uint64_t by = 1)
+    {
+        counts[level < Tree_stats::max_levels ? level : Tree_stats::max_levels - 1] += by;
+    }
+
+public:
+
+    /// This function sets the value of the root equal to the input parameter
+    /** This function was created to facilitate access to the root when it was made private. It isn't being used currently due to change in implementation ideology midway but is
+    still kept here. */
+    void setRoot(base_node* node)
+    {
+        root = node;
+        structure_version++;
+        return;
+    } // check this function also.
+
+    /// Function to shift all the keys left in the array from index i to j (both inclusive).
+    /** This function is called whenever a key has to be inserted into an array. Since arrays are contigous in memory, you can't insert between two elements. So this function shifts
+    all elements from point of insertion to the right so as to create space for one more element to be added. Works by copying elements one by one to the right.
+    @param node The node whose key array elements are being shifted.
+    @param i The left limit (inclusive) in the key array of the elements being shifted.
+    @param j The right limit (inclusive) in the key array of the elements being shifted. */
+    template <class Node> void move_keys_right(Node* node, int i, int j)
+    {
+        for (int counter = j; counter >= i; counter--)
+        {
+            copy_entry(node, counter+1, node, counter);
+        }
+        if constexpr (BTREE_STATS)
+            counters.shift_distance.add(j >= i ? j - i + 1 : 0);
+        return;
+    }
+
+    /// Function to shift the children pointers to the right from index i to j (both inclusive)
+    /** This function shifts the children to the right to facilitate insertion into the child array. Works by copying data sequentially to the right.Called along with move_keys_right
+    function as both of these operations are needed while inserting keys in the middle of the array.
+    @param node The node whose children array keys have to be shifted.
+    @param i The left limit (inclusive) of the keys being shifted
+    @param j The right limit (inclusive) of the keys being shifted */
+    void move_children_right(inner_node* node, int i, int j)
+    {
+        for (int counter = j; counter >= i; counter--)
+        {
+            node->children_array[counter+1] = node->children_array[counter];
+        }
+    }
+
+/// Function to shift all the keys left in the array from index i to j (both inclusive).
+    /** This function is used to shift all the elements stored in an array towards the left by one unit. It was important in the original implementation idea, but wasn't used when
+    the plan was changed later on. Included as a legacy function. Works by copying elements one by one to the left.
+    @param node The node whose key array elements are being shifted.
+    @param i The left limit (inclusive) in the key array of the elements being shifted.
+    @param j The right limit (inclusive) in the key array of the elements being shifted. */
+    template <class Node> void move_keys_left(Node* node, int i, int j)
+    {
+        assert(i > 0);
+        for (int counter = i; counter <= j; counter++)
+        {
+            copy_entry(node, counter-1, node, counter);
+        }
+        if constexpr (BTREE_STATS)
+            counters.shift_distance.add(j >= i ? j - i + 1 : 0);
+        return;
+    }
+
+/// Function to split the given node into two nodes.
+    /**  This function is called when a node has crossed maximum capacity after insertion. It splits at the given break point, usually the (Node::capacity + 1)/2 index. For an
+    inner node, it makes a copy of the key before the breakpoint, and then moves all the keys from the breakpoint on to a different node and sets the valid bit of those keys as zero
+    in the current node. It also sets the valid bit of the key before the breakpoint to zero, as that key only lives on in the level above. A leaf keeps every key: the keys from the
+    breakpoint onwards move to the additional node, a copy of the first of them is sent up as the separator, and the additional node is linked in between the split leaf and its
+    right sibling.
+    @param toSplit A pointer to the node which needs to be split.
+    @param extra A pointer to an additional node in which the right half to the toSplit node will be transferred.
+    @param separator Set to the key which has to be inserted into a level above the current node. Filled in place, so that splitting never allocates a key.
+    @param break_point The index of the first key which moves to the additional node. Both nodes have to keep at least one key.
+    */
+    template <class Node> void split(Node* toSplit, Node* extra, KeyType& separator, int break_point)
+    {
+        const int capacity = Node::capacity;
+        if constexpr (!Node::leaf)
+        {
+            separator = toSplit->key_array[break_point - 1];
+            // separator cant be a reference to that element of toSplit because the element at that location itself is made zero later on.
+        }
+        for (int i = break_point; i <= capacity; i++)
+        {
+            copy_entry(extra, i - break_point, toSplit, i);
+            if constexpr (!Node::leaf)
+            {
+                extra->children_array[i - break_point] = toSplit->children_array[i];
+                toSplit->children_array[i] = 0;
+            }
+            extra->NumberOfValidKeys++;
+            toSplit->key_array[i].valid = 0;
+            toSplit->NumberOfValidKeys--;
+        }
+        if constexpr (!Node::leaf)
+        {
+            extra->children_array[capacity - break_point + 1] = toSplit->children_array[capacity + 1]; // last element of child array is not covered in the loop
+            toSplit->children_array[capacity + 1] = 0;
+            toSplit->key_array[break_point - 1].valid = 0;
+            toSplit->NumberOfValidKeys--;
+        }
+        else
+        {
+            separator = extra->key_array[0]; // the separator is a copy, the key itself stays in the leaf.
+            extra->last_insert = toSplit->last_insert >= break_point ? toSplit->last_insert - break_point : -1;
+            extra->run_length = toSplit->last_insert >= break_point ? toSplit->run_length : 0;
+            if (toSplit->last_insert >= break_point)
+            {
+                toSplit->last_insert = -1;
+                toSplit->run_length = 0;
+            }
+            extra->next_leaf = toSplit->next_leaf;
+            extra->prev_leaf = toSplit;
+            if (toSplit->next_leaf != NULL)
+                toSplit->next_leaf->prev_leaf = extra;
+            else
+                last_leaf = extra;
+            toSplit->next_leaf = extra;
+        }
+        BTREE_TRACE(1, "split a node of level " << toSplit->level << " into " << toSplit->NumberOfValidKeys << " and " << extra->NumberOfValidKeys << " keys");
+        return;
+    }
+
+/// Function to find the position at which a key should be inserted.
+    /** It does so by searching through the keys of the current node for the first position where the key to be inserted is smaller than the key stored there, so that the new
+    key goes after all the keys equal to it. If the key to be inserted is larger than all keys, then the next available position in the key array is returned.
+    @param current  The node of the btree in which the key position is being searched.
+    @param toInsert The key which has to be inserted into the current node.
+    @return The index at which the key should be inserted.
+    */
+    template <class Node> int find_position_to_insert(Node* current, KeyType* toInsert) //returns index value for insertion
+    {
+        return upper_index(current, *toInsert);
+    }
+
+/// Function to find the first key of a node which is not smaller than a probe.
+/** With normalized keys this is the search_in_node kernel on the normalized keys of the node, with the lowest normalized value matching the probe. Otherwise it is a branchless
+    binary search which compares keys and probe through Traits::compare.
+    @param node     The node being searched.
+    @param probe    A key, or anything else which the traits can compare keys with.
+    @return The index of the first key not smaller than the probe, or the number of keys of the node if there is none. */
+    template <class Node, class Probe> static int lower_index(const Node* node, const Probe& probe)
+    {
+        if constexpr (Traits::normalized)
+            return search_in_node(node->search_array, node->NumberOfValidKeys, Traits::normalize_lower(probe), false);
+        else
+            return compare_in_node(node->key_array, node->NumberOfValidKeys, probe, false);
+    }
+
+/// Function to find the first key of a node which is larger than a probe. The counterpart of lower_index.
+    template <class Node, class Probe> static int upper_index(const Node* node, const Probe& probe)
+    {
+        if constexpr (Traits::normalized)
+            return search_in_node(node->search_array, node->NumberOfValidKeys, Traits::normalize_upper(probe), true);
+        else
+            return compare_in_node(node->key_array, node->NumberOfValidKeys, probe, true);
+    }
+
+/// Branchless binary search over the keys of a node with Traits::compare, for traits which do not normalize keys.
+/** The search keeps every key before base smaller than the probe (not larger, if upper), and the answer at most base + length, so that one key is left to look at in the end.
+    @param keys     The key array of the node.
+    @param n        The number of valid keys in the node.
+    @param probe    The probe being looked for.
+    @param upper    Whether to return the first key larger than the probe instead of the first one not smaller.
+    @return The index of the bound, between 0 and n (both inclusive). */
+    template <class Probe> static int compare_in_node(const KeyType* keys, int n, const Probe& probe, bool upper)
+    {
+        if (n == 0)
+            return 0;
+        const int limit = upper ? 1 : 0; // the key is before the bound if compare(key, probe) < limit.
+        const KeyType* base = keys;
+        int length = n;
+        while (length > 1)
+        {
+            int half = length / 2;
+            base = (Traits::compare(base[half], probe) < limit) ? base + half : base;
+            length -= half;
+        }
+        return (int)(base - keys) + (Traits::compare(*base, probe) < limit);
+    }
+
+/// Function to check whether the key at a position of a node matches a probe, i.e. compares equal to it.
+    template <class Node, class Probe> static bool matches(const Node* node, int position, const Probe& probe)
+    {
+        if constexpr (Traits::normalized)
+            return !(node->search_array[position] < Traits::normalize_lower(probe)) && !(Traits::normalize_upper(probe) < node->search_array[position]);
+        else
+            return Traits::compare(node->key_array[position], probe) == 0;
+    }
+
+/// Function to store a key, along with its normalized form, at a given index of a node.
+    template <class Node> static void set_key(Node* node, int index, const KeyType& key)
+    {
+        node->key_array[index] = key;
+        if constexpr (Traits::normalized)
+            node->search_array[index] = Traits::normalize(key);
+    }
+
+/// Function to move a key, along with its normalized form, to a given index of a node.
+    template <class Node> static void set_key(Node* node, int index, KeyType&& key)
+    {
+        if constexpr (Traits::normalized)
+            node->search_array[index] = Traits::normalize(key);
+        node->key_array[index] = std::move(key);
+    }
+
+/// Function to compare two keys in the order of the tree: negative, zero or positive as a is smaller than, equal to or larger than b.
+    static int compare_keys(const KeyType& a, const KeyType& b)
+    {
+        if constexpr (Traits::normalized)
+        {
+            typename Traits::normalized_type x = Traits::normalize(a), y = Traits::normalize(b);
+            return x < y ? -1 : (y < x ? 1 : 0);
+        }
+        else
+            return Traits::compare(a, b);
+    }
+
+/// Function to copy the key (and its normalized form) at index from of node source to index to of node destination.
+    template <class Node> static void copy_entry(Node* destination, int to, const Node* source, int from)
+    {
+        destination->key_array[to] = source->key_array[from];
+        if constexpr (Traits::normalized)
+            destination->search_array[to] = source->search_array[from];
+    }
+
+/// Function to add a key in a leaf of the BTree.
+/** It adds a key to a specified leaf in the BTree. It does so by first finding the position to insert the key, and inserts it there. After this it checks whether the node is
+    completely filled or not, and splits it through split_if_full if it is. A key not smaller than the last key of the leaf is appended without searching the leaf. A key put
+    right after the last key added to the leaf continues an ascending run. Once the run is RUN_MIN_LENGTH keys long, the split it causes cuts the leaf where the run is going.
+    A leaf holding tombstones is compacted first, and rebalanced afterwards if that left it underfull. A leaf shared with a snapshot is copied first (see writable).
+    @param path     The path from the root to the leaf in which the key has to be added.
+    @param toInsert Pointer to the key to be added. */
+    void add_key_in_node(node_path& path, KeyType* toInsert)
+    {
+        leaf_node* current = writable<leaf_node>(path, 0);
+        bool compacted = current->tombstones != 0;
+        if (compacted)
+            purge_leaf(current); // a lazily deleted leaf is cleaned up when it is next written to, so that tombstones never move around in splits.
+        int keys = current->NumberOfValidKeys;
+        int position_to_insert = keys > 0 && compare_keys(*toInsert, current->key_array[keys - 1]) >= 0 ? keys : find_position_to_insert(current, toInsert); // appending needs no search.
+        current->run_length = current->last_insert >= 0 && position_to_insert == current->last_insert + 1 ? std::min(current->run_length + 1, RUN_MIN_LENGTH) : 1;
+        move_keys_right(current, position_to_insert, current->NumberOfValidKeys - 1);
+        set_key(current, position_to_insert, *toInsert);
+        current->NumberOfValidKeys++;
+        current->last_insert = position_to_insert;
+        BTREE_TRACE(2, "added a key at position " << position_to_insert << " of a leaf, which holds " << current->NumberOfValidKeys << " keys now");
+        key_count++;
+        split_if_full<leaf_node>(path, 0, current->run_length >= RUN_MIN_LENGTH ? position_to_insert : -1); // a compacted leaf lost at least one key before it got the new one, so it is never split as well.
+        if (compacted)
+            fix_underflow<leaf_node>(path, 0);
+        return;
+    }
+
+/// Function to add a key in an inner node of the BTree.
+/** It adds a key to a specified inner node in the BTree along with the corresponding right child. The key goes right after the child which was split, whose index is known from
+    the path of the insertion rather than found by comparing keys, as separators equal to the new one may sit on both sides of it when the tree holds duplicate keys. The required
+    space is made in the child array by shifting the children to the right and adding the corresponding child node pointer. The caller splits the node if it is full afterwards.
+    @param current  Pointer to the node in which the key has to be added. It has to be writable.
+    @param toInsert Pointer to the key to be added.
+    @param position_to_insert   Index of the child which was split. The key is added right after it.
+    @param right_child  Pointer to the node which has to be added as the right child after key in added. */
+    void add_key_in_node(inner_node* current, KeyType* toInsert, int position_to_insert, base_node* right_child)
+    {
+        move_keys_right(current, position_to_insert, current->NumberOfValidKeys - 1);
+        move_children_right(current, position_to_insert + 1, current->NumberOfValidKeys); // the children array will be shifted right from position to insert + 1 because the node being added contains keys larger than key being added.
+        current->children_array[position_to_insert+1] = right_child;
+        set_key(current, position_to_insert, *toInsert);
+        current->NumberOfValidKeys++;
+        BTREE_TRACE(2, "added a separator at position " << position_to_insert << " of an inner node of level " << current->level);
+        return;
+    }
+
+/// Function to split a node after an insertion if it has used up its buffer space.
+/** If the node is full, an additional node of the same kind is created into which along with the current node is sent into the split function. This results in the additional
+    node containing the right half of the node to be split, and the original node reduced to half its size. The split function also returns the key which will be subsequently
+    inserted into the parent node, which is the node one level up on the path of the insertion, right after the child which was split. The parent is split in turn if that
+    fills it up. If the current node is the root, then a new root is defined one level above it, with the node which was split as its only child, and the key goes there. Only
+    the nodes on the path are touched: the children which move to the new node keep no pointer back to their parent which would have to be updated.
+    A node split by an ascending run of keys (such as increasing order ids) is cut at the key just added rather than in the middle: the keys before it stay behind in a full
+    node, which the run never comes back to, and the run goes on in the new node. The parent gets its separators in the same ascending order, and is split the same way. Only
+    at the right edge of the tree, where the key just added is the last key of the last node of its level, is the cut made right before it. Anywhere else it is moved so that
+    both nodes keep at least the minimum number of keys, as keys after the run (such as those of the next district) stay in the new node. Sequential inserts then leave full
+    nodes behind instead of half full ones, runs of several districts at once leave nodes at least MIN_FILL_FACTOR full, and random inserts, which make no runs, are split in halves.
+    @param path     The path of the insertion. The node at the given level has to be writable.
+    @param level    The level of the node in which a key was just added.
+    @param run      The index of the key just added if it continues an ascending run, or -1.
+    @param edge     Whether the node is the last one of its level. Worked out for the leaf, and passed up to its parents. */
+    template <class Node> void split_if_full(node_path& path, int level, int run = -1, bool edge = false)
+    {
+        Node* current = (Node*)path.nodes[level];
+        if (current->NumberOfValidKeys != Node::capacity + 1) // this checks whether the node has to be split after insertion.
+            return;
+        int break_point = (Node::capacity + 1) / 2;
+        if constexpr (Node::leaf)
+            edge = current->next_leaf == NULL;
+        if (run >= 1)
+        {
+            break_point = Node::leaf ? run : std::min(run + 1, (int)Node::capacity); // an inner node sends the key of the run up, unless that would leave the new node without keys.
+            edge = edge && run == Node::capacity;
+            if (!edge)
+            {
+                const int minimum = std::max(minimum_keys<Node>(), 1), lowest = Node::leaf ? minimum : minimum + 1; // an inner node keeps one key less than its break point.
+                break_point = std::min(std::max(break_point, lowest), Node::capacity + 1 - minimum);
+            }
+        }
+        Node* right_created_node = new_node<Node>(level);
+        KeyType splitReturned;
+        split (current, right_created_node, splitReturned, break_point);
+        if constexpr (BTREE_STATS)
+            count_level(counters.splits, level);
+        if (current == root) // If this is the root, define a new node as parent and make that root.
+        {
+            assert(level + 1 < max_height);
+            inner_node* fresh_node = new_node<inner_node>(level + 1);
+            fresh_node->children_array[0] = current;
+            root = fresh_node;
+            path.nodes[level + 1] = fresh_node;
+            path.slots[level + 1] = 0;
+            BTREE_TRACE(1, "new root of level " << fresh_node->level);
+        }
+        inner_node* parent = writable<inner_node>(path, level + 1);
+        add_key_in_node(parent, &splitReturned, path.slots[level + 1], right_created_node);
+        split_if_full<inner_node>(path, level + 1, run >= 1 ? path.slots[level + 1] : -1, edge && run >= 1);
+    }
+
+/// Function to create a node of the given type from a block of the allocator.
+/** @param level The level of the new node. Leaves are always at level 0. */
+    template <class Node> Node* new_node(int level)
+    {
+        Node* created = new (allocator.allocate()) Node();
+        created->level = level;
+        created->born = current_epoch;
+        structure_version++;
+        return created;
+    }
+
+/// Function to destroy a node and give its block back to the allocator.
+    void free_node(base_node* node)
+    {
+        if (node->level == 0)
+            ((leaf_node*)node)->~leaf_node();
+        else
+            ((inner_node*)node)->~inner_node();
+        allocator.deallocate(node);
+    }
+
+/// Function to run the destructor of every node of a subtree. Only needed when the keys have destructors, as the memory itself is released with the slabs of the allocator.
+    void destroy_subtree(base_node* node)
+    {
+        if (node->level != 0)
+        {
+            for (int i = 0; i <= node->NumberOfValidKeys; i++)
+                destroy_subtree(child_at(node, i));
+            if (frozen_nodes != NULL)
+                ((implicit_node*)node)->~implicit_node();
+            else
+                ((inner_node*)node)->~inner_node();
+            return;
+        }
+        ((leaf_node*)node)->~leaf_node();
+    }
+
+
+/// Function to add a key in the BTree.
+/** This function is called when a key has to be inserted in the BTree. The function starts at the root, and traverses the tree finding a suitable place to insert. We know that an
+    addition has to be done in the leaf node. So it traverses the tree to the corresponding leaf node by comparing values with the keys in a node, and moving to a child node
+    when the value is larger than the one at the previous index but smaller than the one at the current index. If it is larger than all values in the node, then the function traverses
+    to the last valid entry of the children array and continues the search from there. The nodes passed and the children taken are remembered on the way, and when it finds the
+    leaf node in which the insertion has to be done, the add_key_in_node function is called with that path, along which splits go back up.
+    The path taken is remembered along with the separators around its leaf. The next key which falls between them (the next order id of a stream, say) goes to the same leaf
+    along the same path without any descent, as long as no node was created or removed and no separator moved in between.
+    @param toInsert The key which has to be inserted into the BTree. */
+    void add_key(KeyType* toInsert) // function to add node to the b+ tree
+    {
+        reclaim_snapshots();
+        thaw();
+        filter_keys(toInsert, 1);
+        if constexpr (BTREE_STATS)
+            counters.inserts++;
+        if (hint.version == structure_version && (!hint.has_lower || compare_keys(*toInsert, hint.lower) >= 0) && (!hint.has_upper || compare_keys(*toInsert, hint.upper) < 0))
+        {
+            node_path path;
+            for (int level = 0; level <= root->level; level++)
+            {
+                path.nodes[level] = hint.path.nodes[level];
+                path.slots[level] = hint.path.slots[level];
+            }
+            if constexpr (BTREE_STATS)
+                counters.hinted_inserts++;
+            add_key_in_node(path, toInsert);
+            return;
+        }
+        base_node* current = root;
+        if (root == NULL)
+        {
+            leaf_node* fresh_leaf = new_node<leaf_node>(0);
+            set_key(fresh_leaf, 0, *toInsert);
+            fresh_leaf->NumberOfValidKeys = 1;
+            root = fresh_leaf;
+            first_leaf = fresh_leaf;
+            last_leaf = fresh_leaf;
+            key_count = 1;
+            return;
+        }
+        node_path path;
+        const KeyType* lower = NULL; // the separators around the child taken on the lowest level which has them, which bound the keys of the leaf.
+        const KeyType* upper = NULL;
+        while (current->level != 0) // keys are always added in leaf node. Leaves are the only nodes at level 0.
+        {
+            inner_node* inner = (inner_node*)current;
+            int position = find_position_to_insert(inner, toInsert); // If the key is larger than all keys, this is the last valid entry of the children array.
+            path.nodes[current->level] = current;
+            path.slots[current->level] = position;
+            if (position > 0)
+                lower = &inner->key_array[position - 1];
+            if (position < inner->NumberOfValidKeys)
+                upper = &inner->key_array[position];
+            current = inner->children_array[position];
+        }
+        // at this point, current should be the btree leaf node wherein the key has to be inserted.
+        path.nodes[0] = current;
+        remember_path(path, lower, upper);
+        add_key_in_node(path, toInsert);
+        return;
+    }
+
+/// Function to remember the path of an insertion as the insert hint. The hint lasts until the structure of the tree changes, which the insertion itself may do when it splits.
+    void remember_path(const node_path& path, const KeyType* lower, const KeyType* upper)
+    {
+        for (int level = 0; level <= root->level; level++)
+        {
+            hint.path.nodes[level] = path.nodes[level];
+            hint.path.slots[level] = path.slots[level];
+        }
+        hint.has_lower = lower != NULL;
+        if (lower != NULL)
+            hint.lower = *lower;
+        hint.has_upper = upper != NULL;
+        if (upper != NULL)
+            hint.upper = *upper;
+        hint.version = structure_version;
+    }
+
+/// Function to add a batch of keys to the BTree, with one descent per leaf which receives keys instead of one per key.
+/** The batch is sorted first. It then goes down the tree as a whole: every inner node hands each of its children the run of keys which falls between the separators around
+    it, and every leaf reached merges its run with its own keys in a single pass. A leaf (or an inner node) which overflows is split once, into as many nodes as it needs, and
+    all the separators it creates go up to its parent together, so that the parent is rewritten once as well. Keys equal to keys already in the tree are added after them, like
+    with add_key.
+    @param keys The keys to add, which the tree takes over. They must all have their valid bit set. */
+    void insert_batch(std::vector<KeyType>&& keys)
+    {
+        add_batch(keys, false);
+    }
+
+/// Function to add a batch of keys to the BTree, replacing every key already in the tree which is equal to one of the batch. See insert_batch.
+/** When the batch holds equal keys, the last of them wins. In a tree which already holds a key several times, one of its copies is replaced.
+    @param keys The keys to add or replace, which the tree takes over. They must all have their valid bit set. */
+    void upsert_batch(std::vector<KeyType>&& keys)
+    {
+        add_batch(keys, true);
+    }
+
+/// A node created by splitting a node during a batch insertion, which has to be added to the parent of the split node.
+    struct new_sibling
+    {
+        KeyType separator; /**< The smallest key below the new node, which becomes its separator in the parent. */
+        base_node* node; /**< The new node. */
+        int after; /**< Index, in the parent, of the child after which the new node goes. Set by the parent. */
+    };
+
+/// The state of a batch insertion shared by every node it goes through.
+    struct batch_state
+    {
+        bool upsert; /**< Whether keys equal to keys of the batch are replaced rather than kept. */
+        bool underfull; /**< Set when a leaf lost tombstones in the merge and was left with fewer keys than the minimum. */
+        std::vector<KeyType> merged; /**< Scratch space for the merge of a leaf. */
+    };
+
+/// Function doing the work of insert_batch and upsert_batch.
+    void add_batch(std::vector<KeyType>& keys, bool upsert)
+    {
+        reclaim_snapshots();
+        thaw();
+        std::stable_sort(keys.begin(), keys.end(), [](const KeyType& a, const KeyType& b) { return compare_keys(a, b) < 0; });
+        if (upsert && !keys.empty())
+        {
+            size_t kept = 0;
+            for (size_t i = 1; i < keys.size(); i++)
+            {
+                if (compare_keys(keys[kept], keys[i]) != 0)
+                    kept++;
+                if (kept != i)
+                    keys[kept] = std::move(keys[i]);
+            }
+            keys.resize(kept + 1);
+        }
+        if (keys.empty())
+            return;
+        filter_keys(keys.data(), keys.size());
+        if constexpr (BTREE_STATS)
+            counters.inserts += keys.size();
+        if (root == NULL)
+        {
+            leaf_node* fresh_leaf = new_node<leaf_node>(0);
+            root = fresh_leaf;
+            first_leaf = fresh_leaf;
+            last_leaf = fresh_leaf;
+        }
+        batch_state batch;
+        batch.upsert = upsert;
+        batch.underfull = false;
+        std::vector<new_sibling> siblings;
+        merge_batch(root, NULL, 0, keys.data(), keys.size(), batch, siblings);
+        while (!siblings.empty()) // the root was split, so the tree grows a level, as many times as the new roots keep splitting.
+        {
+            inner_node* fresh_node = new_node<inner_node>(root->level + 1);
+            fresh_node->children_array[0] = root;
+            root = fresh_node;
+            std::vector<new_sibling> above;
+            absorb_siblings(fresh_node, siblings, above);
+            siblings.swap(above);
+        }
+        if (batch.underfull) // only after lazy deletes. The leaves left without tombstones are rebalanced in one pass, like compact does.
+        {
+            for_each_leaf_path([this](node_path& path)
+            {
+                if (((leaf_node*)path.nodes[0])->tombstones == 0)
+                    fix_underflow<leaf_node>(path, 0);
+            });
+        }
+    }
+
+/// Function to merge a sorted run of keys into the subtree below a node.
+/** @param node     The root of the subtree. All keys of the run belong below it.
+    @param parent   The parent of node, already writable, or NULL if node is the root.
+    @param slot     The index of node among the children of parent.
+    @param keys     The first key of the run.
+    @param n        The number of keys of the run, at least 1.
+    @param batch    The state of the batch insertion.
+    @param siblings Filled with the nodes which the node was split into, besides itself. */
+    void merge_batch(base_node* node, inner_node* parent, int slot, KeyType* keys, size_t n, batch_state& batch, std::vector<new_sibling>& siblings)
+    {
+        if (node->level == 0)
+        {
+            merge_into_leaf(writable((leaf_node*)node, parent, slot), keys, n, batch, siblings);
+            return;
+        }
+        inner_node* inner = writable((inner_node*)node, parent, slot);
+        std::vector<new_sibling> below;
+        size_t start = 0;
+        while (start < n)
+        {
+            int child = upper_index(inner, keys[start]);
+            size_t end = start + 1; // the run of the child ends at the first key not smaller than the separator after it.
+            while (end < n && (child == inner->NumberOfValidKeys || compare_keys(keys[end], inner->key_array[child]) < 0))
+                end++;
+            size_t before = below.size();
+            merge_batch(inner->children_array[child], inner, child, keys + start, end - start, batch, below);
+            for (size_t i = before; i < below.size(); i++)
+                below[i].after = child;
+            start = end;
+        }
+        if (!below.empty())
+            absorb_siblings(inner, below, siblings);
+    }
+
+/// Function to merge a sorted run of keys with the keys of a leaf, in one pass, and to split the leaf into as many leaves as needed to hold the result.
+/** The keys are spread evenly over the leaves, which are all at least half full. Tombstones of the leaf are dropped on the way, as add_key_in_node does.
+    @param leaf     The leaf, already writable. All keys of the run belong in it.
+    @param keys     The first key of the run.
+    @param n        The number of keys of the run, at least 1.
+    @param batch    The state of the batch insertion.
+    @param siblings Filled with the new leaves, which follow leaf in the list of leaves. */
+    void merge_into_leaf(leaf_node* leaf, KeyType* keys, size_t n, batch_state& batch, std::vector<new_sibling>& siblings)
+    {
+        std::vector<KeyType>& merged = batch.merged;
+        merged.clear();
+        int i = 0;
+        for (size_t j = 0; j <= n; j++)
+        {
+            while (i < leaf->NumberOfValidKeys && (j == n || compare_keys(leaf->key_array[i], keys[j]) <= 0))
+            {
+                if (leaf->tombstones == 0 || leaf->key_array[i].valid)
+                    merged.push_back(leaf->key_array[i]);
+                i++;
+            }
+            if (j == n)
+                break;
+            if (batch.upsert && !merged.empty() && compare_keys(merged.back(), keys[j]) == 0)
+                merged.back() = std::move(keys[j]);
+            else
+            {
+                merged.push_back(std::move(keys[j]));
+                key_count++;
+            }
+        }
+        tombstone_count -= leaf->tombstones;
+        leaf->tombstones = 0;
+        size_t total = merged.size();
+        size_t pieces = (total + leaf_capacity - 1) / leaf_capacity;
+        if constexpr (BTREE_STATS)
+            count_level(counters.splits, 0, pieces - 1);
+        leaf_node* previous = leaf;
+        for (size_t piece = 0; piece < pieces; piece++)
+        {
+            size_t from = total * piece / pieces;
+            int count = (int)(total * (piece + 1) / pieces - from);
+            leaf_node* target = piece == 0 ? leaf : new_node<leaf_node>(0);
+            int old_count = target->NumberOfValidKeys;
+            for (int k = 0; k < count; k++)
+                set_key(target, k, std::move(merged[from + k]));
+            for (int k = count; k < old_count; k++)
+                target->key_array[k].valid = 0;
+            target->NumberOfValidKeys = count;
+            if (piece > 0)
+            {
+                target->prev_leaf = previous;
+                target->next_leaf = previous->next_leaf;
+                if (previous->next_leaf != NULL)
+                    previous->next_leaf->prev_leaf = target;
+                else
+                    last_leaf = target;
+                previous->next_leaf = target;
+                siblings.push_back(new_sibling{target->key_array[0], target, 0});
+            }
+            previous = target;
+        }
+        if (leaf != root && leaf->NumberOfValidKeys < min_leaf_keys)
+            batch.underfull = true;
+    }
+
+/// Function to add the nodes created below an inner node by a batch insertion to its children, and to split it into as many inner nodes as needed to hold them.
+/** The keys and children are laid out in order first, then spread evenly over the nodes; the key between two nodes goes up to the parent as the separator of the second one.
+    @param inner    The node receiving the new children. It has to be writable.
+    @param below    The new children, in order, each with the index of the child it follows.
+    @param siblings Filled with the nodes which inner was split into, besides itself. */
+    void absorb_siblings(inner_node* inner, std::vector<new_sibling>& below, std::vector<new_sibling>& siblings)
+    {
+        std::vector<KeyType> keys;
+        std::vector<base_node*> children;
+        size_t next = 0;
+        for (int child = 0; child <= inner->NumberOfValidKeys; child++)
+        {
+            children.push_back(inner->children_array[child]);
+            for (; next < below.size() && below[next].after == child; next++)
+            {
+                keys.push_back(std::move(below[next].separator));
+                children.push_back(below[next].node);
+            }
+            if (child < inner->NumberOfValidKeys)
+                keys.push_back(inner->key_array[child]);
+        }
+        size_t total = children.size();
+        size_t pieces = (total + inner_capacity) / (inner_capacity + 1); // every node holds at most inner_capacity + 1 children.
+        if constexpr (BTREE_STATS)
+            count_level(counters.splits, inner->level, pieces - 1);
+        for (size_t piece = 0; piece < pieces; piece++)
+        {
+            size_t from = total * piece / pieces;
+            int count = (int)(total * (piece + 1) / pieces - from); // number of children of the node.
+            inner_node* target = piece == 0 ? inner : new_node<inner_node>(inner->level);
+            int old_count = target->NumberOfValidKeys;
+            for (int k = 0; k < count; k++)
+            {
+                target->children_array[k] = children[from + k];
+                if (k > 0)
+                    set_key(target, k - 1, keys[from + k - 1]);
+            }
+            for (int k = count - 1; k < old_count; k++)
+                target->key_array[k].valid = 0;
+            for (int k = count; k <= old_count; k++)
+                target->children_array[k] = NULL;
+            target->NumberOfValidKeys = count - 1;
+            if (piece > 0)
+                siblings.push_back(new_sibling{keys[from - 1], target, 0});
+        }
+    }
+
+/// Function to build the BTree bottom-up from keys which are already sorted.
+/** This replaces the contents of the tree with the given keys, without a single descent, shift or split. The leaves are filled one after the other with fill_factor of their
+    capacity and linked, then every level of inner nodes is built on top of the level below in the same way, until one node is left, which becomes the root. Only the last node of
+    a level is allowed to hold fewer keys; if it would be less than half as full as the others, it is balanced with the node before it. A fill factor below 1 leaves room in every
+    node, so that insertions done after the load don't split right away.
+    With a random access range (a vector, an array) the size of every level is known up front, and the nodes of each level are filled by up to 'threads' threads, each one
+    building its own contiguous run of nodes. Any other range (like an istream_iterator) is consumed as a stream, in one pass and on one thread.
+    @param first        Iterator to the first key. The keys must be sorted in the order of the key traits.
+    @param last         Iterator past the last key.
+    @param fill_factor  Fraction of the capacity of every node which is filled, between 0 and 1.
+    @param threads      Number of threads used to fill the nodes. Only used for random access ranges. */
+    template <class Iterator> void bulk_load(Iterator first, Iterator last, double fill_factor = 1.0, int threads = 1)
+    {
+        clear();
+        std::vector<base_node*> level; // the nodes of the level being built, in key order.
+        std::vector<KeyType> lows; // the smallest key below every node of level, which becomes its separator in the level above.
+        int leaf_fill = fill_count(leaf_capacity, fill_factor);
+        if constexpr (std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>::value)
+            load_leaves(first, (size_t)(last - first), leaf_fill, threads, level, lows);
+        else
+            stream_leaves(first, last, leaf_fill, level, lows);
+        if (level.empty())
+            return;
+        key_count = 0;
+        for (size_t i = 0; i < level.size(); i++)
+            key_count += level[i]->NumberOfValidKeys;
+        first_leaf = (leaf_node*)level.front();
+        last_leaf = (leaf_node*)level.back();
+        int inner_fill = fill_count(inner_capacity, fill_factor);
+        while (level.size() > 1)
+            load_inner_level(level, lows, inner_fill, threads);
+        root = level[0];
+        if (filtering)
+            rebuild_filter(0);
+        return;
+    }
+
+/// Function to remove every key from the BTree and give all its nodes back to the system.
+/** While snapshots are held, their nodes are only retired, and freed one by one when the snapshots are released. */
+    void clear()
+    {
+        reclaim_snapshots();
+        if (!snapshots.empty())
+        {
+            if (root != NULL)
+                retire_subtree(root);
+        }
+        else
+        {
+            if (!std::is_trivially_destructible<KeyType>::value && root != NULL)
+                destroy_subtree(root);
+            allocator.release_all();
+        }
+        root = NULL;
+        first_leaf = NULL;
+        last_leaf = NULL;
+        key_count = 0;
+        tombstone_count = 0;
+        structure_version++;
+        layout = Frozen_layout::none;
+        frozen_nodes = NULL;
+        if (filtering)
+            rebuild_filter(0);
+    }
+
+/// Function to rewrite the tree into one contiguous run of nodes in the given layout, for a tree which is mostly read from then on (a replica, a table loaded for reporting).
+/** The keys are packed into full nodes, tombstones left out, and every node is built in a single run of blocks taken from the allocator at once: the inner nodes first, in the
+    order of the layout, then the leaves in key order. The levels near the root, which every lookup reads, then sit on a few pages instead of being spread over all the slabs,
+    and a scan goes through the leaves in the order of their addresses. With huge pages the whole tree needs a handful of TLB entries.
+    A tree frozen in the breadth first or van Emde Boas layout is an ordinary tree, which takes changes: the nodes they create are allocated outside of the run, so the layout
+    decays until the tree is frozen again. A tree frozen in the implicit layout has no child pointers, and is thawed by the first change made to it (see thaw).
+    The nodes of the tree move, so no snapshot of it may be held, and all iterators are invalidated.
+    @param frozen_layout    The order of the inner nodes in the run, and whether they keep child pointers. With Frozen_layout::none, the tree is only thawed. */
+    void freeze(Frozen_layout frozen_layout = Frozen_layout::breadth_first)
+    {
+        reclaim_snapshots();
+        if (!snapshots.empty())
+            throw std::logic_error("A BTree cannot be frozen while snapshots of it are held.");
+        if (frozen_layout == Frozen_layout::none)
+        {
+            thaw();
+            return;
+        }
+        std::vector<KeyType> keys;
+        keys.reserve(key_count);
+        for (iterator it = begin(); it != end(); ++it)
+            keys.push_back(*it);
+        clear();
+        if (keys.empty())
+            return;
+        bool implicit = frozen_layout == Frozen_layout::implicit;
+        std::vector<std::vector<size_t> > shape(1, plan_level(keys.size(), leaf_capacity, leaf_capacity, 1)); // for every level, the first item (key or child) of each of its nodes and the number of items.
+        while (shape.back().size() > 2)
+        {
+            size_t count = shape.back().size() - 1;
+            if (implicit) // every node but the last has all its children, so that the index of a child is known.
+            {
+                std::vector<size_t> starts;
+                for (size_t start = 0; start < count; start += implicit_fanout)
+                    starts.push_back(start);
+                starts.push_back(count);
+                shape.push_back(starts);
+            }
+            else
+                shape.push_back(plan_level(count, inner_capacity + 1, inner_capacity + 1, 2));
+        }
+        int top = (int)shape.size() - 1;
+        std::vector<std::vector<size_t> > place(shape.size()); // the index in the run of every node, by level.
+        for (int level = 0; level <= top; level++)
+            place[level].resize(shape[level].size() - 1);
+        size_t next = 0;
+        if (frozen_layout == Frozen_layout::van_emde_boas && top > 0)
+            place_van_emde_boas(shape, place, top, 0, top, next);
+        else
+        {
+            for (int level = top; level > 0; level--)
+                for (size_t i = 0; i < place[level].size(); i++)
+                    place[level][i] = next++;
+        }
+        for (size_t i = 0; i < place[0].size(); i++)
+            place[0][i] = next++;
+        char* run = (char*)allocator.allocate_run(next);
+        std::vector<KeyType> lows(place[0].size()); // the smallest key below every node of a level, which becomes its separator in the level above.
+        for (size_t i = 0; i < place[0].size(); i++)
+        {
+            leaf_node* leaf = new (run + place[0][i] * NodeSize) leaf_node();
+            leaf->born = current_epoch;
+            lows[i] = keys[shape[0][i]];
+            for (size_t k = shape[0][i]; k < shape[0][i + 1]; k++)
+                set_key(leaf, (int)(k - shape[0][i]), std::move(keys[k]));
+            leaf->NumberOfValidKeys = (int)(shape[0][i + 1] - shape[0][i]);
+            leaf->prev_leaf = i > 0 ? (leaf_node*)(run + place[0][i - 1] * NodeSize) : NULL;
+            leaf->next_leaf = i + 1 < place[0].size() ? (leaf_node*)(run + place[0][i + 1] * NodeSize) : NULL;
+        }
+        for (int level = 1; level <= top; level++)
+        {
+            std::vector<KeyType> above(place[level].size());
+            for (size_t i = 0; i < place[level].size(); i++)
+            {
+                char* block = run + place[level][i] * NodeSize;
+                size_t first = shape[level][i], last = shape[level][i + 1];
+                if (implicit)
+                {
+                    implicit_node* node = new (block) implicit_node(level);
+                    for (size_t c = first + 1; c < last; c++)
+                        node->set_separator((int)(c - first - 1), lows[c]);
+                    node->NumberOfValidKeys = (int)(last - first) - 1;
+                    node->born = current_epoch;
+                }
+                else
+                {
+                    inner_node* inner = new (block) inner_node(level);
+                    for (size_t c = first; c < last; c++)
+                    {
+                        inner->children_array[c - first] = (base_node*)(run + place[level - 1][c] * NodeSize);
+                        if (c > first)
+                            set_key(inner, (int)(c - first - 1), lows[c]);
+                    }
+                    inner->NumberOfValidKeys = (int)(last - first) - 1;
+                    inner->born = current_epoch;
+                }
+                above[i] = lows[first];
+            }
+            lows.swap(above);
+        }
+        root = (base_node*)(run + place[top][0] * NodeSize);
+        first_leaf = (leaf_node*)(run + place[0].front() * NodeSize);
+        last_leaf = (leaf_node*)(run + place[0].back() * NodeSize);
+        key_count = keys.size();
+        layout = frozen_layout;
+        if (implicit)
+        {
+            frozen_nodes = run;
+            for (int level = 0; level <= top; level++)
+                implicit_levels[level] = place[level][0];
+        }
+        structure_version++;
+        if (filtering)
+            rebuild_filter(0);
+        BTREE_TRACE(1, "froze " << key_count << " keys into a run of " << next << " nodes");
+    }
+
+/// Function to make a frozen tree an ordinary one again. Every change to the tree does it first, so it is only needed to choose when its cost is paid.
+/** A tree in the implicit layout gets inner nodes with child pointers, built over its leaves (which stay where they are) like bulk_load builds them, and the blocks of its
+    implicit nodes are given back to the allocator. Any other tree only forgets its layout, as it takes changes as it is. */
+    void thaw()
+    {
+        layout = Frozen_layout::none;
+        if (frozen_nodes == NULL)
+            return;
+        std::vector<base_node*> level;
+        std::vector<KeyType> lows;
+        for (leaf_node* leaf = first_leaf; leaf != NULL; leaf = leaf->next_leaf)
+        {
+            level.push_back(leaf);
+            lows.push_back(leaf->key_array[0]);
+        }
+        for (size_t index = implicit_levels[root->level]; index < implicit_levels[0]; index++) // the inner levels come before the leaves, so their blocks end where the leaves start.
+        {
+            implicit_node* node = (implicit_node*)(frozen_nodes + index * NodeSize);
+            node->~implicit_node();
+            allocator.deallocate(node);
+        }
+        frozen_nodes = NULL;
+        while (level.size() > 1)
+            load_inner_level(level, lows, inner_capacity, 1);
+        root = level[0];
+        structure_version++;
+    }
+
+/// The layout in which the tree was frozen by freeze, or Frozen_layout::none if it was not frozen or was changed since.
+    Frozen_layout frozen() const
+    {
+        return layout;
+    }
+
+/// Function to number the inner nodes of a subtree in van Emde Boas order for freeze: its upper half (by height) first, then each subtree hanging below that half, each in turn
+/// laid out in van Emde Boas order.
+/** @param shape    For every level, the first child of each node in the level below, followed by the number of nodes of that level.
+    @param place    Filled with the index in the run of every node of the subtree, by level.
+    @param level    The level of the root of the subtree.
+    @param index    The index of the root of the subtree in its level.
+    @param height   The number of inner levels of the subtree to number.
+    @param next     The next free index in the run. */
+    static void place_van_emde_boas(const std::vector<std::vector<size_t> >& shape, std::vector<std::vector<size_t> >& place, int level, size_t index, int height, size_t& next)
+    {
+        if (height == 1)
+        {
+            place[level][index] = next++;
+            return;
+        }
+        int upper = height / 2;
+        place_van_emde_boas(shape, place, level, index, upper, next);
+        size_t first = index, last = index + 1; // the nodes right below the upper half.
+        for (int above = level; above > level - upper; above--)
+        {
+            first = shape[above][first];
+            last = shape[above][last];
+        }
+        for (size_t i = first; i < last; i++)
+            place_van_emde_boas(shape, place, level - upper, i, height - upper, next);
+    }
+
+/// Function to find a child of an inner node, in either kind of inner node. In the implicit layout the child is worked out from the index of the node in its level.
+    base_node* child_at(const base_node* node, int position) const
+    {
+        if (frozen_nodes != NULL)
+            return implicit_child(node, position);
+        return ((const inner_node*)node)->children_array[position];
+    }
+
+/// Function to find a child of a node of the implicit layout: the child at position of the node at index j of its level is the node at j * implicit_fanout + position below.
+    base_node* implicit_child(const base_node* node, int position) const
+    {
+        size_t index = (size_t)((const char*)node - frozen_nodes) / NodeSize - implicit_levels[node->level];
+        return (base_node*)(frozen_nodes + (implicit_levels[node->level - 1] + index * implicit_fanout + position) * NodeSize);
+    }
+
+/// Function to go down the implicit layout from the root to a leaf, taking in every node the child left of the first separator not smaller (larger, if upper) than the probe.
+/** @param compared Increased by the comparisons done, for the counters.
+    @return The leaf reached. */
+    template <class Probe> base_node* implicit_descent(const Probe& probe, bool upper, uint64_t& compared) const
+    {
+        base_node* current = root;
+        while (current->level != 0)
+        {
+            const implicit_node* node = (const implicit_node*)current;
+            if constexpr (BTREE_STATS)
+                compared += search_comparisons(node->NumberOfValidKeys);
+            current = implicit_child(node, upper ? upper_index(node, probe) : lower_index(node, probe));
+        }
+        return current;
+    }
+
+/// Function to turn a fill factor into a number of keys per node, which is at least 1 and at most the capacity.
+    static int fill_count(int capacity, double fill_factor)
+    {
+        int count = (int)(capacity * fill_factor + 0.5);
+        return count < 1 ? 1 : (count > capacity ? capacity : count);
+    }
+
+/// Function to split a level of items (keys or children) between nodes which take per_node items each.
+/** Every node gets per_node items, except that the last node gets what is left. If that is less than half of per_node (or less than min_per_node), the last two nodes are merged
+    if they fit in one node (max_per_node items) and otherwise share their items evenly.
+    @return The index of the first item of every node, followed by the number of items. */
+    static std::vector<size_t> plan_level(size_t items, size_t per_node, size_t max_per_node, size_t min_per_node)
+    {
+        std::vector<size_t> starts;
+        for (size_t start = 0; start < items; start += per_node)
+            starts.push_back(start);
+        starts.push_back(items);
+        size_t nodes = starts.size() - 1;
+        size_t least = (per_node + 1) / 2 > min_per_node ? (per_node + 1) / 2 : min_per_node;
+        if (nodes >= 2 && items - starts[nodes - 1] < least)
+        {
+            size_t together = items - starts[nodes - 2];
+            if (together <= max_per_node)
+                starts.erase(starts.begin() + (nodes - 1));
+            else
+                starts[nodes - 1] = starts[nodes - 2] + together / 2;
+        }
+        return starts;
+    }
+
+/// Function to run work(begin, end) over the node indices [0, count), split into contiguous runs between up to 'threads' threads.
+    template <class Work> static void run_in_threads(size_t count, int threads, Work work)
+    {
+        if (threads <= 1 || count < 2 * (size_t)threads)
+        {
+            work((size_t)0, count);
+            return;
+        }
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++)
+            workers.push_back(std::thread(work, count * t / threads, count * (t + 1) / threads));
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+    }
+
+/// Function to build the leaves of bulk_load from a random access range of n keys, on up to 'threads' threads.
+/** The blocks of all leaves are taken from the allocator first, as the allocator is not thread safe. The leaves are then constructed, filled and linked in parallel. */
+    template <class Iterator> void load_leaves(Iterator first, size_t n, int leaf_fill, int threads, std::vector<base_node*>& level, std::vector<KeyType>& lows)
+    {
+        if (n == 0)
+            return;
+        std::vector<size_t> starts = plan_level(n, leaf_fill, leaf_capacity, 1);
+        size_t count = starts.size() - 1;
+        level.resize(count);
+        lows.resize(count);
+        for (size_t i = 0; i < count; i++)
+            level[i] = (base_node*)allocator.allocate();
+        run_in_threads(count, threads, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                leaf_node* leaf = new (level[i]) leaf_node();
+                leaf->born = current_epoch;
+                for (size_t k = starts[i]; k < starts[i + 1]; k++)
+                    set_key(leaf, (int)(k - starts[i]), first[k]);
+                leaf->NumberOfValidKeys = (int)(starts[i + 1] - starts[i]);
+                lows[i] = leaf->key_array[0];
+            }
+        });
+        link_leaves(level);
+    }
+
+/// Function to build the leaves of bulk_load from a range which can only be read once, in one pass.
+    template <class Iterator> void stream_leaves(Iterator first, Iterator last, int leaf_fill, std::vector<base_node*>& level, std::vector<KeyType>& lows)
+    {
+        leaf_node* leaf = NULL;
+        for (; first != last; ++first)
+        {
+            if (leaf == NULL || leaf->NumberOfValidKeys == leaf_fill)
+            {
+                leaf = new_node<leaf_node>(0);
+                level.push_back(leaf);
+            }
+            set_key(leaf, leaf->NumberOfValidKeys, *first);
+            leaf->NumberOfValidKeys++;
+        }
+        if (level.size() >= 2 && leaf->NumberOfValidKeys < (leaf_fill + 1) / 2) // the stream ended early in the last leaf, so balance it with the one before.
+        {
+            leaf_node* before = (leaf_node*)level[level.size() - 2];
+            int together = before->NumberOfValidKeys + leaf->NumberOfValidKeys;
+            int keep = together <= leaf_capacity ? together : together / 2; // number of keys left in the leaf before.
+            int moving = before->NumberOfValidKeys - keep; // negative when keys move from the last leaf to the one before.
+            if (moving > 0)
+            {
+                move_keys_right_by(leaf, moving);
+                for (int i = 0; i < moving; i++)
+                    copy_entry(leaf, i, before, keep + i);
+            }
+            else
+            {
+                for (int i = 0; i < leaf->NumberOfValidKeys; i++)
+                    copy_entry(before, before->NumberOfValidKeys + i, leaf, i);
+            }
+            before->NumberOfValidKeys = keep;
+            leaf->NumberOfValidKeys = together - keep;
+            if (leaf->NumberOfValidKeys == 0)
+            {
+                free_node(leaf);
+                level.pop_back();
+            }
+        }
+        lows.resize(level.size());
+        for (size_t i = 0; i < level.size(); i++)
+            lows[i] = ((leaf_node*)level[i])->key_array[0];
+        link_leaves(level);
+    }
+
+/// Function to shift all the keys of a node right by a number of positions, making room at its front. Used when bulk_load balances its last two leaves.
+    template <class Node> void move_keys_right_by(Node* node, int positions)
+    {
+        for (int counter = node->NumberOfValidKeys - 1; counter >= 0; counter--)
+            copy_entry(node, counter + positions, node, counter);
+    }
+
+/// Function to link a level of leaves, given in key order, into the list of leaves.
+    void link_leaves(std::vector<base_node*>& level)
+    {
+        for (size_t i = 0; i < level.size(); i++)
+        {
+            leaf_node* leaf = (leaf_node*)level[i];
+            leaf->prev_leaf = i > 0 ? (leaf_node*)level[i - 1] : NULL;
+            leaf->next_leaf = i + 1 < level.size() ? (leaf_node*)level[i + 1] : NULL;
+        }
+    }
+
+/// Function to build one level of inner nodes on top of a level of nodes during bulk_load. The new level replaces level and lows.
+/** Every inner node takes inner_fill + 1 children, and the smallest keys below all children but the first become its keys. */
+    void load_inner_level(std::vector<base_node*>& level, std::vector<KeyType>& lows, int inner_fill, int threads)
+    {
+        std::vector<size_t> starts = plan_level(level.size(), inner_fill + 1, inner_capacity + 1, 2); // an inner node needs two children to hold a key.
+        size_t count = starts.size() - 1;
+        std::vector<base_node*> above(count);
+        std::vector<KeyType> above_lows(count);
+        int above_level = level[0]->level + 1;
+        for (size_t i = 0; i < count; i++)
+            above[i] = (base_node*)allocator.allocate();
+        run_in_threads(count, threads, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                inner_node* inner = new (above[i]) inner_node(above_level);
+                inner->born = current_epoch;
+                for (size_t c = starts[i]; c < starts[i + 1]; c++)
+                {
+                    int position = (int)(c - starts[i]);
+                    inner->children_array[position] = level[c];
+                    if (position > 0)
+                        set_key(inner, position - 1, lows[c]);
+                }
+                inner->NumberOfValidKeys = (int)(starts[i + 1] - starts[i]) - 1;
+                above_lows[i] = lows[starts[i]];
+            }
+        });
+        level.swap(above);
+        lows.swap(above_lows);
+    }
+
+/// Function to print the subtree with the node in the parameter as its root.
+/** It prints all the elements contained in the node and then calls the function recursively to all children. This results in a preorder printing of the tree nodes.
+    @param  The node whose subtree (node included) has to be printed. */
+    void print_subtree(base_node* to_print)
+    {
+        if (to_print->level == 0)
+        {
+            print_keys((leaf_node*)to_print);
+            return;
+        }
+        if (frozen_nodes == NULL) // the separators of the implicit layout may be normalized keys only.
+            print_keys((inner_node*)to_print);
+        for (int i = 0; i <= to_print->NumberOfValidKeys; i++)
+        {
+            base_node* child = child_at(to_print, i);
+            if (child == NULL)
+                break;
+            print_subtree(child);
+        }
+        return;
+    }
+
+/// Function to print all the valid keys of a single node on one line.
+    template <class Node> void print_keys(Node* to_print)
+    {
+     //   cout << "first key of node being printed is " << to_print->key_array[0].cust_id << " with Number of valid keys as " << to_print->NumberOfValidKeys << endl;
+        for (int i = 0; i < to_print->NumberOfValidKeys; i++)
+        {
+   //         cout << "printing node. Valuue of i is " << i << "   ";
+            if (to_print->key_array[i].valid == 1)
+                std::cout << to_print->key_array[i].cust_id << "  " ;
+        }
+        std::cout << std::endl;
+        return;
+    }
+
+/// Function to print the entire BTree.
+/** It calls the print_subtree function with the BTree root as the parameter. */
+    void print_tree()
+    {
+        base_node* start = root;
+        if (start != NULL)
+            print_subtree(start);
+        std::cout << std::endl;
+        return;
+    }
+
+/// Function to search for a particular key in the BTree.
+/** It is a wrapper for the search_helper function. One important point is that search works by checking equality of keys. So, set the valid bit of the key being sent as the target
+    in the function to 1.
+    @param target   The key which is being searched for.
+    @return Pointer to the key being searched for. */
+    KeyType* search_key(KeyType* target)
+    {
+        if (root == NULL || filtered_out(*target))
+            return 0;
+        KeyType* found = search_helper(target, root);
+        if (found == 0)
+            count_filter_miss<KeyType>();
+        return found;
+    }
+
+/// Utility function to search for a key in the BTree.
+/** This function searchs in the BTree below the current node by seeking, with seek, the first key which is not smaller than the target. As all keys live in the leaves, the
+    search always goes down to a leaf. If the key found there is equal to the target it is returned.
+    @param target   Key which is being looked for in the BTree.
+    @param current  Pointer to the node in the BTree which is currently being traversed.
+    @return Pointer to the key being searched. */
+    KeyType* search_helper(KeyType* target, base_node* current)
+    {
+        iterator position = seek(current, *target, false);
+        if (position.leaf != NULL && matches(position.leaf, position.index, *target))
+            return &(*position);
+        BTREE_TRACE(2, "search_key found no matching key");
+        return 0;
+    }
+
+/// Utility function which finds the first key below a node which is not smaller than (or, if upper is set, larger than) a given probe.
+/** It goes down from the given node to a leaf, taking in every inner node the child left of the first separator not smaller (larger) than the probe. All keys in the children
+    before it are then known to be smaller (not larger), so the wanted key is either in the leaf reached or, if every key of that leaf is too small, the first key of the next leaf.
+    Tombstones are ordered like live keys, so the bound is the first live key from the position found.
+    @param current  The node to start from. Normally the root.
+    @param probe    A key, or any probe which the key traits can compare keys with (like a prefix of the key).
+    @param upper    Whether to look for the upper bound instead of the lower bound.
+    @param path     If not NULL, filled with the path from the node down to the leaf reached, which is not the leaf of the bound if the bound is in a later leaf.
+    @return Iterator to the bound, or the end iterator if there is no such key. */
+    template <class Probe> iterator seek(base_node* current, const Probe& probe, bool upper, node_path* path = NULL) const
+    {
+        if (current == NULL)
+            return end();
+        uint64_t compared = 0;
+        int visited = current->level + 1;
+        if (frozen_nodes != NULL) // the implicit layout is only read, so no path is asked for.
+            current = implicit_descent(probe, upper, compared);
+        while (current->level != 0)
+        {
+            inner_node* inner = (inner_node*)current;
+            if constexpr (BTREE_STATS)
+                compared += search_comparisons(inner->NumberOfValidKeys);
+            int position = upper ? upper_index(inner, probe) : lower_index(inner, probe);
+            if (path != NULL)
+            {
+                path->nodes[current->level] = current;
+                path->slots[current->level] = position;
+            }
+            current = inner->children_array[position];
+        }
+        if (path != NULL)
+            path->nodes[0] = current;
+        leaf_node* leaf = (leaf_node*)current;
+        iterator position(this, leaf, upper ? upper_index(leaf, probe) : lower_index(leaf, probe));
+        position.skip_tombstones(); // past the end of the leaf, the bound is the first live key of the leaves after it.
+        if constexpr (BTREE_STATS)
+            count_lookup(compared + search_comparisons(leaf->NumberOfValidKeys), visited + (position.leaf != leaf && position.leaf != NULL));
+        return position;
+    }
+
+/// Function which returns an iterator to the first key of the BTree which is not smaller than the given probe. Costs one descent of the tree.
+/** The probe can be a full key, or any other type which the key traits know how to compare keys with. For a prefix of the key, this is the first key starting with the prefix. */
+    template <class Probe> iterator lower_bound(const Probe& probe) const
+    {
+        return seek(root, probe, false);
+    }
+
+/// Function which returns an iterator to the first key of the BTree which is larger than the given probe. Costs one descent of the tree.
+    template <class Probe> iterator upper_bound(const Probe& probe) const
+    {
+        return seek(root, probe, true);
+    }
+
+/// Function which returns an iterator to a key matching the given probe, or the end iterator if there is none.
+    template <class Probe> iterator find(const Probe& probe) const
+    {
+        if (filtered_out(probe))
+            return end();
+        iterator position = lower_bound(probe);
+        if (position.leaf != NULL && matches(position.leaf, position.index, probe))
+            return position;
+        count_filter_miss<Probe>();
+        return end();
+    }
+
+/// Function which tells whether the tree holds a key equal to the given one. With the filter on (see set_filter), most absent keys are told apart without going down the tree.
+    bool exists(const KeyType& key) const
+    {
+        return find(key) != end();
+    }
+
+/// Function which returns the range of keys matching the given probe, as a pair of lower_bound and upper_bound. With a prefix as the probe, these are all keys with the prefix.
+    template <class Probe> std::pair<iterator, iterator> equal_range(const Probe& probe) const
+    {
+        return std::make_pair(lower_bound(probe), upper_bound(probe));
+    }
+
+/// Function to look up a batch of keys, with the descents of several of them interleaved to hide the latency of the memory.
+/** A lookup on a tree larger than the cache stalls on a cache miss at every level. Here the probes go down the tree in groups of MULTI_GET_GROUP, one level at a time for the
+    whole group: for every probe of the group the child to visit is picked in the current node and its cache lines are prefetched, and the children are only searched once the
+    whole group has moved down. The misses of the group on one level are then all in flight at the same time instead of one after the other. All leaves are at the same depth,
+    so the probes of a group stay in step. Whole keys which the filter rules out (see set_filter) do not go down at all. Every probe gets the same answer as with find.
+    @param probes   The keys (or any probes which the key traits can compare keys with) to look up.
+    @return For every probe, a pointer to a key matching it, or NULL if there is none. */
+    template <class Probe> std::vector<KeyType*> multi_get(const std::vector<Probe>& probes) const
+    {
+        std::vector<KeyType*> results(probes.size(), NULL);
+        if (root == NULL)
+            return results;
+        std::vector<size_t> pending; // the probes which go down the tree: those which the filter does not rule out.
+        pending.reserve(probes.size());
+        for (size_t i = 0; i < probes.size(); i++)
+            if (!filtered_out(probes[i]))
+                pending.push_back(i);
+        const base_node* current[MULTI_GET_GROUP];
+        size_t at[MULTI_GET_GROUP]; // the probe of every lookup of the group.
+        uint64_t compared[MULTI_GET_GROUP]; // comparisons of every lookup of the group so far, for the counters.
+        for (size_t start = 0; start < pending.size(); start += MULTI_GET_GROUP)
+        {
+            int group = (int)std::min((size_t)MULTI_GET_GROUP, pending.size() - start);
+            for (int i = 0; i < group; i++)
+            {
+                current[i] = root;
+                at[i] = pending[start + i];
+                compared[i] = 0;
+            }
+            for (int level = root->level; level > 0; level--)
+            {
+                for (int i = 0; i < group; i++)
+                {
+                    if constexpr (BTREE_STATS)
+                        compared[i] += search_comparisons(current[i]->NumberOfValidKeys);
+                    if (frozen_nodes != NULL)
+                    {
+                        const implicit_node* node = (const implicit_node*)current[i];
+                        current[i] = implicit_child(node, lower_index(node, probes[at[i]]));
+                    }
+                    else
+                    {
+                        const inner_node* inner = (const inner_node*)current[i];
+                        current[i] = inner->children_array[lower_index(inner, probes[at[i]])];
+                    }
+                    if (level == 1)
+                        prefetch_node((const leaf_node*)current[i]);
+                    else if (frozen_nodes != NULL)
+                        prefetch_node((const implicit_node*)current[i]);
+                    else
+                        prefetch_node((const inner_node*)current[i]);
+                }
+            }
+            for (int i = 0; i < group; i++)
+            {
+                leaf_node* leaf = (leaf_node*)current[i];
+                iterator position(this, leaf, lower_index(leaf, probes[at[i]]));
+                position.skip_tombstones();
+                if (position.leaf != NULL && matches(position.leaf, position.index, probes[at[i]]))
+                    results[at[i]] = &(*position);
+                else
+                    count_filter_miss<Probe>();
+                if constexpr (BTREE_STATS)
+                    count_lookup(compared[i] + search_comparisons(leaf->NumberOfValidKeys), root->level + 1 + (position.leaf != leaf && position.leaf != NULL));
+            }
+        }
+        return results;
+    }
+
+/// Function to prefetch the cache lines of a node which a search reads: the header and the search keys (the normalized keys, or the keys themselves).
+    template <class Node> static void prefetch_node(const Node* node)
+    {
+        const char* first = (const char*)node;
+        const char* last;
+        if constexpr (Traits::normalized)
+            last = (const char*)(node->search_array + Node::capacity);
+        else
+            last = (const char*)(node->key_array + Node::capacity);
+        for (const char* line = first; line < last; line += CACHE_LINE_SIZE)
+            __builtin_prefetch(line, 0, 3);
+    }
+
+/// Iterator to the smallest key of the BTree.
+    iterator begin() const
+    {
+        iterator first(this, first_leaf, 0);
+        first.skip_tombstones();
+        return first;
+    }
+
+/// Iterator past the largest key of the BTree.
+    iterator end() const
+    {
+        return iterator(this, NULL, 0);
+    }
+
+/// Reverse iterator to the largest key of the BTree. Useful for queries on the last entries of a range.
+    reverse_iterator rbegin() const
+    {
+        return std::reverse_iterator(end());
+    }
+
+/// Reverse iterator past the smallest key of the BTree.
+    reverse_iterator rend() const
+    {
+        return std::reverse_iterator(begin());
+    }
+
+
+
+/// Function to search for a all keys in the BTree which fulfill a certain criteria. The criteria is decided by the function pointer passed as argument.
+/** This is a wrapper for the linear_search_helper function. It works by searching the entire tree, and adding the address of any key which returns a true in the function whose pointer
+    is passed as a parameter. The second argument of the function keeps changing as we traverse the key, whereas the first argument, which will be KeyType target, is the fixed key
+    relative to whom we want to evaluate all the other keys. The function is called linear_search because it is a O(n) search, as apposed to the O(mlogn) search you can do it a btree.
+    @param target   The key relative to whom other keys are evaluated in the compare function.
+    @param *compare Pointer to the function which will make the comparision between keys. It should return a bool value.
+    @return vector<void*> which contains pointers to all the keys which were evaluated to true in the compare function. Proper care must be taken while dereferencing, as addresses
+            will first have to be cast to KeyType pointers. parallel_scan does the same on every core, with any predicate and typed results.*/
+    std::vector<void*> linear_search(KeyType* target, bool (*compare)(KeyType* a, KeyType* b)) // NOTE: If output is 1, b is added to output list.
+    {
+        // Implement the linear search funciton. Add to array whenever compare function returns value one,
+        std::vector<void*> ans;
+//	memset(ans, 0, sizeof(&ans));
+        if (root == NULL)
+            return ans;
+        ans = *(linear_search_helper(root, &ans, target, compare));
+        return ans;
+    }
+
+
+/// Helper function to search for a all keys in the BTree which fulfill a certain criteria. The criteria is decided by the function pointer passed as argument.
+/** The function works by traversing the entire tree by evaluating all keys in a leaf, or recursively calling the function to all children of an inner node. It is essentially similar
+    to the print tree function, except that instead of printing the output, it evaluates it using the compare function and adds address  of key to vector<void*> if the function is true.
+    @param current  The node in the btree in which the function should be searching.
+    @param ans      A vector<void*> which contains all the addresses of all keys that have evaluated to true till now.
+    @param target   The key relative to whom other keys are evaluated in the compare function.
+    @param *compare Pointer to the function which will make the comparision between keys. It should return a bool value.
+    @return vector<void*> which contains pointers to all the keys which were evaluated to true in the compare function. Proper care must be taken while dereferencing later on,
+            as addresses will first have to be cast to KeyType pointers.*/
+    std::vector<void*>* linear_search_helper(base_node* current, std::vector<void*>* ans, KeyType* target, bool (*compare)(KeyType* a, KeyType* b))
+    {
+        if (current->level == 0)
+            return linear_search_keys((leaf_node*)current, ans, target, compare);
+        for (int i = 0; i <= current->NumberOfValidKeys; i++) // the keys of inner nodes are only copies of keys in the leaves, so they are not evaluated.
+        {
+            base_node* child = child_at(current, i);
+            if (child == NULL)
+                break;
+            ans = linear_search_helper(child, ans, target, compare);
+        }
+        return ans;
+    }
+
+/// Helper function of linear_search_helper which evaluates the compare function on every key of a single node.
+    template <class Node> std::vector<void*>* linear_search_keys(Node* current, std::vector<void*>* ans, KeyType* target, bool (*compare)(KeyType* a, KeyType* b))
+    {
+        for (int i = 0; i < current->NumberOfValidKeys; i++)
+        {
+            if (current->tombstones != 0 && !current->key_array[i].valid)
+                continue;
+            if ((*compare)(target, &(current->key_array[i])) == 1)
+                ans->push_back(&current->key_array[i]);
+        }
+        return ans;
+    }
+
+/// Function to find the keys of the BTree for which a predicate holds, on all threads of a pool.
+/** The tree is cut into about eight subtrees per thread, the nodes of the highest level which has that many, and each subtree is a task of the pool: it walks the run of
+    leaves below its node and calls the predicate on every live key. The predicate is a template parameter, so it is inlined into the loop over the keys of a leaf instead of
+    being called through a pointer for every key. Every task collects its matches in a buffer of its own, and the buffers are joined in key order.
+    With a limit, the result is the first limit matching keys in key order. A task stops after limit matches, or as soon as the tasks before it have found limit keys between
+    them, as none of its keys could make it into the result then.
+    No thread may change the tree during the scan, and the predicate is called from several threads at once.
+    @param predicate    Called as predicate(key) on every live key, and returns whether the key is wanted.
+    @param limit        Largest number of keys returned.
+    @param pool         The threads which run the scan.
+    @return The matching keys, in key order. */
+    template <class Predicate> std::vector<KeyType> parallel_scan(Predicate predicate, size_t limit = SIZE_MAX, Scan_pool& pool = Scan_pool::shared()) const
+    {
+        std::vector<KeyType> result;
+        if (root == NULL || limit == 0)
+            return result;
+        std::vector<leaf_node*> starts = scan_tasks(pool.size());
+        size_t tasks = starts.size() - 1;
+        std::vector<std::vector<KeyType> > found(tasks);
+        std::vector<char> finished(tasks, 0);
+        std::vector<size_t> matches_before(tasks + 1, 0); // for k up to settled, the number of matches of tasks 0 to k - 1, which are all done.
+        std::atomic<size_t> settled(0);
+        std::mutex settle_lock;
+        pool.run(tasks, [&](size_t task, int)
+        {
+            std::vector<KeyType>& mine = found[task];
+            for (leaf_node* leaf = starts[task]; leaf != starts[task + 1] && mine.size() < limit; leaf = leaf->next_leaf)
+            {
+                if (settled.load(std::memory_order_acquire) >= task && matches_before[task] >= limit) // the tasks before this one have found enough keys.
+                    break;
+                for (int i = 0; i < leaf->NumberOfValidKeys && mine.size() < limit; i++)
+                {
+                    const KeyType& key = leaf->key_array[i];
+                    if ((leaf->tombstones == 0 || key.valid) && predicate(key))
+                        mine.push_back(key);
+                }
+            }
+            std::lock_guard<std::mutex> guard(settle_lock);
+            finished[task] = 1;
+            size_t k = settled.load(std::memory_order_relaxed);
+            for (; k < tasks && finished[k]; k++)
+                matches_before[k + 1] = matches_before[k] + found[k].size();
+            settled.store(k, std::memory_order_release);
+        });
+        for (size_t t = 0; t < tasks && result.size() < limit; t++)
+            result.insert(result.end(), found[t].begin(), found[t].begin() + std::min(found[t].size(), limit - result.size()));
+        return result;
+    }
+
+/// Function to stream the keys of the BTree for which a predicate holds to a callback, on all threads of a pool, in no particular order.
+/** The tree is split into tasks like in parallel_scan. The callback gets the index of the thread calling it, so that it can fill buffers of its own without a lock.
+    No thread may change the tree during the scan.
+    @param predicate    Called as predicate(key) on every live key, and returns whether the key is wanted.
+    @param visit        Called as visit(key, worker) on every matching key, where worker is the index of the calling thread in the pool, from 0 to pool.size() - 1. Returning
+                        false stops the scan on every thread.
+    @param pool         The threads which run the scan.
+    @return Whether the scan went through the whole tree, rather than being stopped by visit. */
+    template <class Predicate, class Visit> bool parallel_for_each(Predicate predicate, Visit visit, Scan_pool& pool = Scan_pool::shared()) const
+    {
+        if (root == NULL)
+            return true;
+        std::vector<leaf_node*> starts = scan_tasks(pool.size());
+        std::atomic<bool> stopped(false);
+        pool.run(starts.size() - 1, [&](size_t task, int worker)
+        {
+            for (leaf_node* leaf = starts[task]; leaf != starts[task + 1] && !stopped.load(std::memory_order_relaxed); leaf = leaf->next_leaf)
+            {
+                for (int i = 0; i < leaf->NumberOfValidKeys; i++)
+                {
+                    const KeyType& key = leaf->key_array[i];
+                    if ((leaf->tombstones == 0 || key.valid) && predicate(key) && !visit(key, worker))
+                    {
+                        stopped = true;
+                        break;
+                    }
+                }
+            }
+        });
+        return !stopped;
+    }
+
+/// Function to cut the tree into tasks of a parallel scan: the subtrees of the nodes of the highest level with at least eight nodes per thread, or of the leaves.
+/** @param threads  Number of threads of the scan.
+    @return The leftmost leaf of every subtree, in key order, followed by NULL. The leaves of a task run from its leaf up to the leaf of the next one. */
+    std::vector<leaf_node*> scan_tasks(int threads) const
+    {
+        std::vector<base_node*> level(1, root);
+        while (level[0]->level != 0 && level.size() < 8 * (size_t)threads)
+        {
+            std::vector<base_node*> below;
+            for (size_t i = 0; i < level.size(); i++)
+            {
+                for (int c = 0; c <= level[i]->NumberOfValidKeys; c++)
+                    below.push_back(child_at(level[i], c));
+            }
+            level.swap(below);
+        }
+        std::vector<leaf_node*> starts;
+        for (size_t i = 0; i < level.size(); i++)
+        {
+            base_node* node = level[i];
+            while (node->level != 0)
+                node = child_at(node, 0);
+            starts.push_back((leaf_node*)node);
+        }
+        starts.push_back(NULL);
+        return starts;
+    }
+
+
+
+/// Function to remove a key from the BTree.
+/** It finds the first live key matching the given one, the same key which search_key would return. In the default mode the key is taken out of its leaf at once, and if the
+    leaf is left with fewer keys than the minimum fill, it borrows keys from a sibling or is merged with it (see fix_underflow). Merges remove a separator from the parent, which may
+    in turn become underfull, up to the root, which is dropped when it is left with a single child. Freed nodes go back to the allocator.
+    In lazy delete mode the valid bit of the key is cleared instead, leaving a tombstone which lookups and iterators skip. The leaf is compacted when it is next written to, when
+    all its keys are dead, or when the tombstones of the whole tree go over the tombstone limit, in which case the whole tree is compacted in one pass. A burst of deletes then
+    costs one descent and one store each, while the memory and height of the tree stay bounded.
+    @param toDelete The key which has to be removed. Its valid bit has to be set, like for search_key.
+    @return Whether a matching key was found and removed. */
+    bool delete_key(KeyType* toDelete)
+    {
+        reclaim_snapshots();
+        thaw();
+        node_path path;
+        iterator position = seek(root, *toDelete, false, &path);
+        if (position.leaf == NULL || !matches(position.leaf, position.index, *toDelete))
+            return false;
+        if constexpr (BTREE_STATS)
+            counters.deletes++;
+        while (path.nodes[0] != position.leaf) // the key is at the start of a later leaf, after leaves which only hold smaller keys and tombstones.
+            step_forward(path);
+        leaf_node* leaf = writable<leaf_node>(path, 0);
+        leaf->key_array[position.index].valid = 0;
+        leaf->tombstones++;
+        tombstone_count++;
+        key_count--;
+        if (lazy_delete && tombstone_count > tombstone_limit * (key_count + tombstone_count))
+            compact();
+        else if (!lazy_delete || leaf->tombstones == leaf->NumberOfValidKeys)
+        {
+            purge_leaf(leaf);
+            fix_underflow<leaf_node>(path, 0);
+            drop_empty_root();
+        }
+        return true;
+    }
+
+/// Function to set the minimum fill of the nodes, as a fraction of their capacity, below which a node which lost keys is rebalanced.
+/** The minimum is at least one key, and small enough that both halves of a split node have it and that two nodes which are both at most at the minimum always fit in one node
+    when they are merged (half of the capacity for leaves, one less for inner nodes, whose split sends one key up).
+    A lower minimum leaves more room between the fill right after a merge and the capacity, so that alternating inserts and deletes around the same keys do not keep splitting and
+    merging the same nodes. */
+    void set_min_fill(double min_fill)
+    {
+        min_leaf_keys = std::min(fill_count(leaf_capacity, min_fill), leaf_capacity / 2);
+        min_inner_keys = std::min(fill_count(inner_capacity, min_fill), (inner_capacity - 1) / 2);
+    }
+
+/// Function to switch the filter of exact lookups on or off.
+/** The filter is a split block Bloom filter (see Bloom_filter) holding a hash of the normalized form of every key added. search_key, exists, find and multi_get of whole keys ask
+    it first, and a key which it has certainly never seen is reported missing after reading one cache line, without going down the tree. Bounds and lookups of prefixes are not
+    filtered. Deleted keys stay in the filter until it is rebuilt from the keys of the tree, which happens when it has taken as many keys as it was sized for: twice the keys of the
+    tree at the previous rebuild. The false positive rate is reached then, and is lower before. Only trees whose traits normalize keys can be filtered.
+    @param on                   Whether lookups should be filtered. Switching the filter on builds it from the keys of the tree.
+    @param false_positive_rate  Fraction of the lookups of absent keys which a filter full to its size lets through. About 10 bits per key of the filter give 1%. */
+    void set_filter(bool on, double false_positive_rate = FILTER_FALSE_POSITIVE_RATE)
+    {
+        static_assert(Traits::normalized, "Keys are hashed for the filter through their normalized form.");
+        filtering = on;
+        filter_rate = false_positive_rate;
+        if (on)
+            rebuild_filter(0);
+        else
+            filter = Bloom_filter();
+    }
+
+/// Function to look at the filter of the tree, for its size and memory usage.
+    const Bloom_filter& lookup_filter() const
+    {
+        return filter;
+    }
+
+/// Function to hash a key for the filter, so that equal keys get equal hashes.
+    static uint64_t filter_hash(const KeyType& key)
+    {
+        return normalized_hash<Traits>(key);
+    }
+
+/// Function which tells whether the filter shows that the tree holds no key equal to a probe. Always false when filtering is off, and for probes which are not whole keys.
+    template <class Probe> bool filtered_out(const Probe& probe) const
+    {
+        if constexpr (Traits::normalized && std::is_same<Probe, KeyType>::value)
+        {
+            if (filtering && !filter.may_contain(filter_hash(probe)))
+            {
+                if constexpr (BTREE_STATS)
+                    counters.filtered_lookups++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+/// Function to count a lookup of a probe which the filter let through and which found no key.
+    template <class Probe> void count_filter_miss() const
+    {
+        if constexpr (BTREE_STATS && std::is_same<Probe, KeyType>::value)
+        {
+            if (filtering)
+                counters.filter_false_positives++;
+        }
+    }
+
+/// Function to add keys which are about to be added to the tree to the filter, if filtering is on. If they do not fit, the filter is rebuilt, for twice the keys of the tree.
+    void filter_keys(const KeyType* keys, size_t count)
+    {
+        if constexpr (Traits::normalized)
+        {
+            if (!filtering)
+                return;
+            if (filter.size() + count > filter.capacity())
+                rebuild_filter(count);
+            for (size_t i = 0; i < count; i++)
+                filter.add(filter_hash(keys[i]));
+        }
+    }
+
+/// Function to build the filter anew from the live keys of the tree, which drops the hashes of the keys deleted since the last build.
+/** @param incoming Number of keys about to be added, which the filter is sized for on top of the keys of the tree, and doubled along with them. */
+    void rebuild_filter(size_t incoming)
+    {
+        if constexpr (Traits::normalized)
+        {
+            filter.reset(std::max(2 * (key_count + incoming), (size_t)FILTER_MIN_KEYS), filter_rate);
+            for (iterator it = begin(); it != end(); ++it)
+                filter.add(filter_hash(*it));
+            BTREE_TRACE(1, "rebuilt the filter for " << filter.capacity() << " keys in " << filter.memory_bytes() << " bytes");
+        }
+    }
+
+/// Function to switch lazy deletes on or off. Switching them off compacts the tree right away.
+/** @param lazy     Whether deletes should only leave tombstones.
+    @param limit    Fraction of all the keys (tombstones included) which may be tombstones before the whole tree is compacted. */
+    void set_lazy_delete(bool lazy, double limit = TOMBSTONE_LIMIT)
+    {
+        lazy_delete = lazy;
+        tombstone_limit = limit;
+        if (!lazy && tombstone_count != 0)
+            compact();
+    }
+
+/// Function to remove every tombstone from the tree and rebalance every underfull leaf, in one pass over the leaves.
+/** The leaves are visited from left to right; each one is compacted, and then fixed with fix_underflow if it is underfull, which compacts the sibling it takes keys from first.
+    A fixed leaf never falls below the minimum again during the pass, as leaves only give keys to an underfull neighbour down to the minimum, so one pass is enough. */
+    void compact()
+    {
+        reclaim_snapshots();
+        thaw();
+        for_each_leaf_path([this](node_path& path)
+        {
+            if (((leaf_node*)path.nodes[0])->tombstones != 0)
+                purge_leaf(writable<leaf_node>(path, 0));
+            fix_underflow<leaf_node>(path, 0);
+        });
+        drop_empty_root();
+    }
+
+/// Number of keys in the tree. Tombstones are not counted.
+    size_t size() const
+    {
+        return key_count;
+    }
+
+/// Number of tombstones left by lazy deletes which have not been compacted yet.
+    size_t tombstones() const
+    {
+        return tombstone_count;
+    }
+
+/// Function to take the tombstones out of a leaf, moving its live keys together at the front of the key array.
+    void purge_leaf(leaf_node* leaf)
+    {
+        if (leaf->tombstones == 0)
+            return;
+        int kept = 0;
+        int moved = 0;
+        for (int i = 0; i < leaf->NumberOfValidKeys; i++)
+        {
+            if (!leaf->key_array[i].valid)
+                continue;
+            if (kept != i)
+            {
+                copy_entry(leaf, kept, leaf, i);
+                moved++;
+            }
+            kept++;
+        }
+        if constexpr (BTREE_STATS)
+            counters.shift_distance.add(moved);
+        for (int i = kept; i < leaf->NumberOfValidKeys; i++)
+            leaf->key_array[i].valid = 0;
+        leaf->NumberOfValidKeys = kept;
+        tombstone_count -= leaf->tombstones;
+        leaf->tombstones = 0;
+        leaf->last_insert = -1;
+        leaf->run_length = 0;
+    }
+
+/// Minimum number of keys of a node of the given type, other than the root.
+    template <class Node> int minimum_keys() const
+    {
+        return Node::leaf ? min_leaf_keys : min_inner_keys;
+    }
+
+/// Function to run a visitor on the path to every leaf, from the first leaf to the last. The visitor may rebalance the leaf, as long as the path leads to the leaf holding its keys afterwards.
+    template <class Visit> void for_each_leaf_path(Visit visit)
+    {
+        if (root == NULL)
+            return;
+        node_path path;
+        base_node* current = root;
+        while (current->level != 0)
+        {
+            path.nodes[current->level] = current;
+            path.slots[current->level] = 0;
+            current = ((inner_node*)current)->children_array[0];
+        }
+        path.nodes[0] = current;
+        do
+            visit(path);
+        while (step_forward(path));
+    }
+
+/// Function to move a path to the leaf after the one it leads to: up to the lowest node where the path did not take the last child, then down the leftmost children.
+/** @return Whether there is a leaf after. */
+    bool step_forward(node_path& path) const
+    {
+        int level = 1;
+        while (level <= root->level && path.slots[level] == path.nodes[level]->NumberOfValidKeys)
+            level++;
+        if (level > root->level)
+            return false;
+        path.slots[level]++;
+        for (; level > 0; level--)
+        {
+            path.nodes[level - 1] = ((inner_node*)path.nodes[level])->children_array[path.slots[level]];
+            path.slots[level - 1] = 0;
+        }
+        return true;
+    }
+
+/// Function to bring a node which lost keys back to the minimum fill.
+/** As long as the node is underfull, it takes keys from the sibling (under the same parent) with the most keys to spare, evening out the two nodes but never taking the sibling
+    below the minimum. If neither sibling has keys to spare, the node is merged with one of them. A merge takes a separator (and a child) out of the parent, so the parent is fixed in
+    the same way afterwards, and a root left without any key is replaced by its only child. Every node changed on the way is first made writable, so snapshots keep their copy.
+    @param path     The path to the node, which leads afterwards to the node holding its keys (the left sibling it was merged into, if it was) at every level.
+    @param level    The level of the node to fix. The root is never underfull. */
+    template <class Node> void fix_underflow(node_path& path, int level)
+    {
+        const int minimum = minimum_keys<Node>();
+        while (path.nodes[level] != root && path.nodes[level]->NumberOfValidKeys < minimum)
+        {
+            structure_version++; // separators move even when no node is taken out.
+            Node* node = writable<Node>(path, level);
+            inner_node* parent = (inner_node*)path.nodes[level + 1]; // made writable with node.
+            int position = path.slots[level + 1];
+            Node* left = position > 0 ? (Node*)parent->children_array[position - 1] : NULL;
+            Node* right = position < parent->NumberOfValidKeys ? (Node*)parent->children_array[position + 1] : NULL;
+            if constexpr (Node::leaf)
+            {
+                if (left != NULL && left->tombstones != 0)
+                    purge_leaf(left = writable(left, parent, position - 1));
+                if (right != NULL && right->tombstones != 0)
+                    purge_leaf(right = writable(right, parent, position + 1));
+            }
+            if (left != NULL && left->NumberOfValidKeys > minimum && (right == NULL || left->NumberOfValidKeys >= right->NumberOfValidKeys))
+            {
+                int moving = std::min((left->NumberOfValidKeys - node->NumberOfValidKeys) / 2, left->NumberOfValidKeys - minimum);
+                borrow_from_left(node, writable(left, parent, position - 1), parent, position - 1, moving);
+                if constexpr (!Node::leaf)
+                    path.slots[level] += moving; // the children of node moved right to make room for those of left.
+                if constexpr (BTREE_STATS)
+                    count_level(counters.borrows, level);
+            }
+            else if (right != NULL && right->NumberOfValidKeys > minimum)
+            {
+                int moving = std::min((right->NumberOfValidKeys - node->NumberOfValidKeys) / 2, right->NumberOfValidKeys - minimum);
+                borrow_from_right(node, writable(right, parent, position + 1), parent, position, moving);
+                if constexpr (BTREE_STATS)
+                    count_level(counters.borrows, level);
+            }
+            else
+            {
+                if constexpr (BTREE_STATS)
+                    count_level(counters.merges, level);
+                BTREE_TRACE(1, "merged a node of level " << level << " with a sibling");
+                if (left != NULL)
+                {
+                    left = writable(left, parent, position - 1);
+                    if constexpr (!Node::leaf)
+                        path.slots[level] += left->NumberOfValidKeys + 1; // the children of node go after those of left.
+                    merge_nodes(left, node, parent, position - 1);
+                    path.nodes[level] = left;
+                    path.slots[level + 1] = position - 1;
+                }
+                else
+                    merge_nodes(node, right, parent, position);
+                if (parent == root)
+                    shrink_root();
+                else
+                    fix_underflow<inner_node>(path, level + 1);
+            }
+        }
+    }
+
+/// Function to move the last keys (and children) of a node to the front of its right sibling, through the separator between them in the parent.
+/** @param node         The node receiving the keys.
+    @param left         Its left sibling, giving the keys.
+    @param parent       Their parent.
+    @param separator    Index of the separator between the two nodes in the parent.
+    @param moving       Number of keys to move, at least 1. */
+    template <class Node> void borrow_from_left(Node* node, Node* left, inner_node* parent, int separator, int moving)
+    {
+        int from = left->NumberOfValidKeys - moving; // first key of left which moves (or, for inner nodes, goes up to the parent).
+        move_keys_right_by(node, moving);
+        if constexpr (Node::leaf)
+        {
+            for (int i = 0; i < moving; i++)
+                copy_entry(node, i, left, from + i);
+            set_key(parent, separator, node->key_array[0]);
+        }
+        else
+        {
+            for (int counter = node->NumberOfValidKeys; counter >= 0; counter--)
+                node->children_array[counter + moving] = node->children_array[counter];
+            copy_entry(node, moving - 1, parent, separator); // the old separator comes down in front of the keys of node.
+            for (int i = 0; i < moving - 1; i++)
+                copy_entry(node, i, left, from + 1 + i);
+            for (int i = 0; i < moving; i++)
+            {
+                node->children_array[i] = left->children_array[from + 1 + i];
+                left->children_array[from + 1 + i] = NULL;
+            }
+            copy_entry(parent, separator, left, from);
+        }
+        for (int i = from; i < left->NumberOfValidKeys; i++)
+            left->key_array[i].valid = 0;
+        left->NumberOfValidKeys -= moving;
+        node->NumberOfValidKeys += moving;
+    }
+
+/// Function to move the first keys (and children) of a node to the end of its left sibling, through the separator between them in the parent. The mirror of borrow_from_left.
+    template <class Node> void borrow_from_right(Node* node, Node* right, inner_node* parent, int separator, int moving)
+    {
+        int end = node->NumberOfValidKeys;
+        int removed = moving; // number of keys which leave right. For inner nodes, the last of them goes up to the parent.
+        if constexpr (Node::leaf)
+        {
+            for (int i = 0; i < moving; i++)
+                copy_entry(node, end + i, right, i);
+            set_key(parent, separator, right->key_array[moving]);
+        }
+        else
+        {
+            copy_entry(node, end, parent, separator);
+            for (int i = 0; i < moving - 1; i++)
+                copy_entry(node, end + 1 + i, right, i);
+            for (int i = 0; i < moving; i++)
+                node->children_array[end + 1 + i] = right->children_array[i];
+            copy_entry(parent, separator, right, moving - 1);
+            for (int i = moving; i <= right->NumberOfValidKeys; i++)
+                right->children_array[i - moving] = right->children_array[i];
+            for (int i = right->NumberOfValidKeys - moving + 1; i <= right->NumberOfValidKeys; i++)
+                right->children_array[i] = NULL;
+        }
+        for (int i = removed; i < right->NumberOfValidKeys; i++)
+            copy_entry(right, i - removed, right, i);
+        for (int i = right->NumberOfValidKeys - removed; i < right->NumberOfValidKeys; i++)
+            right->key_array[i].valid = 0;
+        right->NumberOfValidKeys -= removed;
+        node->NumberOfValidKeys += moving;
+    }
+
+/// Function to merge a node into its left sibling, and take the separator between them and the merged node out of the parent.
+/** For inner nodes the separator comes down between the keys of the two nodes. For leaves it is dropped, and the merged leaf is unlinked from the list of leaves. The merged
+    node is given back to the allocator, once no snapshot holds it any more.
+    @param left         The node which is kept.
+    @param right        Its right sibling, which is merged into it.
+    @param parent       Their parent.
+    @param separator    Index of the separator between the two nodes in the parent. */
+    template <class Node> void merge_nodes(Node* left, Node* right, inner_node* parent, int separator)
+    {
+        int end = left->NumberOfValidKeys;
+        if constexpr (Node::leaf)
+        {
+            for (int i = 0; i < right->NumberOfValidKeys; i++)
+                copy_entry(left, end + i, right, i);
+            left->NumberOfValidKeys += right->NumberOfValidKeys;
+            left->next_leaf = right->next_leaf;
+            if (right->next_leaf != NULL)
+                right->next_leaf->prev_leaf = left;
+            else
+                last_leaf = left;
+        }
+        else
+        {
+            copy_entry(left, end, parent, separator);
+            for (int i = 0; i < right->NumberOfValidKeys; i++)
+                copy_entry(left, end + 1 + i, right, i);
+            for (int i = 0; i <= right->NumberOfValidKeys; i++)
+                left->children_array[end + 1 + i] = right->children_array[i];
+            left->NumberOfValidKeys += right->NumberOfValidKeys + 1;
+        }
+        if (separator + 1 < parent->NumberOfValidKeys)
+            move_keys_left(parent, separator + 1, parent->NumberOfValidKeys - 1);
+        move_children_left(parent, separator + 2, parent->NumberOfValidKeys);
+        parent->key_array[parent->NumberOfValidKeys - 1].valid = 0;
+        parent->children_array[parent->NumberOfValidKeys] = NULL;
+        parent->NumberOfValidKeys--;
+        retire_node(right);
+    }
+
+/// Function to shift the children pointers to the left by one from index i to j (both inclusive). The counterpart of move_children_right.
+    void move_children_left(inner_node* node, int i, int j)
+    {
+        for (int counter = i; counter <= j; counter++)
+            node->children_array[counter - 1] = node->children_array[counter];
+    }
+
+/// Function to replace a root which has no keys left by its only child, as many times as needed. The tree loses a level every time.
+    void shrink_root()
+    {
+        while (root->level != 0 && root->NumberOfValidKeys == 0)
+        {
+            base_node* child = ((inner_node*)root)->children_array[0];
+            retire_node(root);
+            root = child;
+        }
+    }
+
+/// Function to free the root when it is a leaf with no keys left, which leaves the tree empty.
+    void drop_empty_root()
+    {
+        if (root == NULL || root->level != 0 || root->NumberOfValidKeys != 0)
+            return;
+        retire_node(root);
+        root = NULL;
+        first_leaf = NULL;
+        last_leaf = NULL;
+    }
+
+public:
+/// Function to take a consistent, read-only snapshot of the BTree, which can be scanned (from other threads too) while the tree keeps changing.
+/** Taking a snapshot costs O(1): it only pins the current root and starts a new epoch of the tree. From then on the tree is copy on write. A node which the snapshot shares
+    is never changed in place; the first change to it copies it, and the parent of the copy (shared too, or not) is made to point at the copy, up to the root. An insert or delete
+    then copies the path from the root to its leaf once per snapshot, and every later change to the same nodes is done in place on the copies. The nodes replaced are freed when
+    every snapshot holding them has been released. Long reports and backups can thus scan a stable view of the tree without blocking or being blocked by the writes.
+    Snapshots are taken on the thread which writes the tree.
+    @return The handle of the snapshot, which has to be released before the tree is destroyed. */
+    snapshot take_snapshot()
+    {
+        reclaim_snapshots();
+        thaw();
+        snapshot_state* state = new snapshot_state();
+        state->root = root;
+        state->epoch = current_epoch;
+        state->keys = key_count;
+        state->released.store(false, std::memory_order_relaxed);
+        snapshots.push_back(state);
+        pinned_epoch = current_epoch;
+        current_epoch++;
+        return snapshot(state);
+    }
+
+/// Number of snapshots of the tree which are held, or were released after the last write to the tree.
+    size_t snapshot_count() const
+    {
+        return snapshots.size();
+    }
+
+private:
+/// Function to get a version of a node on a path which can be changed without a snapshot noticing.
+/** The parent of a node which has to be copied is made writable first, the same way, up to the root, and the path is made to lead through the copies.
+    @param path     The path to the node.
+    @param level    The level of the node about to be changed.
+    @return The node to change instead, which is also the node of the path at that level now. */
+    template <class Node> Node* writable(node_path& path, int level)
+    {
+        Node* node = (Node*)path.nodes[level];
+        if (node->born > pinned_epoch)
+            return node;
+        inner_node* parent = node == root ? NULL : writable<inner_node>(path, level + 1);
+        Node* copy = writable(node, parent, parent == NULL ? 0 : path.slots[level + 1]);
+        path.nodes[level] = copy;
+        return copy;
+    }
+
+/// Function to get a version of a node which can be changed without a snapshot noticing.
+/** A node born after the newest snapshot is returned as it is. A node shared with a snapshot is copied, the copy takes its place in the tree (in its parent, or as the root) and
+    in the list of leaves, and the node itself is retired. The sibling link and latch fields are not read by snapshots, so they are updated in place on shared nodes. Children
+    are shared by the copy as they are, as they keep no pointer to their parent.
+    @param node     The node about to be changed.
+    @param parent   The parent of the node, which has to be writable already, or NULL if the node is the root.
+    @param position The index of the node among the children of parent.
+    @return The node to change instead. It holds the same keys and children, at the same positions. */
+    template <class Node> Node* writable(Node* node, inner_node* parent, int position)
+    {
+        if (node->born > pinned_epoch)
+            return node;
+        Node* copy = new_node<Node>(node->level);
+        for (int i = 0; i < node->NumberOfValidKeys; i++)
+            copy_entry(copy, i, node, i);
+        copy->NumberOfValidKeys = node->NumberOfValidKeys;
+        if constexpr (Node::leaf)
+        {
+            copy->tombstones = node->tombstones;
+            copy->last_insert = node->last_insert;
+            copy->run_length = node->run_length;
+            copy->prev_leaf = node->prev_leaf;
+            copy->next_leaf = node->next_leaf;
+            if (node->prev_leaf != NULL)
+                node->prev_leaf->next_leaf = copy;
+            else
+                first_leaf = copy;
+            if (node->next_leaf != NULL)
+                node->next_leaf->prev_leaf = copy;
+            else
+                last_leaf = copy;
+        }
+        else
+        {
+            for (int i = 0; i <= node->NumberOfValidKeys; i++)
+                copy->children_array[i] = node->children_array[i];
+        }
+        if (parent == NULL)
+            root = copy;
+        else
+            parent->children_array[position] = copy;
+        retire_node(node);
+        return copy;
+    }
+
+/// Function to give a node which was taken out of the tree back to the allocator, right away if no snapshot holds it and otherwise once the snapshots holding it are released.
+    void retire_node(base_node* node)
+    {
+        structure_version++;
+        if (node->born > pinned_epoch)
+            free_node(node);
+        else
+            retired.push_back(std::make_pair(node, current_epoch));
+    }
+
+/// Function to retire every node of a subtree, when the tree is cleared while snapshots are held.
+    void retire_subtree(base_node* node)
+    {
+        if (node->level != 0)
+        {
+            inner_node* inner = (inner_node*)node;
+            for (int i = 0; i <= inner->NumberOfValidKeys; i++)
+                retire_subtree(inner->children_array[i]);
+        }
+        retire_node(node);
+    }
+
+/// Function to drop the snapshots which were released and free the retired nodes which no snapshot holds any more. Called before every write to the tree.
+/** A snapshot taken in epoch s holds a retired node if the node was born in epoch s or before, and retired after the snapshot was taken, i.e. in an epoch after s. */
+    void reclaim_snapshots()
+    {
+        if (snapshots.empty())
+            return;
+        size_t kept = 0;
+        pinned_epoch = 0;
+        for (size_t i = 0; i < snapshots.size(); i++)
+        {
+            if (snapshots[i]->released.load(std::memory_order_acquire))
+                delete snapshots[i];
+            else
+            {
+                snapshots[kept++] = snapshots[i];
+                pinned_epoch = snapshots[i]->epoch;
+            }
+        }
+        snapshots.resize(kept);
+        kept = 0;
+        for (size_t i = 0; i < retired.size(); i++)
+        {
+            if (held_by_snapshot(retired[i].first->born, retired[i].second))
+                retired[kept++] = retired[i];
+            else
+                free_node(retired[i].first);
+        }
+        retired.resize(kept);
+    }
+
+/// Whether a snapshot which is still held was taken in an epoch from born up to (not including) retired_in.
+    bool held_by_snapshot(uint64_t born, uint64_t retired_in) const
+    {
+        for (size_t i = 0; i < snapshots.size(); i++)
+        {
+            if (snapshots[i]->epoch >= born && snapshots[i]->epoch < retired_in)
+                return true;
+        }
+        return false;
+    }
+};
+
+
+/// A node of a BTreeMap. Inner nodes hold separators and children only.
+template <class KeyType, class Value, class Traits, int Capacity, bool IsLeaf, size_t Alignment> class alignas(Alignment) Map_node : public Node_base<KeyType>,
+    public Map_separators<KeyType, Traits, Capacity + 1>
+{
+public:
+    static const int capacity = Capacity; /**< Maximum number of separators which the node holds outside of an insertion. */
+    static const bool leaf = false;
+
+    Node_base<KeyType>* children_array[Capacity + 2]; /**< The children, one more than the separators, with one buffer space at the end used while splitting. */
+
+    /** Constructor for inner nodes of a BTreeMap. The separators and children are left uninitialised, as only the first NumberOfValidKeys of them are ever read.
+    @param node_level The level of the node in the tree. Inner nodes are always at level 1 or above. */
+    Map_node(int node_level = 1)
+    {
+        this->NumberOfValidKeys = 0;
+        this->level = node_level;
+        this->born = 0;
+    }
+};
+
+/// Specialisation of Map_node for the leaves of a BTreeMap, which hold the keys and a pointer to the value of every key.
+template <class KeyType, class Value, class Traits, int Capacity, size_t Alignment> class alignas(Alignment) Map_node<KeyType, Value, Traits, Capacity, true, Alignment>
+    : public Node_base<KeyType>, public Node_search_keys<Traits, Capacity + 1>
+{
+public:
+    static const int capacity = Capacity; /**< Maximum number of keys which the leaf holds outside of an insertion. */
+    static const bool leaf = true;
+
+    KeyType key_array[Capacity + 1]; /**< The keys, with one buffer space at the end used while splitting. */
+
+    Value* value_array[Capacity + 1]; /**< The value of every key, at the same index. Values are allocated apart from the leaves, so they never move. */
+
+    Map_node* next_leaf; /**< The leaf holding the keys right after the keys of this leaf. NULL for the last leaf. */
+
+    Map_node* prev_leaf; /**< The leaf holding the keys right before the keys of this leaf. NULL for the first leaf. */
+
+    /** Constructor for the leaves of a BTreeMap. It sets NumberOfValidKeys to zero and both siblings of the leaf to NULL. */
+    Map_node()
+    {
+        next_leaf = NULL;
+        prev_leaf = NULL;
+        this->NumberOfValidKeys = 0;
+        this->level = 0;
+        this->born = 0;
+    }
+};
+
+
+/// Compile time geometry of the nodes of a BTreeMap whose nodes are meant to be NodeSize bytes large, and of the blocks of its values.
+/** A leaf entry is a key, its normalized form and the pointer to its value; an inner entry is a separator and a child pointer. With primary_key (16 bytes, normalized to 12) a
+    4 KiB leaf holds 111 keys and a 4 KiB inner node 201 separators, almost twice as many as an inner node of a BTree, whatever the size of the values. With the 8 byte forms of
+    primary_key_packed_traits, an inner node holds 252 separators, twice as many. */
+template <class KeyType, class Value, size_t NodeSize, class Traits = key_traits<KeyType> > struct map_geometry
+{
+    static const size_t alignment = NodeSize >= PAGE_BYTES ? PAGE_BYTES : CACHE_LINE_SIZE;
+    static const size_t header_size = sizeof(Node_base<KeyType>);
+    static const size_t leaf_entry_size = sizeof(KeyType) + normalized_key_size<Traits>() + sizeof(Value*); /**< Bytes taken by one key, its normalized form and its value pointer. */
+    static const size_t separator_size = Traits::normalized ? normalized_key_size<Traits>() : sizeof(KeyType); /**< Bytes taken by one separator. */
+
+    static const int leaf_capacity = (int)((NodeSize - header_size - 3 * sizeof(void*)) / leaf_entry_size) - 1;
+    static const int inner_capacity = (int)((NodeSize - header_size - 2 * sizeof(void*)) / (separator_size + sizeof(void*))) - 1;
+
+    typedef Map_node<KeyType, Value, Traits, leaf_capacity, true, alignment> leaf_node;
+    typedef Map_node<KeyType, Value, Traits, inner_capacity, false, alignment> inner_node;
+
+    static const size_t value_alignment = alignof(Value) > alignof(void*) ? alignof(Value) : alignof(void*); /**< Alignment of the blocks of the values. */
+    static const size_t value_block_size = ((sizeof(Value) > sizeof(void*) ? sizeof(Value) : sizeof(void*)) + value_alignment - 1) / value_alignment * value_alignment;
+
+    static_assert(NodeSize % alignment == 0, "The node size has to be a multiple of the cache line size.");
+    static_assert(leaf_capacity >= 3 && inner_capacity >= 3, "The node size is too small to hold three keys. Increase NodeSize.");
+    static_assert(sizeof(leaf_node) <= NodeSize && sizeof(inner_node) <= NodeSize, "Node layout does not fit in the target node size.");
+};
+
+
+/// A sorted map from keys to values, which are kept apart from the tree so that pointers to them stay valid.
+/** Unlike BTree, which stores whole records in every node, the map stores a key once, in a leaf, with a pointer to its value; inner nodes hold only compact separators (see
+    Map_separators), so that their fanout does not depend on the size of the keys' records and the tree stays flat. Every value is allocated once, from a pool of its own, when
+    its key is added, and stays at the same address until its key is erased: splits and other structural changes only move the pointers in the leaves. A Value* returned by find
+    is therefore a stable handle, and find_and_modify and upsert change values in place.
+    Keys are unique. Insertions split full nodes on the way back up along the path of the descent. Like PagedBTree, an erase which empties a leaf frees it and takes it out of the
+    nodes above, and nodes are not merged otherwise. The map is meant to be used from one thread at a time.
+*/
+template <class KeyType, class Value, size_t NodeSize = BLOCK_SIZE, class Traits = key_traits<KeyType> > class BTreeMap
+{
+public:
+    typedef map_geometry<KeyType, Value, NodeSize, Traits> geometry;
+    typedef BTree<KeyType, NodeSize, Traits> tree_type; /**< The tree whose node level helpers (searches, key copies) are shared. */
+    typedef Node_base<KeyType> base_node;
+    typedef typename geometry::leaf_node leaf_node;
+    typedef typename geometry::inner_node inner_node;
+    typedef typename inner_node::separator_type separator_type;
+    static const int leaf_capacity = geometry::leaf_capacity; /**< Number of keys held by a full leaf. */
+    static const int inner_capacity = geometry::inner_capacity; /**< Number of separators held by a full inner node. */
+    static const int max_height = 64; /**< Bound on the height of the tree, see BTree::max_height. */
+
+private:
+    base_node* root; /**< The root. NULL for an empty map. */
+    leaf_node* first_leaf; /**< The leftmost leaf, where iteration starts. */
+    size_t key_count; /**< Number of keys in the map. */
+    Node_allocator<NodeSize, geometry::alignment> allocator; /**< The pool of all nodes of the tree. */
+    Node_allocator<geometry::value_block_size, geometry::value_alignment> value_allocator; /**< The pool of all values. */
+
+    /// The nodes on the way from the root down to a leaf, by level, with the child taken in every inner node. Like BTree::node_path.
+    struct node_path
+    {
+        base_node* nodes[max_height]; /**< The node of every level on the way: nodes[0] is the leaf and nodes[root->level] the root. */
+        int slots[max_height]; /**< For every inner level l, the index of nodes[l - 1] among the children of nodes[l]. */
+    };
+
+public:
+    /// An iterator over the keys and values of the map in key order.
+    /** Any insertion or erase invalidates all iterators, but not the pointers to values, which stay valid until their key is erased. */
+    class iterator
+    {
+    public:
+        iterator() : leaf(NULL), index(0) {}
+
+        const KeyType& key() const { return leaf->key_array[index]; } /**< The key at the iterator. */
+        Value& value() const { return *leaf->value_array[index]; } /**< The value of the key at the iterator. */
+
+        iterator& operator++()
+        {
+            if (++index == leaf->NumberOfValidKeys)
+            {
+                leaf = leaf->next_leaf;
+                index = 0;
+            }
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const { return leaf == other.leaf && index == other.index; }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        iterator(leaf_node* at, int position) : leaf(at), index(position) {}
+
+        leaf_node* leaf; /**< The leaf of the current key. NULL for the end iterator. */
+        int index; /**< Index of the current key in the leaf. */
+        friend class BTreeMap;
+    };
+
+    /** Constructor for the BTreeMap. The map starts empty.
+    @param use_huge_pages   Whether the slabs from which nodes are allocated should be backed by huge pages. */
+    BTreeMap(bool use_huge_pages = false) : allocator(use_huge_pages)
+    {
+        root = NULL;
+        first_leaf = NULL;
+        key_count = 0;
+    }
+
+    /** Destructor for the BTreeMap. Every handle to its values becomes invalid. */
+    ~BTreeMap()
+    {
+        clear();
+    }
+
+    BTreeMap(const BTreeMap&) = delete;
+    BTreeMap& operator=(const BTreeMap&) = delete;
+
+/// Function to add a key with its value, if the key is not in the map yet.
+/** @return Whether the key was added. A key already in the map keeps its value. */
+    bool insert(const KeyType& key, const Value& value)
+    {
+        bool added;
+        add(key, value, false, added);
+        return added;
+    }
+
+/// Function to add a key with its value, or to replace the value of the key if it is in the map already. The value is assigned in place, so handles to it stay valid.
+/** @return Whether the key was added, rather than its value replaced. */
+    bool upsert(const KeyType& key, const Value& value)
+    {
+        bool added;
+        add(key, value, true, added);
+        return added;
+    }
+
+/// Function to look up the value of a key, adding the key with the given value first if it is not in the map yet. One descent does both.
+/** @return A pointer to the value, which stays valid until its key is erased. */
+    Value* find_or_insert(const KeyType& key, const Value& value)
+    {
+        bool added;
+        return add(key, value, false, added);
+    }
+
+/// Function to change the value of a key in place.
+/** @param key      The key whose value is changed.
+    @param modify   Called with a reference to the value, if the key is in the map.
+    @return Whether the key is in the map. */
+    template <class Modify> bool find_and_modify(const KeyType& key, Modify modify)
+    {
+        Value* value = find(key);
+        if (value == NULL)
+            return false;
+        modify(*value);
+        return true;
+    }
+
+/// Function to look up the value of the first key matching a probe.
+/** @param probe    A key, or any probe which the key traits can compare keys with.
+    @return A pointer to the value, which stays valid until its key is erased, or NULL if no key matches. */
+    template <class Probe> Value* find(const Probe& probe) const
+    {
+        leaf_node* leaf;
+        int position;
+        if (!seek(probe, leaf, position) || !tree_type::matches(leaf, position, probe))
+            return NULL;
+        return leaf->value_array[position];
+    }
+
+/// Function to copy the value of the first key matching a probe.
+/** @param probe    A key, or any probe which the key traits can compare keys with.
+    @param result   Set to a copy of the value, if a key matches.
+    @return Whether a key matches. */
+    template <class Probe> bool get(const Probe& probe, Value& result) const
+    {
+        Value* value = find(probe);
+        if (value == NULL)
+            return false;
+        result = *value;
+        return true;
+    }
+
+/// Function to remove a key and its value. Handles to the value become invalid.
+/** @return Whether the key was in the map. */
+    bool erase(const KeyType& key)
+    {
+        if (root == NULL)
+            return false;
+        node_path path;
+        leaf_node* leaf = descend(key, path);
+        int position = tree_type::upper_index(leaf, key) - 1;
+        if (position < 0 || !tree_type::matches(leaf, position, key))
+            return false;
+        free_value(leaf->value_array[position]);
+        for (int i = position + 1; i < leaf->NumberOfValidKeys; i++)
+            move_entry(leaf, i - 1, i);
+        leaf->NumberOfValidKeys--;
+        key_count--;
+        if (leaf->NumberOfValidKeys == 0)
+            release_leaf(path);
+        return true;
+    }
+
+/// Function to remove every key and value. Every handle to a value becomes invalid.
+    void clear()
+    {
+        if (!std::is_trivially_destructible<Value>::value)
+        {
+            for (leaf_node* leaf = first_leaf; leaf != NULL; leaf = leaf->next_leaf)
+                for (int i = 0; i < leaf->NumberOfValidKeys; i++)
+                    leaf->value_array[i]->~Value();
+        }
+        if (!std::is_trivially_destructible<KeyType>::value && root != NULL)
+            destroy_subtree(root);
+        allocator.release_all();
+        value_allocator.release_all();
+        root = NULL;
+        first_leaf = NULL;
+        key_count = 0;
+    }
+
+/// Iterator to the first key not smaller than a probe, or the end iterator if there is none.
+    template <class Probe> iterator lower_bound(const Probe& probe) const
+    {
+        leaf_node* leaf;
+        int position;
+        if (!seek(probe, leaf, position))
+            return end();
+        return iterator(leaf, position);
+    }
+
+/// Iterator to the first key larger than a probe, or the end iterator if there is none.
+    template <class Probe> iterator upper_bound(const Probe& probe) const
+    {
+        leaf_node* leaf;
+        int position;
+        if (!seek(probe, leaf, position, true))
+            return end();
+        return iterator(leaf, position);
+    }
+
+/// The range of the keys matching a probe, like BTree::equal_range. With a prefix probe, these are all the keys which start with the prefix.
+    template <class Probe> std::pair<iterator, iterator> equal_range(const Probe& probe) const
+    {
+        return std::make_pair(lower_bound(probe), upper_bound(probe));
+    }
+
+    iterator begin() const { return iterator(first_leaf, 0); } /**< Iterator to the smallest key. */
+    iterator end() const { return iterator(); } /**< Iterator past the largest key. */
+    size_t size() const { return key_count; } /**< Number of keys in the map. */
+    const Node_allocator<NodeSize, geometry::alignment>& node_allocator() const { return allocator; } /**< The pool of the nodes, for their memory usage. */
+    const Node_allocator<geometry::value_block_size, geometry::value_alignment>& values() const { return value_allocator; } /**< The pool of the values. */
+
+private:
+/// Function to create a node of the given type from a block of the allocator.
+    template <class Node> Node* new_node(int level)
+    {
+        Node* created = new (allocator.allocate()) Node();
+        created->level = level;
+        return created;
+    }
+
+/// Function to destroy a value and give its block back.
+    void free_value(Value* value)
+    {
+        value->~Value();
+        value_allocator.deallocate(value);
+    }
+
+/// Function to destroy a node and give its block back.
+    void free_node(base_node* node)
+    {
+        if (node->level == 0)
+            ((leaf_node*)node)->~leaf_node();
+        else
+            ((inner_node*)node)->~inner_node();
+        allocator.deallocate(node);
+    }
+
+/// Function to run the destructor of every node of a subtree, when the keys have destructors.
+    void destroy_subtree(base_node* node)
+    {
+        if (node->level != 0)
+        {
+            inner_node* inner = (inner_node*)node;
+            for (int i = 0; i <= inner->NumberOfValidKeys; i++)
+                destroy_subtree(inner->children_array[i]);
+            inner->~inner_node();
+            return;
+        }
+        ((leaf_node*)node)->~leaf_node();
+    }
+
+/// The separator at an index of an inner node: a normalized key, or a key.
+    static separator_type& separator(inner_node* node, int index)
+    {
+        if constexpr (Traits::normalized)
+            return node->search_array[index];
+        else
+            return node->key_array[index];
+    }
+
+/// The separator which sends a key, and every larger key, to the right of it.
+    static separator_type separator_of(const KeyType& key)
+    {
+        if constexpr (Traits::normalized)
+            return Traits::normalize(key);
+        else
+            return key;
+    }
+
+/// Function to move the key and value at index from of a leaf to index to.
+    static void move_entry(leaf_node* leaf, int to, int from)
+    {
+        tree_type::copy_entry(leaf, to, leaf, from);
+        leaf->value_array[to] = leaf->value_array[from];
+    }
+
+/// Function doing the work of insert, upsert and find_or_insert.
+/** @param added    Set to whether the key was added.
+    @return The value of the key. */
+    Value* add(const KeyType& key, const Value& value, bool replace, bool& added)
+    {
+        if (root == NULL)
+        {
+            first_leaf = new_node<leaf_node>(0);
+            root = first_leaf;
+        }
+        node_path path;
+        leaf_node* leaf = descend(key, path);
+        int position = tree_type::upper_index(leaf, key);
+        added = !(position > 0 && tree_type::matches(leaf, position - 1, key));
+        if (!added)
+        {
+            if (replace)
+                *leaf->value_array[position - 1] = value;
+            return leaf->value_array[position - 1];
+        }
+        Value* stored = new (value_allocator.allocate()) Value(value);
+        for (int i = leaf->NumberOfValidKeys - 1; i >= position; i--)
+            move_entry(leaf, i + 1, i);
+        tree_type::set_key(leaf, position, key);
+        leaf->value_array[position] = stored;
+        leaf->NumberOfValidKeys++;
+        key_count++;
+        if (leaf->NumberOfValidKeys > leaf_capacity)
+            split_leaf(path);
+        return stored;
+    }
+
+/// Function to go down from the root to the leaf where a key belongs, taking in every inner node the child left of the first separator larger than the key.
+/** @param key      The key.
+    @param path     Filled with the path from the root to the leaf.
+    @return The leaf reached. */
+    leaf_node* descend(const KeyType& key, node_path& path)
+    {
+        base_node* current = root;
+        while (current->level != 0)
+        {
+            int position = tree_type::upper_index((inner_node*)current, key);
+            path.nodes[current->level] = current;
+            path.slots[current->level] = position;
+            current = ((inner_node*)current)->children_array[position];
+        }
+        path.nodes[0] = current;
+        return (leaf_node*)current;
+    }
+
+/// Function to find the first key not smaller than a probe (or, if upper is true, the first key larger than it), as a leaf and a position in it, like BTree::seek.
+/** @return Whether there is such a key. */
+    template <class Probe> bool seek(const Probe& probe, leaf_node*& leaf, int& position, bool upper = false) const
+    {
+        if (root == NULL)
+            return false;
+        base_node* current = root;
+        while (current->level != 0)
+        {
+            inner_node* inner = (inner_node*)current;
+            current = inner->children_array[upper ? tree_type::upper_index(inner, probe) : tree_type::lower_index(inner, probe)];
+        }
+        leaf = (leaf_node*)current;
+        position = upper ? tree_type::upper_index(leaf, probe) : tree_type::lower_index(leaf, probe);
+        if (position == leaf->NumberOfValidKeys) // every key of the leaf is smaller, so the bound is the first key of the next leaf. Leaves are never empty.
+        {
+            leaf = leaf->next_leaf;
+            position = 0;
+        }
+        return leaf != NULL;
+    }
+
+/// Function to split a leaf which has used its buffer space in two, and to add the new leaf to the node above, splitting the nodes above along the path as far as needed.
+    void split_leaf(node_path& path)
+    {
+        leaf_node* leaf = (leaf_node*)path.nodes[0];
+        leaf_node* right = new_node<leaf_node>(0);
+        int break_point = (leaf_capacity + 1) / 2;
+        for (int i = break_point; i < leaf->NumberOfValidKeys; i++)
+        {
+            tree_type::copy_entry(right, i - break_point, leaf, i);
+            right->value_array[i - break_point] = leaf->value_array[i];
+        }
+        right->NumberOfValidKeys = leaf->NumberOfValidKeys - break_point;
+        leaf->NumberOfValidKeys = break_point;
+        right->next_leaf = leaf->next_leaf;
+        right->prev_leaf = leaf;
+        if (leaf->next_leaf != NULL)
+            leaf->next_leaf->prev_leaf = right;
+        leaf->next_leaf = right;
+        separator_type split_separator = separator_of(right->key_array[0]);
+        base_node* added = right;
+        int height = root->level;
+        for (int level = 1; level <= height; level++) // add the separator and the new node to the parent, which may have to be split in turn.
+        {
+            inner_node* parent = (inner_node*)path.nodes[level];
+            int position = path.slots[level];
+            for (int i = parent->NumberOfValidKeys - 1; i >= position; i--)
+                separator(parent, i + 1) = separator(parent, i);
+            for (int i = parent->NumberOfValidKeys; i > position; i--)
+                parent->children_array[i + 1] = parent->children_array[i];
+            separator(parent, position) = split_separator;
+            parent->children_array[position + 1] = added;
+            parent->NumberOfValidKeys++;
+            if (parent->NumberOfValidKeys <= inner_capacity)
+                return;
+            inner_node* sibling = new_node<inner_node>(level);
+            break_point = (inner_capacity + 1) / 2;
+            split_separator = separator(parent, break_point - 1); // it goes up, and is kept by neither of the two nodes.
+            for (int i = break_point; i < parent->NumberOfValidKeys; i++)
+                separator(sibling, i - break_point) = separator(parent, i);
+            for (int i = break_point; i <= parent->NumberOfValidKeys; i++)
+                sibling->children_array[i - break_point] = parent->children_array[i];
+            sibling->NumberOfValidKeys = parent->NumberOfValidKeys - break_point;
+            parent->NumberOfValidKeys = break_point - 1;
+            added = sibling;
+        }
+        assert(height + 1 < max_height);
+        inner_node* fresh = new_node<inner_node>(height + 1); // the root was split, so the tree grows a level.
+        fresh->children_array[0] = root;
+        fresh->children_array[1] = added;
+        separator(fresh, 0) = split_separator;
+        fresh->NumberOfValidKeys = 1;
+        root = fresh;
+    }
+
+/// Function to free a leaf left without keys, unlinking it from the list of leaves and taking it out of the nodes above, like PagedBTree::release_leaf.
+    void release_leaf(node_path& path)
+    {
+        leaf_node* leaf = (leaf_node*)path.nodes[0];
+        if (leaf->prev_leaf != NULL)
+            leaf->prev_leaf->next_leaf = leaf->next_leaf;
+        else
+            first_leaf = leaf->next_leaf;
+        if (leaf->next_leaf != NULL)
+            leaf->next_leaf->prev_leaf = leaf->prev_leaf;
+        int height = root->level;
+        free_node(leaf);
+        if (height == 0)
+        {
+            root = NULL;
+            return;
+        }
+        for (int level = 1; level <= height; level++) // take the child out of its parent. A parent left without children goes as well.
+        {
+            inner_node* parent = (inner_node*)path.nodes[level];
+            if (parent->NumberOfValidKeys == 0)
+            {
+                free_node(parent);
+                continue;
+            }
+            int position = path.slots[level];
+            int removed = position == 0 ? 0 : position - 1; // the separator in front of the child goes with it, or the one after it for the first child.
+            for (int i = removed + 1; i < parent->NumberOfValidKeys; i++)
+                separator(parent, i - 1) = separator(parent, i);
+            for (int i = position + 1; i <= parent->NumberOfValidKeys; i++)
+                parent->children_array[i - 1] = parent->children_array[i];
+            parent->NumberOfValidKeys--;
+            break;
+        }
+        while (root->level != 0 && root->NumberOfValidKeys == 0) // a root with a single child is replaced by it.
+        {
+            base_node* child = ((inner_node*)root)->children_array[0];
+            free_node(root);
+            root = child;
+        }
+    }
+};
+
+
+/// The header of a node of a StringBTree, in front of the slotted page which holds its keys.
+class String_node_header : public Node_base<std::string_view>
+{
+public:
+    String_node_header* next_leaf; /**< The leaf holding the keys right after the keys of this leaf. NULL for the last leaf and for inner nodes. */
+
+    String_node_header* prev_leaf; /**< The leaf holding the keys right before the keys of this leaf. NULL for the first leaf and for inner nodes. */
+
+    Node_base<std::string_view>* upper; /**< The last child of an inner node, right of every separator. The other children are the payloads of the separators. */
+
+    uint16_t payload_length; /**< Bytes of the payload after every key: the value in a leaf, the child pointer in an inner node. */
+
+    uint16_t prefix_length; /**< Number of leading bytes which every key of the node shares with its fences. They are kept once, at the start of the lower fence. */
+
+    uint16_t lower_fence_offset, lower_fence_length; /**< The lower fence: every key of the node is at least as large. Empty for the leftmost node of a level. */
+
+    uint16_t upper_fence_offset, upper_fence_length; /**< The upper fence: every key of the node is smaller. Empty for the rightmost node of a level, which is unbounded. */
+
+    uint16_t heap_start; /**< Offset of the first byte in use of the heap, which grows down from the end of the node towards the slot array. */
+
+    uint16_t free_heap; /**< Bytes of the heap left behind by removed keys, which a compaction gets back. */
+};
+
+
+/// A node of a StringBTree: a slotted page, with an array of slots growing up from the header and a heap of key bytes and payloads growing down from the end.
+/** The fences of a node are the separators around it in its parent, so every key the node will ever hold lies between them and starts with their common prefix. That prefix
+    is stored once per node and cut off every key, so keys sharing long prefixes (last names of a district, URLs of a site) take only their distinct tails. Every slot also keeps
+    the first four bytes of the tail of its key, so a binary search mostly compares integers in the slot array and only goes to the heap to break ties. */
+template <size_t NodeSize, size_t Alignment> class alignas(Alignment) String_node : public String_node_header
+{
+public:
+    /// A slot of the slot array, one per key in key order.
+    struct slot
+    {
+        uint16_t offset; /**< Offset in the body of the tail of the key, which the payload follows. */
+        uint16_t length; /**< Length of the tail of the key, past the prefix of the node. */
+        uint32_t head; /**< The first four bytes of the tail, big endian and padded with zeroes, which order like the tails themselves unless they are equal. */
+    };
+
+    static const size_t body_size = NodeSize - sizeof(String_node_header); /**< Bytes shared by the slot array and the heap. */
+
+    unsigned char body[body_size]; /**< The slot array at the front and the heap at the back. */
+
+    /** Constructor for the nodes of a StringBTree. The node starts without keys and with unbounded fences.
+    @param node_level       The level of the node in the tree.
+    @param payload_bytes    Bytes of the payload of every key. */
+    String_node(int node_level, size_t payload_bytes)
+    {
+        this->NumberOfValidKeys = 0;
+        this->level = node_level;
+        this->born = 0;
+        next_leaf = NULL;
+        prev_leaf = NULL;
+        upper = NULL;
+        payload_length = (uint16_t)payload_bytes;
+        prefix_length = 0;
+        lower_fence_offset = lower_fence_length = 0;
+        upper_fence_offset = upper_fence_length = 0;
+        heap_start = (uint16_t)body_size;
+        free_heap = 0;
+    }
+
+    slot* slots() { return (slot*)body; }
+    const slot* slots() const { return (const slot*)body; }
+    const unsigned char* prefix() const { return body + lower_fence_offset; } /**< The prefix shared by every key of the node. */
+    const unsigned char* tail(int index) const { return body + slots()[index].offset; } /**< The bytes of the key at an index past the prefix. */
+    unsigned char* payload(int index) { return body + slots()[index].offset + slots()[index].length; } /**< The payload of the key at an index, which may be unaligned. */
+    const unsigned char* payload(int index) const { return body + slots()[index].offset + slots()[index].length; }
+    size_t key_length(int index) const { return prefix_length + slots()[index].length; } /**< Length of the whole key at an index. */
+    std::string_view lower_fence() const { return std::string_view((const char*)body + lower_fence_offset, lower_fence_length); }
+    std::string_view upper_fence() const { return std::string_view((const char*)body + upper_fence_offset, upper_fence_length); }
+
+    /// Bytes between the slot array and the heap.
+    size_t free_space() const { return heap_start - this->NumberOfValidKeys * sizeof(slot); }
+
+    /// Bytes which would be free after a compaction of the heap.
+    size_t space_after_compaction() const { return free_space() + free_heap; }
+
+    /// Bytes which a key of the given length, with its slot and payload, takes in the node.
+    size_t space_needed(size_t key_bytes) const { return sizeof(slot) + key_bytes - prefix_length + payload_length; }
+
+    /// Whether a key of the given length fits in the node, compacting it if needed.
+    bool has_space_for(size_t key_bytes) const { return space_needed(key_bytes) <= space_after_compaction(); }
+
+    /// Function to set the fences of a node without keys, and the prefix which they share.
+    void set_fences(std::string_view lower, std::string_view upper_bound)
+    {
+        assert(this->NumberOfValidKeys == 0);
+        lower_fence_offset = store(lower.data(), lower.size());
+        lower_fence_length = (uint16_t)lower.size();
+        upper_fence_offset = store(upper_bound.data(), upper_bound.size());
+        upper_fence_length = (uint16_t)upper_bound.size();
+        size_t shared = 0;
+        if (!upper_bound.empty()) // an unbounded node has keys without any common prefix.
+            while (shared < lower.size() && shared < upper_bound.size() && lower[shared] == upper_bound[shared])
+                shared++;
+        prefix_length = (uint16_t)shared;
+    }
+
+    /// Function to copy the whole key at an index, prefix included, into a buffer.
+    /** @return The length of the key. */
+    size_t copy_key(int index, unsigned char* out) const
+    {
+        memcpy(out, prefix(), prefix_length);
+        memcpy(out + prefix_length, tail(index), slots()[index].length);
+        return key_length(index);
+    }
+
+    /// The child at an index of an inner node: the payload of the separator at that index, or the upper child past the last separator.
+    Node_base<std::string_view>* child(int index) const
+    {
+        if (index == this->NumberOfValidKeys)
+            return upper;
+        Node_base<std::string_view>* found;
+        memcpy(&found, payload(index), sizeof(found));
+        return found;
+    }
+
+    /// Function to replace the child at an index of an inner node.
+    void set_child(int index, Node_base<std::string_view>* node)
+    {
+        if (index == this->NumberOfValidKeys)
+            upper = node;
+        else
+            memcpy(payload(index), &node, sizeof(node));
+    }
+
+    /// Function to get the first four bytes of a tail as a big endian integer, padded with zeroes.
+    static uint32_t head_of(const unsigned char* bytes, size_t length)
+    {
+        uint32_t head = 0;
+        for (size_t i = 0; i < 4; i++)
+            head = (head << 8) | (i < length ? bytes[i] : 0);
+        return head;
+    }
+
+    /// Function to find the first key of the node not smaller than a key (or, if upper_bound is true, the first one which is larger). The key has to lie between the fences.
+    /** @param key          The key, which starts with the prefix of the node.
+        @param upper_bound  Whether keys equal to key come before the index found.
+        @param found        Set to whether a key of the node is equal to key.
+        @return The index found, between 0 and NumberOfValidKeys. */
+    int search(std::string_view key, bool upper_bound, bool& found) const
+    {
+        assert(key.size() >= prefix_length && memcmp(key.data(), prefix(), prefix_length) == 0);
+        const unsigned char* rest = (const unsigned char*)key.data() + prefix_length;
+        size_t rest_length = key.size() - prefix_length;
+        uint32_t head = head_of(rest, rest_length);
+        int low = 0, high = this->NumberOfValidKeys;
+        found = false;
+        while (low < high)
+        {
+            int middle = (low + high) / 2;
+            int order = compare(middle, head, rest, rest_length);
+            if (order < 0)
+                low = middle + 1;
+            else if (order > 0)
+                high = middle;
+            else
+            {
+                found = true; // keys of a node are unique.
+                return upper_bound ? middle + 1 : middle;
+            }
+        }
+        return low;
+    }
+
+    /// Function to add a key and its payload at an index. The key has to start with the prefix of the node, and has_space_for has to hold for it.
+    void insert(int index, std::string_view key, const void* payload_bytes)
+    {
+        assert(has_space_for(key.size()) && key.size() >= prefix_length);
+        if (free_space() < space_needed(key.size()))
+            compact();
+        size_t length = key.size() - prefix_length;
+        memmove(slots() + index + 1, slots() + index, (this->NumberOfValidKeys - index) * sizeof(slot));
+        heap_start -= (uint16_t)(length + payload_length);
+        memcpy(body + heap_start, key.data() + prefix_length, length);
+        memcpy(body + heap_start + length, payload_bytes, payload_length);
+        slots()[index].offset = heap_start;
+        slots()[index].length = (uint16_t)length;
+        slots()[index].head = head_of((const unsigned char*)key.data() + prefix_length, length);
+        this->NumberOfValidKeys++;
+    }
+
+    /// Function to remove the key at an index. Its bytes in the heap are given back by the next compaction.
+    void remove(int index)
+    {
+        free_heap += slots()[index].length + payload_length;
+        memmove(slots() + index, slots() + index + 1, (this->NumberOfValidKeys - index - 1) * sizeof(slot));
+        this->NumberOfValidKeys--;
+    }
+
+    /// Function to pack the fences and the keys in use at the end of the heap, getting back the bytes of removed keys.
+    void compact()
+    {
+        unsigned char copy[body_size];
+        memcpy(copy, body, body_size);
+        const slot* old_slots = (const slot*)copy;
+        heap_start = (uint16_t)body_size;
+        free_heap = 0;
+        lower_fence_offset = store(copy + lower_fence_offset, lower_fence_length);
+        upper_fence_offset = store(copy + upper_fence_offset, upper_fence_length);
+        for (int i = 0; i < this->NumberOfValidKeys; i++)
+            slots()[i].offset = store(copy + old_slots[i].offset, old_slots[i].length + payload_length);
+    }
+
+private:
+/// Function to compare the key at an index with the tail of a key: negative, zero or positive as the key at the index is smaller than, equal to or larger than it.
+    int compare(int index, uint32_t head, const unsigned char* rest, size_t rest_length) const
+    {
+        const slot& at = slots()[index];
+        if (at.head != head)
+            return at.head < head ? -1 : 1;
+        int order = memcmp(body + at.offset, rest, std::min((size_t)at.length, rest_length));
+        if (order != 0)
+            return order;
+        return at.length < rest_length ? -1 : (at.length > rest_length ? 1 : 0);
+    }
+
+/// Function to put bytes at the bottom of the heap. @return Their offset.
+    uint16_t store(const void* bytes, size_t length)
+    {
+        heap_start -= (uint16_t)length;
+        memcpy(body + heap_start, bytes, length);
+        return heap_start;
+    }
+};
+
+
+/// Compile time geometry of the nodes of a StringBTree whose nodes are NodeSize bytes large.
+/** Nodes hold as many keys as their bytes allow rather than a fixed number. Keys are limited to an eighth of a node, so that a split always leaves both halves room for their
+    fences and for the key which caused it. */
+template <class Value, size_t NodeSize> struct string_geometry
+{
+    static const size_t alignment = NodeSize >= PAGE_BYTES ? PAGE_BYTES : CACHE_LINE_SIZE;
+    typedef String_node<NodeSize, alignment> node_type;
+    static const size_t body_size = node_type::body_size;
+    static const size_t max_key_length = body_size / 8; /**< Length of the longest key which can be added. */
+    static const size_t max_payload = sizeof(Value) > sizeof(void*) ? sizeof(Value) : sizeof(void*);
+
+    static_assert(NodeSize % alignment == 0, "The node size has to be a multiple of the cache line size.");
+    static_assert(NodeSize <= 65536, "Offsets in a node are 16 bits, so nodes cannot be larger than 64 KiB.");
+    static_assert(sizeof(node_type) == NodeSize, "Node layout does not fit in the target node size.");
+    static_assert(max_payload + sizeof(typename node_type::slot) <= body_size / 8, "The values are too large for the node size. Increase NodeSize.");
+    static_assert(std::is_trivially_copyable<Value>::value, "Values are copied byte by byte into the nodes, so they have to be trivially copyable.");
+};
+
+
+/// A sorted map from variable length byte strings to values, on slotted page nodes with prefix compression and truncated separators.
+/** BTree and BTreeMap copy keys of a fixed size around, so they cannot index string columns such as customer last names. The nodes of a StringBTree are slotted pages (see
+    String_node): keys of any length up to max_key_length are stored back to back in a heap, with a slot array in key order in front of it, so a node holds as many keys as fit in
+    its bytes. Every node cuts the prefix shared by its fences off its keys, and a leaf split pushes up only the shortest prefix of the first key of the right leaf which is
+    larger than the last key of the left leaf (suffix truncation). Short separators keep inner nodes wide, and narrow fences make prefixes long further down.
+    Keys are unique and compare like memcmp, shorter keys first; composite keys (last name, first name, id) are concatenated with fixed width or terminated fields. Values are
+    trivially copyable and stored next to their keys, so they move with them and are returned as copies. Insertions split full nodes, splitting parents first along the path of
+    the descent if they cannot take the separator. A node which an erase leaves below MIN_FILL_FACTOR of its bytes is merged with a sibling when the two fit in one node. The tree
+    is meant to be used from one thread at a time.
+*/
+template <class Value, size_t NodeSize = BLOCK_SIZE> class StringBTree
+{
+public:
+    typedef string_geometry<Value, NodeSize> geometry;
+    typedef typename geometry::node_type node_type;
+    typedef typename node_type::slot slot_type;
+    static const size_t max_key_length = geometry::max_key_length; /**< Length of the longest key which can be added. */
+    static const int max_height = 64; /**< Bound on the height of the tree, see BTree::max_height. */
+
+private:
+    node_type* root; /**< The root. NULL for an empty tree. */
+    node_type* first_leaf; /**< The leftmost leaf, where iteration starts. */
+    size_t key_count; /**< Number of keys in the tree. */
+    Node_allocator<NodeSize, geometry::alignment> allocator; /**< The pool of all nodes of the tree. */
+
+    /// The nodes on the way from the root down to a leaf, by level, with the child taken in every inner node. Like BTree::node_path.
+    struct node_path
+    {
+        node_type* nodes[max_height]; /**< The node of every level on the way: nodes[0] is the leaf and nodes[root->level] the root. */
+        int slots[max_height]; /**< For every inner level l, the index of nodes[l - 1] among the children of nodes[l]. */
+    };
+
+public:
+    /// An iterator over the keys and values of the tree in key order. Any insertion or erase invalidates all iterators.
+    class iterator
+    {
+    public:
+        iterator() : leaf(NULL), index(0) {}
+
+        /// The key at the iterator, put back together from the prefix of its leaf and its tail.
+        std::string key() const
+        {
+            std::string whole((const char*)leaf->prefix(), leaf->prefix_length);
+            whole.append((const char*)leaf->tail(index), leaf->slots()[index].length);
+            return whole;
+        }
+
+        /// A copy of the value of the key at the iterator.
+        Value value() const
+        {
+            Value copy;
+            memcpy(&copy, leaf->payload(index), sizeof(Value));
+            return copy;
+        }
+
+        iterator& operator++()
+        {
+            if (++index == leaf->NumberOfValidKeys)
+            {
+                leaf = next_with_keys((node_type*)leaf->next_leaf);
+                index = 0;
+            }
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const { return leaf == other.leaf && index == other.index; }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        iterator(node_type* at, int position) : leaf(at), index(position) {}
+
+        node_type* leaf; /**< The leaf of the current key. NULL for the end iterator. */
+        int index; /**< Index of the current key in the leaf. */
+        friend class StringBTree;
+    };
+
+    /** Constructor for the StringBTree. The tree starts empty.
+    @param use_huge_pages   Whether the slabs from which nodes are allocated should be backed by huge pages. */
+    StringBTree(bool use_huge_pages = false) : allocator(use_huge_pages)
+    {
+        root = NULL;
+        first_leaf = NULL;
+        key_count = 0;
+    }
+
+    StringBTree(const StringBTree&) = delete;
+    StringBTree& operator=(const StringBTree&) = delete;
+
+/// Function to add a key with its value, if the key is not in the tree yet.
+/** @return Whether the key was added. A key already in the tree keeps its value. Throws a length_error for keys longer than max_key_length. */
+    bool insert(std::string_view key, const Value& value)
+    {
+        return add(key, value, false);
+    }
+
+/// Function to add a key with its value, or to replace the value of the key if it is in the tree already.
+/** @return Whether the key was added, rather than its value replaced. Throws a length_error for keys longer than max_key_length. */
+    bool upsert(std::string_view key, const Value& value)
+    {
+        return add(key, value, true);
+    }
+
+/// Function to copy the value of a key.
+/** @param key      The key.
+    @param result   Set to a copy of the value, if the key is in the tree.
+    @return Whether the key is in the tree. */
+    bool get(std::string_view key, Value& result) const
+    {
+        if (root == NULL)
+            return false;
+        node_type* leaf = descend(key, NULL);
+        bool found;
+        int position = leaf->search(key, false, found);
+        if (found)
+            memcpy(&result, leaf->payload(position), sizeof(Value));
+        return found;
+    }
+
+/// Function to check whether a key is in the tree.
+    bool contains(std::string_view key) const
+    {
+        Value ignored;
+        return get(key, ignored);
+    }
+
+/// Function to remove a key and its value.
+/** @return Whether the key was in the tree. */
+    bool erase(std::string_view key)
+    {
+        if (root == NULL)
+            return false;
+        node_path path;
+        node_type* leaf = descend(key, &path);
+        bool found;
+        int position = leaf->search(key, false, found);
+        if (!found)
+            return false;
+        leaf->remove(position);
+        if (--key_count == 0)
+        {
+            clear();
+            return true;
+        }
+        rebalance(path);
+        return true;
+    }
+
+/// Function to remove every key and give all nodes back to the system.
+    void clear()
+    {
+        allocator.release_all();
+        root = NULL;
+        first_leaf = NULL;
+        key_count = 0;
+    }
+
+/// Iterator to the first key not smaller than a probe, or the end iterator if there is none. A probe can be the prefix of the keys looked for, like a last name.
+    iterator lower_bound(std::string_view probe) const
+    {
+        if (root == NULL)
+            return end();
+        node_type* leaf = descend(probe, NULL);
+        bool found;
+        int position = leaf->search(probe, false, found);
+        if (position == leaf->NumberOfValidKeys)
+        {
+            leaf = next_with_keys((node_type*)leaf->next_leaf);
+            position = 0;
+        }
+        return iterator(leaf, position);
+    }
+
+    iterator begin() const { return iterator(next_with_keys(first_leaf), 0); } /**< Iterator to the smallest key. */
+    iterator end() const { return iterator(); } /**< Iterator past the largest key. */
+    size_t size() const { return key_count; } /**< Number of keys in the tree. */
+    int height() const { return root == NULL ? 0 : root->level + 1; } /**< Number of levels of the tree. */
+    const Node_allocator<NodeSize, geometry::alignment>& node_allocator() const { return allocator; } /**< The pool of the nodes, for their memory usage. */
+
+private:
+/// Function to create a node of the given level from a block of the allocator.
+    node_type* new_node(int level)
+    {
+        return new (allocator.allocate()) node_type(level, level == 0 ? sizeof(Value) : sizeof(node_type*));
+    }
+
+/// Function to give the block of a node back.
+    void free_node(node_type* node)
+    {
+        node->~node_type();
+        allocator.deallocate(node);
+    }
+
+/// The first leaf from the given one on which has keys. Only a leaf which could not be merged with its siblings is left without keys.
+    static node_type* next_with_keys(node_type* leaf)
+    {
+        while (leaf != NULL && leaf->NumberOfValidKeys == 0)
+            leaf = (node_type*)leaf->next_leaf;
+        return leaf;
+    }
+
+/// Function to add the key at index from of node source at the end of node destination, whose prefix can differ.
+    static void append_entry(node_type* destination, const node_type* source, int from)
+    {
+        unsigned char key[max_key_length];
+        size_t length = source->copy_key(from, key);
+        destination->insert(destination->NumberOfValidKeys, std::string_view((const char*)key, length), source->payload(from));
+    }
+
+/// Function doing the work of insert and upsert.
+    bool add(std::string_view key, const Value& value, bool replace)
+    {
+        if (key.size() > max_key_length)
+            throw std::length_error("The key is longer than the max_key_length of the StringBTree.");
+        if (root == NULL)
+        {
+            root = new_node(0);
+            first_leaf = root;
+        }
+        node_path path;
+        for (;;) // a split changes the path, so the descent starts over after each one.
+        {
+            node_type* leaf = descend(key, &path);
+            bool found;
+            int position = leaf->search(key, false, found);
+            if (found)
+            {
+                if (replace)
+                    memcpy(leaf->payload(position), &value, sizeof(Value));
+                return false;
+            }
+            if (leaf->has_space_for(key.size()))
+            {
+                leaf->insert(position, key, &value);
+                key_count++;
+                return true;
+            }
+            split(path, 0);
+        }
+    }
+
+/// Function to go down from the root to the leaf where a key belongs, taking in every inner node the child left of the first separator larger than the key.
+/** @param key      The key.
+    @param path     If not NULL, filled with the path from the root to the leaf.
+    @return The leaf reached. */
+    node_type* descend(std::string_view key, node_path* path) const
+    {
+        node_type* current = root;
+        while (current->level != 0)
+        {
+            bool found;
+            int position = current->search(key, true, found);
+            if (path != NULL)
+            {
+                path->nodes[current->level] = current;
+                path->slots[current->level] = position;
+            }
+            current = (node_type*)current->child(position);
+        }
+        if (path != NULL)
+            path->nodes[0] = current;
+        return current;
+    }
+
+/// Function to split the node at a level of a path in two halves of about the same number of bytes, and to add the separator between them to the parent.
+/** If the parent has no room for the separator, the parent is split instead and the node is left as it is: the caller goes down again and finds the node still full. */
+    void split(node_path& path, int level)
+    {
+        node_type* node = path.nodes[level];
+        if (level == root->level) // the root is split, so the tree grows a level.
+        {
+            assert(level + 1 < max_height);
+            root = new_node(level + 1);
+            root->upper = node;
+            path.nodes[level + 1] = root;
+            path.slots[level + 1] = 0;
+            BTREE_TRACE(1, "new root of level " << root->level);
+        }
+        node_type* parent = path.nodes[level + 1];
+        int position = path.slots[level + 1];
+        int count = node->NumberOfValidKeys;
+        unsigned char separator[max_key_length];
+        size_t separator_length = 0;
+        int break_point = split_point(node, separator, separator_length);
+        std::string_view separator_key((const char*)separator, separator_length);
+        if (!parent->has_space_for(separator_length))
+        {
+            split(path, level + 1);
+            return;
+        }
+        node_type* left = new_node(level);
+        node_type* right = new_node(level);
+        left->set_fences(node->lower_fence(), separator_key);
+        right->set_fences(separator_key, node->upper_fence());
+        if (level == 0)
+        {
+            for (int i = 0; i < break_point; i++)
+                append_entry(left, node, i);
+            for (int i = break_point; i < count; i++)
+                append_entry(right, node, i);
+            left->prev_leaf = node->prev_leaf;
+            left->next_leaf = right;
+            right->prev_leaf = left;
+            right->next_leaf = node->next_leaf;
+            if (node->prev_leaf != NULL)
+                node->prev_leaf->next_leaf = left;
+            else
+                first_leaf = left;
+            if (node->next_leaf != NULL)
+                ((node_type*)node->next_leaf)->prev_leaf = right;
+        }
+        else
+        {
+            for (int i = 0; i < break_point; i++)
+                append_entry(left, node, i);
+            left->upper = node->child(break_point);
+            for (int i = break_point + 1; i < count; i++)
+                append_entry(right, node, i);
+            right->upper = node->upper;
+        }
+        Node_base<std::string_view>* left_child = left;
+        parent->insert(position, separator_key, &left_child);
+        parent->set_child(position + 1, right);
+        BTREE_TRACE(1, "split a node of level " << level << " into " << left->NumberOfValidKeys << " and " << right->NumberOfValidKeys << " keys");
+        free_node(node);
+    }
+
+/// Function to choose where to split a node: the split whose larger half takes the fewest bytes, once each half has cut the prefix of its new fences off its keys.
+/** Balancing the bytes after compression rather than the keys matters at the edges of the tree: the rightmost leaf has no upper fence and keeps its keys whole, while the
+    left half which a split takes from it gets a long prefix, so an even split would leave that half mostly empty.
+    @param node         The node, which has at least two keys if it is a leaf, and one otherwise.
+    @param separator    Set to the separator between the halves: for a leaf, the shortest prefix of the first right key which is larger than the last left key, and for an
+                        inner node the key at the break point, which goes up and is kept by neither half.
+    @param length       Set to the length of the separator.
+    @return The break point: the first key of the right half of a leaf, or the index of the separator of an inner node. */
+    static int split_point(const node_type* node, unsigned char* separator, size_t& length)
+    {
+        int count = node->NumberOfValidKeys;
+        bool leaf = node->level == 0;
+        std::string_view lower = node->lower_fence(), upper = node->upper_fence();
+        size_t entry = sizeof(slot_type) + node->prefix_length + node->payload_length; // bytes of an entry in either half, past the tail bytes and before the new prefix is cut.
+        std::vector<size_t> tails(count + 1, 0); // tails[i] is the number of tail bytes of the keys before index i.
+        for (int i = 0; i < count; i++)
+            tails[i + 1] = tails[i] + node->slots()[i].length;
+        int best = -1;
+        size_t best_cost = SIZE_MAX;
+        unsigned char candidate[max_key_length];
+        for (int at = leaf ? 1 : 0; at < count; at++)
+        {
+            size_t candidate_length = node->copy_key(at, candidate);
+            if (leaf)
+            {
+                size_t shared = 0;
+                const unsigned char* before = node->tail(at - 1);
+                const unsigned char* after = node->tail(at);
+                while (shared < node->slots()[at - 1].length && shared < node->slots()[at].length && before[shared] == after[shared])
+                    shared++;
+                candidate_length = node->prefix_length + shared + 1;
+            }
+            std::string_view split_key((const char*)candidate, candidate_length);
+            size_t left_prefix = 0, right_prefix = 0;
+            while (left_prefix < lower.size() && left_prefix < candidate_length && lower[left_prefix] == split_key[left_prefix])
+                left_prefix++;
+            if (!upper.empty())
+                while (right_prefix < upper.size() && right_prefix < candidate_length && upper[right_prefix] == split_key[right_prefix])
+                    right_prefix++;
+            int right_from = leaf ? at : at + 1;
+            size_t left_cost = lower.size() + candidate_length + tails[at] + at * entry - at * left_prefix;
+            size_t right_cost = candidate_length + upper.size() + tails[count] - tails[right_from] + (count - right_from) * entry - (count - right_from) * right_prefix;
+            size_t cost = std::max(left_cost, right_cost);
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best = at;
+                memcpy(separator, candidate, candidate_length);
+                length = candidate_length;
+            }
+        }
+        assert(best >= 0 && best_cost <= node_type::body_size);
+        return best;
+    }
+
+/// Function to merge the nodes along a path which an erase left below MIN_FILL_FACTOR of their bytes with a sibling, going up as long as the parents lose too many bytes in turn.
+    void rebalance(node_path& path)
+    {
+        const size_t underfull = (size_t)(node_type::body_size * (1 - MIN_FILL_FACTOR)); // free bytes beyond which a node is merged.
+        for (int level = 0; level < root->level; level++)
+        {
+            node_type* parent = path.nodes[level + 1];
+            if (path.nodes[level]->space_after_compaction() < underfull || parent->NumberOfValidKeys == 0)
+                break;
+            int position = path.slots[level + 1];
+            if (!merge(parent, position == parent->NumberOfValidKeys ? position - 1 : position)) // the last child is merged with its left sibling, any other with its right one.
+                break;
+        }
+        while (root->level != 0 && root->NumberOfValidKeys == 0) // a root with a single child is replaced by it.
+        {
+            node_type* child = (node_type*)root->upper;
+            free_node(root);
+            root = child;
+        }
+    }
+
+/// Function to merge two neighbour children of an inner node into one node, if their keys (and, for inner nodes, the separator between them) fit in one node.
+/** @param parent   The inner node.
+    @param index    The index of the left child, and of the separator between the two.
+    @return Whether the children were merged. */
+    bool merge(node_type* parent, int index)
+    {
+        node_type* left = (node_type*)parent->child(index);
+        node_type* right = (node_type*)parent->child(index + 1);
+        std::string_view lower = left->lower_fence(), upper = right->upper_fence();
+        size_t prefix = 0; // the prefix of the merged node, as set_fences will find it.
+        if (!upper.empty())
+            while (prefix < lower.size() && prefix < upper.size() && lower[prefix] == upper[prefix])
+                prefix++;
+        size_t needed = lower.size() + upper.size();
+        for (int i = 0; i < left->NumberOfValidKeys; i++)
+            needed += sizeof(slot_type) + left->key_length(i) - prefix + left->payload_length;
+        for (int i = 0; i < right->NumberOfValidKeys; i++)
+            needed += sizeof(slot_type) + right->key_length(i) - prefix + right->payload_length;
+        if (left->level != 0)
+            needed += sizeof(slot_type) + parent->key_length(index) - prefix + left->payload_length;
+        if (needed > node_type::body_size)
+            return false;
+        node_type* merged = new_node(left->level);
+        merged->set_fences(lower, upper);
+        for (int i = 0; i < left->NumberOfValidKeys; i++)
+            append_entry(merged, left, i);
+        if (left->level != 0)
+        {
+            unsigned char separator[max_key_length]; // the separator between the two comes down, with the last child of the left node.
+            size_t length = parent->copy_key(index, separator);
+            merged->insert(merged->NumberOfValidKeys, std::string_view((const char*)separator, length), &left->upper);
+        }
+        for (int i = 0; i < right->NumberOfValidKeys; i++)
+            append_entry(merged, right, i);
+        if (left->level != 0)
+            merged->upper = right->upper;
+        else
+        {
+            merged->prev_leaf = left->prev_leaf;
+            merged->next_leaf = right->next_leaf;
+            if (left->prev_leaf != NULL)
+                left->prev_leaf->next_leaf = merged;
+            else
+                first_leaf = merged;
+            if (right->next_leaf != NULL)
+                ((node_type*)right->next_leaf)->prev_leaf = merged;
+        }
+        parent->remove(index);
+        parent->set_child(index, merged);
+        BTREE_TRACE(1, "merged two nodes of level " << merged->level << " into one of " << merged->NumberOfValidKeys << " keys");
+        free_node(left);
+        free_node(right);
+        return true;
+    }
+};
+
+
+/// Function to write an unsigned integer as a varint: 7 bits per byte, low bits first, with the top bit set in every byte but the last.
+/** @return The number of bytes written, from 1 to 10. */
+inline size_t put_varint(unsigned char* out, uint64_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80)
+    {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+/// Function to read a varint written by put_varint.
+/** @return The number of bytes read. */
+inline size_t get_varint(const unsigned char* in, uint64_t& value)
+{
+    size_t length = 0;
+    int shift = 0;
+    value = 0;
+    while (in[length] & 0x80)
+    {
+        value |= (uint64_t)(in[length++] & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= (uint64_t)in[length++] << shift;
+    return length;
+}
+
+/// Number of bytes which put_varint writes for a value.
+inline size_t varint_size(uint64_t value)
+{
+    size_t length = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+/// Function to write a run of rows in increasing order: the first one as a varint, and every other one as the varint of its difference to the one before.
+/** @return The number of bytes written. */
+inline size_t encode_rows(const uint64_t* rows, size_t count, unsigned char* out)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++)
+        length += put_varint(out + length, i == 0 ? rows[0] : rows[i] - rows[i - 1]);
+    return length;
+}
+
+/// Function to append the rows of a run written by encode_rows to a vector.
+inline void decode_rows(const unsigned char* bytes, size_t length, std::vector<uint64_t>& rows)
+{
+    uint64_t row = 0;
+    for (size_t at = 0; at < length;)
+    {
+        uint64_t delta;
+        at += get_varint(bytes + at, delta);
+        row += delta;
+        rows.push_back(row);
+    }
+}
+
+/// Number of bytes which encode_rows writes for a run of rows.
+inline size_t encoded_size(const uint64_t* rows, size_t count)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++)
+        length += varint_size(i == 0 ? rows[0] : rows[i] - rows[i - 1]);
+    return length;
+}
+
+
+/// An overflow page of a posting list, holding a run of its rows coded by encode_rows.
+template <size_t PageSize> struct Posting_page
+{
+    Posting_page* next; /**< The page holding the next rows of the list. NULL for the last page. */
+    uint64_t first_row; /**< The smallest row of the page. */
+    uint64_t last_row; /**< The largest row of the page, so that lookups skip pages without decoding them. */
+    uint32_t count; /**< Number of rows of the page. */
+    uint32_t length; /**< Number of bytes of rows in use. */
+    unsigned char rows[PageSize - 32]; /**< The rows. */
+};
+
+
+/// The rows of one key of a PostingBTree, in increasing order: coded by encode_rows in the list itself while they fit, and in a chain of overflow pages once they do not.
+template <size_t PageSize> struct Posting_list
+{
+    typedef Posting_page<PageSize> page_type;
+
+    uint64_t count; /**< Number of rows of the key. */
+    uint64_t last_row; /**< The largest row of the key, which a row being added is compared with first. */
+    page_type* first_page; /**< The first overflow page, or NULL while the rows are inline. */
+    page_type* last_page; /**< The last overflow page, to which larger rows are appended. */
+    uint16_t length; /**< Number of bytes of inline_rows in use. */
+    unsigned char inline_rows[POSTING_INLINE_BYTES]; /**< The rows, as long as they fit. */
+};
+
+
+/// A non-unique index from keys to row ids, which keeps every key once with a compressed posting list of its rows.
+/** A secondary index on a column of few distinct values (w_id, d_id) holds each key for many rows. Instead of repeating the key for every row, the index is a BTreeMap from each
+    key to a Posting_list: the row ids in increasing order, delta coded as varints, so a dense run of rows takes about a byte per row. A list of up to POSTING_INLINE_BYTES of
+    rows lives in the value of its key; a longer one spills to a chain of overflow pages of PageSize bytes, each of which knows its smallest and largest row. The pages are
+    smaller than a node by default, so that a list just too long to be inline does not take a whole 4 KiB page, while a scan still decodes hundreds of rows per page. Rows added in
+    increasing order, as row ids are handed out, are appended to the last page without decoding anything. Others go to the first page whose last row is not smaller,
+    found by walking the chain without decoding, which is decoded, changed and coded again, and split in two when it overflows.
+    count is a lookup of the key (O(log n)), and find_all a lookup followed by a decode of the rows (O(log n + matches)). Both also take prefix probes, summing up or decoding
+    every key of the range. The index is meant to be used from one thread at a time.
+*/
+template <class KeyType, size_t NodeSize = BLOCK_SIZE, class Traits = key_traits<KeyType>, size_t PageSize = 1024> class PostingBTree
+{
+public:
+    typedef Posting_list<PageSize> list_type;
+    typedef Posting_page<PageSize> page_type;
+    typedef BTreeMap<KeyType, list_type, NodeSize, Traits> map_type; /**< The map from the keys to their posting lists. */
+    static const size_t page_capacity = sizeof(((page_type*)NULL)->rows); /**< Bytes of rows held by an overflow page. */
+
+private:
+    map_type lists; /**< The posting list of every key with rows. */
+    Node_allocator<sizeof(page_type), CACHE_LINE_SIZE> pages; /**< The pool of the overflow pages. */
+    size_t row_count; /**< Number of (key, row) pairs in the index. */
+
+    static_assert(PageSize % CACHE_LINE_SIZE == 0 && PageSize >= 128, "Overflow pages are a multiple of the cache line size, and hold at least 96 bytes of rows.");
+
+public:
+    /** Constructor for the PostingBTree. The index starts empty. */
+    PostingBTree()
+    {
+        row_count = 0;
+    }
+
+    /** Destructor for the PostingBTree, which gives back its nodes and pages. */
+    ~PostingBTree()
+    {
+        clear();
+    }
+
+    PostingBTree(const PostingBTree&) = delete;
+    PostingBTree& operator=(const PostingBTree&) = delete;
+
+/// Function to add a row to the rows of a key.
+/** @return Whether the row was added, which it is not if the key has it already. */
+    bool insert(const KeyType& key, uint64_t row)
+    {
+        list_type* list = lists.find_or_insert(key, list_type());
+        if (list->count == 0)
+        {
+            list->length = (uint16_t)put_varint(list->inline_rows, row);
+            list->last_row = row;
+        }
+        else if (row > list->last_row)
+            append(list, row);
+        else if (!insert_within(list, row))
+            return false;
+        list->count++;
+        row_count++;
+        return true;
+    }
+
+/// Function to remove a row from the rows of a key. A key left without rows is removed from the index.
+/** @return Whether the key had the row. */
+    bool erase(const KeyType& key, uint64_t row)
+    {
+        list_type* list = lists.find(key);
+        if (list == NULL || row > list->last_row)
+            return false;
+        std::vector<uint64_t> rows;
+        if (list->first_page == NULL)
+        {
+            decode_rows(list->inline_rows, list->length, rows);
+            std::vector<uint64_t>::iterator found = lower_bound(rows.begin(), rows.end(), row);
+            if (found == rows.end() || *found != row)
+                return false;
+            rows.erase(found);
+            list->length = (uint16_t)encode_rows(rows.data(), rows.size(), list->inline_rows); // a row less never takes more bytes.
+            if (!rows.empty())
+                list->last_row = rows.back();
+        }
+        else
+        {
+            page_type* before = NULL;
+            page_type* page = page_of(list, row, before);
+            if (row < page->first_row)
+                return false;
+            decode_rows(page->rows, page->length, rows);
+            std::vector<uint64_t>::iterator found = lower_bound(rows.begin(), rows.end(), row);
+            if (found == rows.end() || *found != row)
+                return false;
+            rows.erase(found);
+            if (rows.empty())
+                unlink_page(list, page, before);
+            else
+                write_page(page, rows.data(), rows.size());
+            if (list->last_page != NULL)
+                list->last_row = list->last_page->last_row;
+            if (list->first_page != NULL && list->first_page == list->last_page && list->first_page->length <= POSTING_INLINE_BYTES) // the rows fit in the list again.
+            {
+                page_type* only = list->first_page;
+                memcpy(list->inline_rows, only->rows, only->length);
+                list->length = (uint16_t)only->length;
+                list->first_page = NULL;
+                list->last_page = NULL;
+                pages.deallocate(only);
+            }
+        }
+        list->count--;
+        row_count--;
+        if (list->count == 0)
+            lists.erase(key);
+        return true;
+    }
+
+/// Function to check whether a key has a row.
+    bool contains(const KeyType& key, uint64_t row) const
+    {
+        const list_type* list = lists.find(key);
+        if (list == NULL || row > list->last_row)
+            return false;
+        std::vector<uint64_t> rows;
+        if (list->first_page == NULL)
+            decode_rows(list->inline_rows, list->length, rows);
+        else
+        {
+            page_type* before;
+            page_type* page = page_of(list, row, before);
+            if (row < page->first_row)
+                return false;
+            decode_rows(page->rows, page->length, rows);
+        }
+        return std::binary_search(rows.begin(), rows.end(), row);
+    }
+
+/// Function to count the rows of the keys matching a probe, without decoding any posting list.
+/** @param probe    A key, or a prefix probe such as a warehouse_prefix of a key_traits<district_prefix> index.
+    @return The number of rows of all keys matching the probe. */
+    template <class Probe> size_t count(const Probe& probe) const
+    {
+        size_t rows = 0;
+        std::pair<typename map_type::iterator, typename map_type::iterator> range = lists.equal_range(probe);
+        for (typename map_type::iterator it = range.first; it != range.second; ++it)
+            rows += it.value().count;
+        return rows;
+    }
+
+/// Function to append the rows of the keys matching a probe to a vector, in key order and in increasing order for every key.
+/** @param probe    A key, or a prefix probe.
+    @param rows     The vector to which the rows are appended.
+    @return The number of rows appended. */
+    template <class Probe> size_t find_all(const Probe& probe, std::vector<uint64_t>& rows) const
+    {
+        size_t before = rows.size();
+        std::pair<typename map_type::iterator, typename map_type::iterator> range = lists.equal_range(probe);
+        for (typename map_type::iterator it = range.first; it != range.second; ++it)
+        {
+            const list_type& list = it.value();
+            rows.reserve(rows.size() + list.count);
+            if (list.first_page == NULL)
+                decode_rows(list.inline_rows, list.length, rows);
+            for (const page_type* page = list.first_page; page != NULL; page = page->next)
+                decode_rows(page->rows, page->length, rows);
+        }
+        return rows.size() - before;
+    }
+
+/// Function to remove every key and row.
+    void clear()
+    {
+        lists.clear();
+        pages.release_all();
+        row_count = 0;
+    }
+
+    size_t size() const { return row_count; } /**< Number of (key, row) pairs in the index. */
+    size_t keys() const { return lists.size(); } /**< Number of distinct keys in the index. */
+    const map_type& map() const { return lists; } /**< The map from keys to posting lists, to iterate over the keys or for its memory usage. */
+    const Node_allocator<sizeof(page_type), CACHE_LINE_SIZE>& overflow_pages() const { return pages; } /**< The pool of the overflow pages, for their memory usage. */
+
+private:
+/// Function to add a row larger than every row of a list at its end, spilling the list to an overflow page when it does not fit inline anymore.
+    void append(list_type* list, uint64_t row)
+    {
+        uint64_t delta = row - list->last_row;
+        size_t length = varint_size(delta);
+        list->last_row = row;
+        if (list->first_page == NULL)
+        {
+            if (list->length + length <= POSTING_INLINE_BYTES)
+            {
+                list->length += (uint16_t)put_varint(list->inline_rows + list->length, delta);
+                return;
+            }
+            spill(list);
+        }
+        page_type* page = list->last_page;
+        if (page->length + length <= page_capacity)
+        {
+            page->length += (uint32_t)put_varint(page->rows + page->length, delta);
+            page->last_row = row;
+            page->count++;
+            return;
+        }
+        page_type* fresh = new_page(); // the page is full: the row starts a new one.
+        write_page(fresh, &row, 1);
+        page->next = fresh;
+        list->last_page = fresh;
+    }
+
+/// Function to add a row which is not larger than every row of a list: in the inline rows, or in the first page whose last row is not smaller.
+/** @return Whether the row was added, which it is not if the list has it already. */
+    bool insert_within(list_type* list, uint64_t row)
+    {
+        std::vector<uint64_t> rows;
+        if (list->first_page == NULL)
+        {
+            decode_rows(list->inline_rows, list->length, rows);
+            std::vector<uint64_t>::iterator at = lower_bound(rows.begin(), rows.end(), row);
+            if (at != rows.end() && *at == row)
+                return false;
+            rows.insert(at, row);
+            if (encoded_size(rows.data(), rows.size()) <= POSTING_INLINE_BYTES)
+            {
+                list->length = (uint16_t)encode_rows(rows.data(), rows.size(), list->inline_rows);
+                return true;
+            }
+            page_type* page = new_page();
+            write_page(page, rows.data(), rows.size());
+            list->first_page = page;
+            list->last_page = page;
+            list->length = 0;
+            return true;
+        }
+        page_type* before;
+        page_type* page = page_of(list, row, before);
+        decode_rows(page->rows, page->length, rows);
+        std::vector<uint64_t>::iterator at = lower_bound(rows.begin(), rows.end(), row);
+        if (at != rows.end() && *at == row)
+            return false;
+        rows.insert(at, row);
+        if (encoded_size(rows.data(), rows.size()) <= page_capacity)
+        {
+            write_page(page, rows.data(), rows.size());
+            return true;
+        }
+        size_t half = rows.size() / 2; // the page overflows, so it is split in two halves.
+        page_type* right = new_page();
+        write_page(right, rows.data() + half, rows.size() - half);
+        write_page(page, rows.data(), half);
+        right->next = page->next;
+        page->next = right;
+        if (list->last_page == page)
+            list->last_page = right;
+        return true;
+    }
+
+/// Function to move the inline rows of a list to its first overflow page.
+    void spill(list_type* list)
+    {
+        std::vector<uint64_t> rows;
+        decode_rows(list->inline_rows, list->length, rows);
+        page_type* page = new_page();
+        write_page(page, rows.data(), rows.size());
+        list->first_page = page;
+        list->last_page = page;
+        list->length = 0;
+    }
+
+/// Function to find the first overflow page of a list whose last row is not smaller than a row. The row has to be at most the last row of the list.
+/** @param before   Set to the page before the one found, or NULL for the first page.
+    @return The page. */
+    static page_type* page_of(const list_type* list, uint64_t row, page_type*& before)
+    {
+        before = NULL;
+        page_type* page = list->first_page;
+        while (page->last_row < row)
+        {
+            before = page;
+            page = page->next;
+        }
+        return page;
+    }
+
+/// Function to take an overflow page left without rows out of its list and give it back.
+    void unlink_page(list_type* list, page_type* page, page_type* before)
+    {
+        if (before != NULL)
+            before->next = page->next;
+        else
+            list->first_page = page->next;
+        if (list->last_page == page)
+            list->last_page = before;
+        pages.deallocate(page);
+    }
+
+/// Function to create an overflow page without rows.
+    page_type* new_page()
+    {
+        page_type* page = (page_type*)pages.allocate();
+        page->next = NULL;
+        page->count = 0;
+        page->length = 0;
+        return page;
+    }
+
+/// Function to replace the rows of an overflow page with a run of rows, which has to fit.
+    static void write_page(page_type* page, const uint64_t* rows, size_t count)
+    {
+        page->length = (uint32_t)encode_rows(rows, count, page->rows);
+        page->count = (uint32_t)count;
+        page->first_row = rows[0];
+        page->last_row = rows[count - 1];
+    }
+};
+
+
+/// Partition function of a PartitionedBTree which sends warehouse w_id to shard w_id % shards, so that all the keys of a warehouse are in one shard.
+/** It takes any key or probe with a w_id, so that the lookups of a warehouse_prefix or a district_prefix go to one shard as well. */
+struct warehouse_partition
+{
+    template <class Probe> auto operator()(const Probe& probe, size_t shards) const -> decltype((size_t)probe.w_id)
+    {
+        return (size_t)(uint32_t)probe.w_id % shards;
+    }
+};
+
+/// Partition function of a PartitionedBTree which spreads the keys evenly over the shards by a hash of their normalized form.
+/** Only whole keys can be routed, so the lookup of a prefix goes to every shard. */
+template <class KeyType, class Traits = key_traits<KeyType> > struct hash_partition
+{
+    static_assert(Traits::normalized, "The keys are hashed through their normalized form.");
+
+    size_t operator()(const KeyType& key, size_t shards) const
+    {
+        return (size_t)((normalized_hash<Traits>(key) >> 32) % shards);
+    }
+};
+
+/// Partition function of a PartitionedBTree which gives every shard a range of the keys: shard i holds the keys from boundary i - 1 up to boundary i, excluded.
+/** Only whole keys can be routed, so the lookup of a prefix goes to every shard. Keys above the last boundary which has a shard go to the last shard. */
+template <class KeyType, class Traits = key_traits<KeyType> > struct range_partition
+{
+    std::vector<KeyType> boundaries; /**< The smallest key of every shard but the first, in increasing order. */
+
+    explicit range_partition(std::vector<KeyType> bounds = std::vector<KeyType>()) : boundaries(std::move(bounds)) {}
+
+    size_t operator()(const KeyType& key, size_t shards) const
+    {
+        size_t shard = upper_bound(boundaries.begin(), boundaries.end(), key, [](const KeyType& a, const KeyType& b)
+        {
+            return BTree<KeyType, BLOCK_SIZE, Traits>::compare_keys(a, b) < 0;
+        }) - boundaries.begin();
+        return std::min(shard, shards - 1);
+    }
+};
+
+
+/// An index split into shards, each a BTree of its own, which a partition function sends every key to.
+/** A TPC-C transaction works on one warehouse, so with warehouse_partition (the default) all the keys it touches are in one shard, and inserts into different shards share no
+    node and no latch. Single key operations go straight to the shard of their key. Batches are split by shard, and every shard works through its part on its owner: the pool
+    of the tree always hands shard i to the same thread, and the threads never take each other's shards, so the upper levels of a shard stay in the cache of its thread.
+    Lookups of probes which the partition function can route (with warehouse_partition, any probe with a w_id) go to one shard; the others are scattered to every shard and
+    the answers gathered. Iterators merge the shards in key order through a heap of one cursor per shard, at O(log shards) per key. Apart from the work it hands to the owners,
+    the tree is used from one thread at a time, like a BTree.
+*/
+template <class KeyType, size_t NodeSize = BLOCK_SIZE, class Traits = key_traits<KeyType>, class Partition = warehouse_partition> class PartitionedBTree
+{
+public:
+    typedef BTree<KeyType, NodeSize, Traits> tree_type; /**< The tree of a shard. */
+
+private:
+    std::vector<std::unique_ptr<tree_type> > shards; /**< The tree of every shard. */
+    Partition partition; /**< Called as partition(key, shard count) to find the shard of a key. */
+    mutable Scan_pool owners; /**< The threads owning the shards. The thread calling the tree is thread 0. */
+
+/// Whether the partition function can find the one shard holding every key which matches a probe.
+    template <class Probe> static constexpr bool routable = std::is_invocable_r<size_t, const Partition&, const Probe&, size_t>::value;
+
+public:
+    /** Constructor for the PartitionedBTree. All shards start empty.
+    @param shard_count  Number of shards. 0 for the number of hardware threads.
+    @param by           The partition function.
+    @param threads      Number of threads owning shards, the calling thread included. 0 for a thread per shard, up to the number of hardware threads. */
+    explicit PartitionedBTree(int shard_count = 0, const Partition& by = Partition(), int threads = 0) : partition(by), owners(owner_threads(shard_count, threads))
+    {
+        for (int s = 0; s < default_shards(shard_count); s++)
+            shards.push_back(std::unique_ptr<tree_type>(new tree_type()));
+    }
+
+    PartitionedBTree(const PartitionedBTree&) = delete;
+    PartitionedBTree& operator=(const PartitionedBTree&) = delete;
+
+    /// An iterator over the keys of all shards in key order, which merges a cursor in every shard.
+    /** The cursors are kept in a heap ordered by their keys, with the smallest first. A cursor goes away when it reaches the end of its range, and the end iterator has none.
+        Like the iterators of a BTree, it is invalidated by any change to the tree. */
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef KeyType value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef KeyType* pointer;
+        typedef KeyType& reference;
+
+        KeyType& operator*() const { return *cursors.front().first; }
+        KeyType* operator->() const { return &*cursors.front().first; }
+
+        iterator& operator++()
+        {
+            pop_heap(cursors.begin(), cursors.end(), later);
+            if (++cursors.back().first == cursors.back().second)
+                cursors.pop_back();
+            else
+                push_heap(cursors.begin(), cursors.end(), later);
+            return *this;
+        }
+
+        iterator operator++(int) { iterator old = *this; ++(*this); return old; }
+        bool operator==(const iterator& other) const { return cursors.size() == other.cursors.size() && (cursors.empty() || cursors.front().first == other.cursors.front().first); }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        typedef std::pair<typename tree_type::iterator, typename tree_type::iterator> cursor; /**< A position in a shard and the end of the range in that shard. */
+        std::vector<cursor> cursors; /**< The cursors of the shards with keys left in their range. */
+
+        /// Order of the heap, which is a max heap for the standard algorithms: a cursor comes later than another if its key is larger.
+        static bool later(const cursor& a, const cursor& b)
+        {
+            return tree_type::compare_keys(*a.first, *b.first) > 0;
+        }
+
+        /// Function to add the range of a shard, unless it is empty.
+        void add(typename tree_type::iterator from, typename tree_type::iterator to)
+        {
+            if (from == to)
+                return;
+            cursors.push_back(cursor(from, to));
+            push_heap(cursors.begin(), cursors.end(), later);
+        }
+
+        friend class PartitionedBTree;
+    };
+
+    size_t shard_count() const { return shards.size(); } /**< Number of shards. */
+    tree_type& shard(size_t index) { return *shards[index]; } /**< The tree of a shard. */
+    const tree_type& shard(size_t index) const { return *shards[index]; } /**< The tree of a shard. */
+
+/// Function to find the shard of a key, or of a probe which the partition function can route.
+    template <class Probe> size_t shard_of(const Probe& probe) const
+    {
+        return partition(probe, shards.size());
+    }
+
+/// Function to add a key to its shard. See BTree::add_key.
+    void add_key(KeyType* toInsert)
+    {
+        shards[shard_of(*toInsert)]->add_key(toInsert);
+    }
+
+/// Function to delete a key from its shard. See BTree::delete_key.
+/** @return Whether the key was found. */
+    bool delete_key(KeyType* toDelete)
+    {
+        return shards[shard_of(*toDelete)]->delete_key(toDelete);
+    }
+
+/// Function to search for a key in its shard. See BTree::search_key.
+/** @return Pointer to the key, or NULL if it is not in the tree. */
+    KeyType* search_key(KeyType* target)
+    {
+        return shards[shard_of(*target)]->search_key(target);
+    }
+
+/// Function to add a batch of keys. The batch is split by shard, and the owner of every shard adds its part with BTree::insert_batch, all shards at the same time.
+/** @param keys The keys to add, which the tree takes over. */
+    void insert_batch(std::vector<KeyType>&& keys)
+    {
+        add_batch(keys, false);
+    }
+
+/// Function to add or replace a batch of keys, like insert_batch does with BTree::upsert_batch.
+/** @param keys The keys to add or replace, which the tree takes over. */
+    void upsert_batch(std::vector<KeyType>&& keys)
+    {
+        add_batch(keys, true);
+    }
+
+/// Function to run an operation on every shard, each on the thread which owns it, and wait until all are done.
+/** @param operation    Called as operation(tree, index) with the tree of a shard and the index of the shard. */
+    template <class Operation> void for_each_shard(Operation operation)
+    {
+        on_owners([&](size_t index) { operation(*shards[index], index); });
+    }
+
+/// Function to look up many probes at once. The probes are scattered to the shards which can hold their keys, which look up their own probes with BTree::multi_get at the same time.
+/** A probe which the partition function cannot route goes to every shard, and gets the smallest of their answers.
+    @param probes   The keys (or any probes which the key traits can compare keys with) to look up.
+    @return For every probe, a pointer to a key matching it, or NULL if there is none. */
+    template <class Probe> std::vector<KeyType*> multi_get(const std::vector<Probe>& probes) const
+    {
+        std::vector<KeyType*> results(probes.size(), NULL);
+        if constexpr (routable<Probe>)
+        {
+            std::vector<std::vector<size_t> > asked(shards.size()); // the indices of the probes sent to every shard.
+            for (size_t i = 0; i < probes.size(); i++)
+                asked[shard_of(probes[i])].push_back(i);
+            on_owners([&](size_t index)
+            {
+                if (asked[index].empty())
+                    return;
+                std::vector<Probe> mine;
+                mine.reserve(asked[index].size());
+                for (size_t i = 0; i < asked[index].size(); i++)
+                    mine.push_back(probes[asked[index][i]]);
+                std::vector<KeyType*> found = shards[index]->multi_get(mine);
+                for (size_t i = 0; i < found.size(); i++)
+                    results[asked[index][i]] = found[i];
+            });
+        }
+        else
+        {
+            std::vector<std::vector<KeyType*> > found(shards.size());
+            on_owners([&](size_t index) { found[index] = shards[index]->multi_get(probes); });
+            for (size_t s = 0; s < shards.size(); s++)
+                for (size_t i = 0; i < probes.size(); i++)
+                    if (found[s][i] != NULL && (results[i] == NULL || tree_type::compare_keys(*found[s][i], *results[i]) < 0))
+                        results[i] = found[s][i];
+        }
+        return results;
+    }
+
+/// Function to find the keys matching a predicate. Every owner filters its shard, and the matches are gathered in key order.
+/** @param predicate    Called as predicate(key) on every key, on the thread owning its shard.
+    @param limit        Number of matches after which the scan stops. Only the smallest matches are returned.
+    @return The keys matching the predicate, in key order. */
+    template <class Predicate> std::vector<KeyType> parallel_scan(Predicate predicate, size_t limit = SIZE_MAX) const
+    {
+        std::vector<std::vector<KeyType> > found(shards.size());
+        on_owners([&](size_t index)
+        {
+            const tree_type& tree = *shards[index];
+            for (typename tree_type::iterator it = tree.begin(); it != tree.end() && found[index].size() < limit; ++it) // the first limit matches overall are among the first limit of every shard.
+                if (predicate(*it))
+                    found[index].push_back(*it);
+        });
+        std::vector<KeyType> result;
+        for (size_t s = 0; s < shards.size(); s++)
+            result.insert(result.end(), found[s].begin(), found[s].end());
+        std::sort(result.begin(), result.end(), [](const KeyType& a, const KeyType& b) { return tree_type::compare_keys(a, b) < 0; });
+        if (result.size() > limit)
+            result.resize(limit);
+        return result;
+    }
+
+/// Function to find the first key which is not smaller than a probe, over all shards.
+    template <class Probe> iterator lower_bound(const Probe& probe) const
+    {
+        iterator merged;
+        for (size_t s = 0; s < shards.size(); s++)
+            merged.add(shards[s]->lower_bound(probe), shards[s]->end());
+        return merged;
+    }
+
+/// Function to find the first key which is larger than a probe, over all shards.
+    template <class Probe> iterator upper_bound(const Probe& probe) const
+    {
+        iterator merged;
+        for (size_t s = 0; s < shards.size(); s++)
+            merged.add(shards[s]->upper_bound(probe), shards[s]->end());
+        return merged;
+    }
+
+/// Function to find the range of the keys matching a probe. A probe which the partition function can route is looked up in its shard only.
+/** @return The iterators to the first matching key and past the last one. The second is end(). */
+    template <class Probe> std::pair<iterator, iterator> equal_range(const Probe& probe) const
+    {
+        iterator merged;
+        if constexpr (routable<Probe>)
+        {
+            std::pair<typename tree_type::iterator, typename tree_type::iterator> range = shards[shard_of(probe)]->equal_range(probe);
+            merged.add(range.first, range.second);
+        }
+        else
+            for (size_t s = 0; s < shards.size(); s++)
+                merged.add(shards[s]->lower_bound(probe), shards[s]->upper_bound(probe));
+        return std::make_pair(merged, iterator());
+    }
+
+/// Iterator to the smallest key of all shards.
+    iterator begin() const
+    {
+        iterator merged;
+        for (size_t s = 0; s < shards.size(); s++)
+            merged.add(shards[s]->begin(), shards[s]->end());
+        return merged;
+    }
+
+    iterator end() const { return iterator(); } /**< Iterator past the largest key. */
+
+/// Number of keys in all shards.
+    size_t size() const
+    {
+        size_t keys = 0;
+        for (size_t s = 0; s < shards.size(); s++)
+            keys += shards[s]->size();
+        return keys;
+    }
+
+/// Function to remove all keys from every shard.
+    void clear()
+    {
+        for (size_t s = 0; s < shards.size(); s++)
+            shards[s]->clear();
+    }
+
+private:
+    static int default_shards(int shard_count) { return shard_count > 0 ? shard_count : std::max(1, (int)std::thread::hardware_concurrency()); } /**< Number of shards to create. */
+    static int owner_threads(int shard_count, int threads) { return threads > 0 ? threads : std::min(default_shards(shard_count), std::max(1, (int)std::thread::hardware_concurrency())); } /**< Number of owners to start. */
+
+/// Function to run task(index) for every shard on the thread owning it. Runs of the pool without stealing give every shard to the same thread each time.
+    template <class Task> void on_owners(Task task) const
+    {
+        owners.run(shards.size(), [&task](size_t index, int) { task(index); }, false);
+    }
+
+/// Function to split a batch by shard and add every part to its shard on the owner of the shard.
+    void add_batch(std::vector<KeyType>& keys, bool upsert)
+    {
+        std::vector<std::vector<KeyType> > parts(shards.size());
+        for (size_t i = 0; i < keys.size(); i++)
+            parts[shard_of(keys[i])].push_back(keys[i]);
+        std::vector<KeyType>().swap(keys);
+        for_each_shard([&](tree_type& tree, size_t index)
+        {
+            if (parts[index].empty())
+                return;
+            if (upsert)
+                tree.upsert_batch(std::move(parts[index]));
+            else
+                tree.insert_batch(std::move(parts[index]));
+        });
+    }
+};
+
+
+/// The index of the calling thread among the threads which use concurrent trees, between 0 and MAX_THREADS - 1.
+/** A thread claims the first free index the first time it asks for one, and gives it back when it exits, so that the indices are reused by threads which come and go. */
+class Thread_slot
+{
+private:
+    int index;
+
+    static std::atomic<bool>* taken()
+    {
+        static std::atomic<bool> slots[MAX_THREADS];
+        return slots;
+    }
+
+public:
+    Thread_slot()
+    {
+        for (index = 0; index < MAX_THREADS; index++)
+        {
+            bool expected = false;
+            if (taken()[index].compare_exchange_strong(expected, true))
+                return;
+        }
+        throw std::runtime_error("More than MAX_THREADS threads are using concurrent trees at the same time.");
+    }
+
+    ~Thread_slot()
+    {
+        taken()[index].store(false);
+    }
+
+    /// Function to get the index of the calling thread.
+    static int current()
+    {
+        thread_local Thread_slot slot;
+        return slot.index;
+    }
+};
+
+
+/// Epoch based reclamation of the nodes which a concurrent tree unlinks while other threads may still be reading them.
+/** A thread enters the current epoch (through a guard) before it looks at the tree, and leaves it when it is done. A node which is unlinked from the tree is retired along with the
+    epoch at that time. Only the threads which were inside the tree in that epoch or before can still have a pointer to it, so its block can be reused as soon as every thread
+    inside the tree entered a later epoch. Retired blocks are collected in batches: every RECLAIM_BATCH retirements the epoch moves on, and the blocks which nobody can see anymore
+    are handed back. Entering and leaving only touch a cache line of the calling thread. */
+class Epoch_manager
+{
+private:
+    struct alignas(CACHE_LINE_SIZE) thread_epoch
+    {
+        std::atomic<uint64_t> epoch; /**< Epoch in which the thread entered, or idle. */
+        int depth; /**< Number of guards of the thread which are alive. Only the thread itself uses it. */
+    };
+
+    static const uint64_t idle = UINT64_MAX;
+    thread_epoch threads[MAX_THREADS];
+    std::atomic<uint64_t> global_epoch;
+    std::vector<std::pair<void*, uint64_t> > retired; /**< Blocks retired and not reused yet, with their epochs. */
+
+public:
+    /// Keeps the calling thread inside the current epoch for as long as it lives. Guards can be nested.
+    class guard
+    {
+    public:
+        guard(Epoch_manager& manager) : owner(manager) { owner.enter(); }
+        ~guard() { owner.exit(); }
+
+    private:
+        Epoch_manager& owner;
+    };
+
+    Epoch_manager()
+    {
+        for (int i = 0; i < MAX_THREADS; i++)
+        {
+            threads[i].epoch.store(idle);
+            threads[i].depth = 0;
+        }
+        global_epoch.store(1);
+    }
+
+    void enter()
+    {
+        thread_epoch& mine = threads[Thread_slot::current()];
+        if (mine.depth++ == 0)
+            mine.epoch.store(global_epoch.load()); // sequentially consistent, so that no pointer is read from the tree before the epoch is published.
+    }
+
+    void exit()
+    {
+        thread_epoch& mine = threads[Thread_slot::current()];
+        if (--mine.depth == 0)
+            mine.epoch.store(idle, std::memory_order_release);
+    }
+
+    /// Function to retire a block which was just unlinked. Not thread safe: the caller serialises retirements (and the free function) with its own lock.
+    /** @param block    The block which was unlinked.
+        @param free     Function which is given every block which can be reused, this one or an older one. */
+    template <class Free> void retire(void* block, Free free)
+    {
+        retired.push_back(std::make_pair(block, global_epoch.load()));
+        if (retired.size() % RECLAIM_BATCH == 0)
+            collect(free);
+    }
+
+private:
+    /// Function to move the epoch on and hand every retired block which no thread can see anymore to free.
+    template <class Free> void collect(Free free)
+    {
+        global_epoch.fetch_add(1);
+        uint64_t oldest = idle;
+        for (int i = 0; i < MAX_THREADS; i++)
+        {
+            uint64_t epoch = threads[i].epoch.load();
+            oldest = epoch < oldest ? epoch : oldest;
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++)
+        {
+            if (retired[i].second < oldest)
+                free(retired[i].first);
+            else
+                retired[kept++] = retired[i];
+        }
+        retired.resize(kept);
+    }
+};
+
+
+/// A B+ tree which many threads can read and write at the same time, using optimistic lock coupling.
+/** The nodes are the nodes of a BTree with the same template parameters, and are searched with the same kernels. Every node carries a Version_latch. Readers take no latch at all:
+    they go down the tree checking that the version of every node they read is unchanged once they are done with it, and start over from the root if a writer got in between. So
+    lookups scale with the number of cores, as they never write to shared memory. Writers go down the tree in the same way and latch only the nodes they change: an insertion
+    latches one leaf, and splits (done on the way down, as soon as a full node is met, so that a split never has to go back up) latch the full node and its parent.
+    Leaves are linked forward only, which is enough for scans. A delete which empties a leaf gives a leaf back to the allocator (see release_empty_leaf), and a root left with one
+    child is replaced by it. Nodes are not merged otherwise. The unlinked nodes are reused through epoch based reclamation once no reader can be looking at them.
+    As readers may read a node while it is being written (and then throw away what they read), the keys have to be trivially copyable. Keys found are returned as copies. */
+template <class KeyType, size_t NodeSize = BLOCK_SIZE, class Traits = key_traits<KeyType> > class ConcurrentBTree
+{
+public:
+    typedef BTree<KeyType, NodeSize, Traits> tree_type; /**< The single threaded tree with the same nodes, whose node level helpers are shared. */
+    typedef typename tree_type::geometry geometry;
+    typedef typename tree_type::base_node base_node;
+    typedef typename tree_type::leaf_node leaf_node;
+    typedef typename tree_type::inner_node inner_node;
+    static constexpr int leaf_capacity = geometry::leaf_capacity;
+    static constexpr int inner_capacity = geometry::inner_capacity;
+
+    static_assert(std::is_trivially_copyable<KeyType>::value, "Optimistic readers copy keys which may be half written, so keys have to be trivially copyable.");
+
+private:
+    std::atomic<base_node*> root; /**< The root. An empty tree has an empty leaf as its root. */
+    Node_allocator<NodeSize, geometry::alignment> allocator; /**< The pool of all nodes of the tree. */
+    std::mutex allocator_mutex; /**< Serialises the allocator and the retirement of nodes, which are only used by splits and merges. */
+    mutable Epoch_manager epochs; /**< Decides when unlinked nodes can be reused. */
+
+public:
+    /** Constructor for the ConcurrentBTree. It starts with an empty leaf as the root.
+    @param use_huge_pages   Whether the slabs from which nodes are allocated should be backed by huge pages. */
+    ConcurrentBTree(bool use_huge_pages = false) : allocator(use_huge_pages)
+    {
+        root.store(new_node<leaf_node>(0));
+    }
+
+    ConcurrentBTree(const ConcurrentBTree&) = delete;
+    ConcurrentBTree& operator=(const ConcurrentBTree&) = delete;
+
+/// Function to add a key in the tree. Safe to call from any number of threads at the same time.
+    void add_key(KeyType* toInsert)
+    {
+        Epoch_manager::guard inside(epochs);
+        while (!try_add_key(*toInsert))
+            ;
+    }
+
+/// Function to remove the first key matching the given one. Safe to call from any number of threads at the same time.
+/** @return Whether a matching key was found and removed. */
+    bool delete_key(KeyType* toDelete)
+    {
+        Epoch_manager::guard inside(epochs);
+        int outcome;
+        while ((outcome = try_delete_key(*toDelete)) < 0)
+            ;
+        return outcome == 1;
+    }
+
+/// Function to look for a key matching a probe. Safe to call from any number of threads at the same time.
+/** @param probe    A key, or any probe which the key traits can compare keys with.
+    @param result   Set to a copy of the first key matching the probe, if there is one.
+    @return Whether a matching key was found. */
+    template <class Probe> bool find(const Probe& probe, KeyType& result) const
+    {
+        Epoch_manager::guard inside(epochs);
+        int outcome;
+        while ((outcome = try_find(probe, result)) < 0)
+            ;
+        return outcome == 1;
+    }
+
+/// Function to copy, in order, the keys not smaller than a probe into a vector, up to a limit.
+/** The scan copies a leaf at a time and checks that the leaf did not change in the meantime. If it did, the scan goes back down the tree to the last key it copied and carries on
+    from there, so every key is returned once. The result is not a snapshot: keys added or removed during the scan may or may not be seen.
+    @param from     The probe to start from.
+    @param limit    The largest number of keys to add to out.
+    @param out      The vector to which the keys are appended.
+    @return The number of keys appended. */
+    template <class Probe> size_t scan(const Probe& from, size_t limit, std::vector<KeyType>& out) const
+    {
+        Epoch_manager::guard inside(epochs);
+        std::vector<KeyType> buffer;
+        buffer.reserve(leaf_capacity);
+        size_t copied = 0;
+        size_t equal_to_last = 0; // how many keys equal to the last key copied (out.back()) were copied, to carry on after a restart.
+        bool restart = true;
+        while (restart && copied < limit)
+        {
+            restart = false;
+            uint64_t version;
+            leaf_node* leaf = copied == 0 ? descend(from, version, restart) : descend(out.back(), version, restart);
+            if (restart)
+                continue;
+            int position = copied == 0 ? tree_type::lower_index(leaf, from) : tree_type::lower_index(leaf, out.back());
+            size_t skip = equal_to_last;
+            while (copied < limit)
+            {
+                buffer.clear();
+                int valid = std::min(leaf->NumberOfValidKeys, leaf_capacity);
+                for (int i = position; i < valid; i++)
+                    buffer.push_back(leaf->key_array[i]);
+                leaf_node* next = leaf->next_leaf;
+                leaf->latch.check_or_restart(version, restart);
+                if (restart)
+                    break;
+                for (size_t i = 0; i < buffer.size() && copied < limit; i++)
+                {
+                    bool repeat = copied > 0 && same_key(buffer[i], out.back());
+                    if (repeat && skip > 0)
+                    {
+                        skip--;
+                        continue;
+                    }
+                    skip = 0;
+                    out.push_back(buffer[i]);
+                    copied++;
+                    equal_to_last = repeat ? equal_to_last + 1 : 1;
+                }
+                if (next == NULL)
+                    break;
+                leaf = next;
+                position = 0;
+                version = leaf->latch.read_or_restart(restart);
+                if (restart)
+                    break;
+            }
+        }
+        return copied;
+    }
+
+/// Function to get the number of nodes in use, for memory usage figures. Retired nodes count until they are reused.
+    size_t used_nodes()
+    {
+        std::lock_guard<std::mutex> hold(allocator_mutex);
+        return allocator.used_blocks();
+    }
+
+private:
+/// Function to check whether two keys are equal in the order of the key traits.
+    static bool same_key(const KeyType& a, const KeyType& b)
+    {
+        if constexpr (Traits::normalized)
+            return Traits::normalize(a) == Traits::normalize(b);
+        else
+            return Traits::compare(a, b) == 0;
+    }
+
+/// Function to create a node of the given type from a block of the allocator.
+    template <class Node> Node* new_node(int level)
+    {
+        void* block;
+        {
+            std::lock_guard<std::mutex> hold(allocator_mutex);
+            block = allocator.allocate();
+        }
+        Node* created = new (block) Node();
+        created->level = level;
+        return created;
+    }
+
+/// Function to retire a node which was unlinked from the tree. Its block is reused once no thread can see it anymore.
+    void retire(base_node* node)
+    {
+        std::lock_guard<std::mutex> hold(allocator_mutex);
+        epochs.retire(node, [this](void* block) { allocator.deallocate(block); });
+    }
+
+/// Function to go down optimistically from the root to the leaf where the first key not smaller than a probe is, or would be.
+/** @param probe            The probe being looked for.
+    @param version          Set to the version of the leaf when it was reached.
+    @param restart          Set if a node changed on the way down.
+    @param parent           If not NULL, set to the parent of the leaf (NULL if the leaf is the root), and parent_version and position to its version and the index of the leaf in it.
+    @return The leaf, whose contents are only known to be consistent until its version changes. */
+    template <class Probe> leaf_node* descend(const Probe& probe, uint64_t& version, bool& restart, inner_node** parent = NULL, uint64_t* parent_version = NULL,
+        int* position = NULL) const
+    {
+        base_node* node = root.load(std::memory_order_acquire);
+        version = node->latch.read_or_restart(restart);
+        if (restart || node != root.load(std::memory_order_acquire))
+        {
+            restart = true;
+            return NULL;
+        }
+        inner_node* above = NULL;
+        uint64_t above_version = 0;
+        int index = 0;
+        while (node->level != 0)
+        {
+            inner_node* inner = (inner_node*)node;
+            if (above != NULL)
+            {
+                above->latch.check_or_restart(above_version, restart);
+                if (restart)
+                    return NULL;
+            }
+            above = inner;
+            above_version = version;
+            index = std::min(tree_type::lower_index(inner, probe), inner_capacity);
+            node = inner->children_array[index];
+            inner->latch.check_or_restart(version, restart); // the child pointer is only known to be right once the node it was read from is unchanged.
+            if (restart)
+                return NULL;
+            version = node->latch.read_or_restart(restart);
+            if (restart)
+                return NULL;
+        }
+        if (above != NULL)
+        {
+            above->latch.check_or_restart(above_version, restart); // the leaf may have been split between the check of its parent and the read of its version.
+            if (restart)
+                return NULL;
+        }
+        if (parent != NULL)
+        {
+            *parent = above;
+            *parent_version = above_version;
+            *position = index;
+        }
+        return (leaf_node*)node;
+    }
+
+/// One attempt of find. @return 1 if a key was found, 0 if there is none, -1 if the attempt has to be started over.
+    template <class Probe> int try_find(const Probe& probe, KeyType& result) const
+    {
+        bool restart = false;
+        uint64_t version;
+        leaf_node* leaf = descend(probe, version, restart);
+        if (restart)
+            return -1;
+        int position = tree_type::lower_index(leaf, probe);
+        while (position >= leaf->NumberOfValidKeys) // every key of the leaf is smaller, so the first key not smaller is in the leaves after it.
+        {
+            leaf_node* next = leaf->next_leaf;
+            leaf->latch.check_or_restart(version, restart);
+            if (restart)
+                return -1;
+            if (next == NULL)
+                return 0;
+            leaf = next;
+            position = 0;
+            version = leaf->latch.read_or_restart(restart);
+            if (restart)
+                return -1;
+        }
+        bool found = tree_type::matches(leaf, position, probe);
+        if (found)
+            result = leaf->key_array[position];
+        leaf->latch.check_or_restart(version, restart);
+        if (restart)
+            return -1;
+        return found ? 1 : 0;
+    }
+
+/// One attempt of add_key. It goes down like descend, but splits the first full node it meets and starts over. @return Whether the key was added.
+    bool try_add_key(const KeyType& key)
+    {
+        bool restart = false;
+        base_node* node = root.load(std::memory_order_acquire);
+        uint64_t version = node->latch.read_or_restart(restart);
+        if (restart || node != root.load(std::memory_order_acquire))
+            return false;
+        inner_node* parent = NULL;
+        uint64_t parent_version = 0;
+        while (node->level != 0)
+        {
+            inner_node* inner = (inner_node*)node;
+            if (inner->NumberOfValidKeys >= inner_capacity)
+            {
+                split_on_the_way(inner, version, parent, parent_version);
+                return false;
+            }
+            if (parent != NULL)
+            {
+                parent->latch.check_or_restart(parent_version, restart);
+                if (restart)
+                    return false;
+            }
+            parent = inner;
+            parent_version = version;
+            node = inner->children_array[std::min(tree_type::upper_index(inner, key), inner_capacity)];
+            inner->latch.check_or_restart(version, restart);
+            if (restart)
+                return false;
+            version = node->latch.read_or_restart(restart);
+            if (restart)
+                return false;
+        }
+        leaf_node* leaf = (leaf_node*)node;
+        if (leaf->NumberOfValidKeys >= leaf_capacity)
+        {
+            split_on_the_way(leaf, version, parent, parent_version);
+            return false;
+        }
+        leaf->latch.upgrade_or_restart(version, restart);
+        if (restart)
+            return false;
+        if (parent != NULL)
+        {
+            parent->latch.check_or_restart(parent_version, restart); // the key may belong to a new right sibling if the leaf was split since its parent was checked.
+            if (restart)
+            {
+                leaf->latch.unlock();
+                return false;
+            }
+        }
+        int position = tree_type::upper_index(leaf, key);
+        for (int counter = leaf->NumberOfValidKeys - 1; counter >= position; counter--)
+            tree_type::copy_entry(leaf, counter + 1, leaf, counter);
+        tree_type::set_key(leaf, position, key);
+        leaf->NumberOfValidKeys++;
+        leaf->latch.unlock();
+        return true;
+    }
+
+/// Function to split a full node met on the way down. It latches the node and its parent, which is not full as it was split first otherwise, and gives up if either changed.
+/** The right half of the node moves to a new node which is added to the parent (or to a new root) right after it. The new node is only reachable once the parent is unlatched. */
+    template <class Node> void split_on_the_way(Node* node, uint64_t version, inner_node* parent, uint64_t parent_version)
+    {
+        bool restart = false;
+        if (parent != NULL)
+        {
+            parent->latch.upgrade_or_restart(parent_version, restart);
+            if (restart)
+                return;
+        }
+        node->latch.upgrade_or_restart(version, restart);
+        if (restart || (parent == NULL && node != root.load()))
+        {
+            if (!restart)
+                node->latch.unlock();
+            if (parent != NULL)
+                parent->latch.unlock();
+            return;
+        }
+        Node* right = new_node<Node>(node->level);
+        KeyType separator;
+        split_half(node, right, separator);
+        if (parent != NULL)
+        {
+            int position = 0;
+            while (parent->children_array[position] != node)
+                position++;
+            for (int counter = parent->NumberOfValidKeys - 1; counter >= position; counter--)
+                tree_type::copy_entry(parent, counter + 1, parent, counter);
+            for (int counter = parent->NumberOfValidKeys; counter > position; counter--)
+                parent->children_array[counter + 1] = parent->children_array[counter];
+            tree_type::set_key(parent, position, separator);
+            parent->children_array[position + 1] = right;
+            parent->NumberOfValidKeys++;
+        }
+        else
+        {
+            inner_node* fresh_root = new_node<inner_node>(node->level + 1);
+            tree_type::set_key(fresh_root, 0, separator);
+            fresh_root->children_array[0] = node;
+            fresh_root->children_array[1] = right;
+            fresh_root->NumberOfValidKeys = 1;
+            root.store(fresh_root, std::memory_order_release);
+        }
+        node->latch.unlock();
+        if (parent != NULL)
+            parent->latch.unlock();
+    }
+
+/// Function to move the right half of a latched node into an empty node. The separator is the first key of the right leaf, or the middle key of an inner node, which goes up.
+    template <class Node> void split_half(Node* node, Node* right, KeyType& separator)
+    {
+        int keys = node->NumberOfValidKeys;
+        int break_point = keys / 2;
+        if constexpr (Node::leaf)
+        {
+            for (int i = break_point; i < keys; i++)
+                tree_type::copy_entry(right, i - break_point, node, i);
+            right->NumberOfValidKeys = keys - break_point;
+            separator = right->key_array[0];
+            right->next_leaf = node->next_leaf;
+            node->next_leaf = right;
+        }
+        else
+        {
+            separator = node->key_array[break_point];
+            for (int i = break_point + 1; i < keys; i++)
+                tree_type::copy_entry(right, i - break_point - 1, node, i);
+            for (int i = break_point + 1; i <= keys; i++)
+            {
+                right->children_array[i - break_point - 1] = node->children_array[i];
+                node->children_array[i] = NULL;
+            }
+            right->NumberOfValidKeys = keys - break_point - 1;
+        }
+        for (int i = break_point; i < keys; i++)
+            node->key_array[i].valid = 0;
+        node->NumberOfValidKeys = break_point;
+    }
+
+/// One attempt of delete_key. @return 1 if a key was removed, 0 if there is none, -1 if the attempt has to be started over.
+    int try_delete_key(const KeyType& key)
+    {
+        bool restart = false;
+        uint64_t version, parent_version = 0;
+        inner_node* parent = NULL;
+        int position = 0;
+        leaf_node* leaf = descend(key, version, restart, &parent, &parent_version, &position);
+        if (restart)
+            return -1;
+        int index = tree_type::lower_index(leaf, key);
+        while (index >= leaf->NumberOfValidKeys)
+        {
+            leaf_node* next = leaf->next_leaf;
+            leaf->latch.check_or_restart(version, restart);
+            if (restart)
+                return -1;
+            if (next == NULL)
+                return 0;
+            leaf = next;
+            index = 0;
+            parent = NULL; // the parent of the next leaf is not known, so it will not be unlinked if it gets empty.
+            version = leaf->latch.read_or_restart(restart);
+            if (restart)
+                return -1;
+        }
+        if (!tree_type::matches(leaf, index, key))
+        {
+            leaf->latch.check_or_restart(version, restart);
+            return restart ? -1 : 0;
+        }
+        leaf->latch.upgrade_or_restart(version, restart);
+        if (restart)
+            return -1;
+        for (int i = index + 1; i < leaf->NumberOfValidKeys; i++)
+            tree_type::copy_entry(leaf, i - 1, leaf, i);
+        leaf->NumberOfValidKeys--;
+        leaf->key_array[leaf->NumberOfValidKeys].valid = 0;
+        if (leaf->NumberOfValidKeys == 0 && parent != NULL)
+            release_empty_leaf(leaf, parent, parent_version, position);
+        else
+            leaf->latch.unlock();
+        return 1;
+    }
+
+/// Function to give back the node of a leaf which a delete just emptied, and unlatch the leaf.
+/** If the leaf has a left neighbour under the same parent, the leaf is unlinked from the parent and from that neighbour. Otherwise the right neighbour is merged into the leaf
+    (which only means copying its keys, as the leaf is empty) and unlinked instead, so that the neighbour whose link changes is always under the same parent. Inner nodes other
+    than the root keep at least one key, so the parent has to have two; a root left with a single child is replaced by it. If the parent or the neighbour is busy, or the parent
+    is too small, the leaf is left empty, which is harmless: lookups go on to the next leaf, and the next insertion into its key range fills it again.
+    @param leaf             The empty leaf, write latched.
+    @param parent           Its parent, as seen on the way down.
+    @param parent_version   The version of the parent on the way down.
+    @param position         The index of the leaf in the parent. */
+    void release_empty_leaf(leaf_node* leaf, inner_node* parent, uint64_t parent_version, int position)
+    {
+        bool restart = false;
+        parent->latch.upgrade_or_restart(parent_version, restart);
+        if (restart)
+        {
+            leaf->latch.unlock();
+            return;
+        }
+        bool is_root = parent == root.load();
+        int separator = position > 0 ? position - 1 : 0; // the separator and the child right of it are taken out of the parent.
+        leaf_node* neighbour = (leaf_node*)parent->children_array[position > 0 ? position - 1 : 1];
+        uint64_t neighbour_version = 0;
+        if (parent->NumberOfValidKeys >= (is_root ? 1 : 2))
+            neighbour_version = neighbour->latch.read_or_restart(restart);
+        else
+            restart = true;
+        if (!restart)
+            neighbour->latch.upgrade_or_restart(neighbour_version, restart);
+        if (restart)
+        {
+            parent->latch.unlock();
+            leaf->latch.unlock();
+            return;
+        }
+        leaf_node* removed;
+        if (position > 0)
+        {
+            neighbour->next_leaf = leaf->next_leaf;
+            neighbour->latch.unlock();
+            removed = leaf;
+        }
+        else
+        {
+            for (int i = 0; i < neighbour->NumberOfValidKeys; i++)
+                tree_type::copy_entry(leaf, i, neighbour, i);
+            leaf->NumberOfValidKeys = neighbour->NumberOfValidKeys;
+            leaf->next_leaf = neighbour->next_leaf;
+            leaf->latch.unlock();
+            removed = neighbour;
+        }
+        for (int i = separator + 1; i < parent->NumberOfValidKeys; i++)
+            tree_type::copy_entry(parent, i - 1, parent, i);
+        for (int i = separator + 2; i <= parent->NumberOfValidKeys; i++)
+            parent->children_array[i - 1] = parent->children_array[i];
+        parent->children_array[parent->NumberOfValidKeys] = NULL;
+        parent->NumberOfValidKeys--;
+        parent->key_array[parent->NumberOfValidKeys].valid = 0;
+        removed->latch.unlock_obsolete();
+        retire(removed);
+        if (parent->NumberOfValidKeys == 0)
+        {
+            root.store(parent->children_array[0], std::memory_order_release);
+            parent->latch.unlock_obsolete();
+            retire(parent);
+            return;
+        }
+        parent->latch.unlock();
+    }
+};
+
+
+/// Identifier of a page of a page file: its index in the file. Page 0 is the superblock, so 0 also stands for no page.
+/** With 32 bits a file of 4 KiB pages can grow to 16 TiB. A 64 bit type works as well, at the cost of 4 more bytes per child in every inner page. */
+typedef uint32_t page_id;
+
+/// The superblock of a page file, stored at the start of page 0. It describes the file and the tree stored in it.
+struct Page_superblock
+{
+    uint64_t magic; /**< PAGE_FILE_MAGIC, to recognise a page file. */
+    uint32_t version; /**< PAGE_FILE_VERSION of the code which created the file. */
+    uint32_t page_size; /**< Size of every page in bytes. */
+    page_id page_count; /**< Number of pages of the file ever handed out, the superblock included. */
+    page_id free_head; /**< The first page of the list of free pages, 0 if there is none. */
+    page_id free_count; /**< Number of pages in the list of free pages. */
+    uint32_t key_size; /**< Size of the keys of the tree stored in the file. 0 until a tree uses the file. */
+    uint32_t leaf_capacity; /**< Number of keys held by a full leaf page, checked when the tree is opened again. */
+    uint32_t inner_capacity; /**< Number of keys held by a full inner page, checked when the tree is opened again. */
+    page_id root; /**< The root page of the tree, 0 while the tree is empty. */
+    page_id first_leaf; /**< The leftmost leaf page, 0 while the tree is empty. */
+    page_id last_leaf; /**< The rightmost leaf page, 0 while the tree is empty. */
+    uint64_t key_count; /**< Number of keys in the tree. */
+};
+
+/// The header at the start of every page of a page file other than the superblock.
+/** The fields are named like those of Node_base, so that the search functions of BTree work on pages as they do on nodes. */
+struct Page_header
+{
+    int NumberOfValidKeys; /**< Number of keys in the page. */
+
+    int level; /**< Height of the page above the leaves, which are at level 0. */
+
+    page_id next_leaf; /**< For a leaf, the leaf holding the keys right after its keys. For a free page, the next free page. 0 if there is none. */
+
+    page_id prev_leaf; /**< For a leaf, the leaf holding the keys right before its keys. 0 if there is none. */
+};
+
+/// The layout of an inner page of a PagedBTree. Children are page ids rather than pointers, and there is no parent, as the tree is walked from the root with a path stack.
+template <class KeyType, class Traits, int Capacity, bool IsLeaf> struct Page_node : public Page_header, public Node_search_keys<Traits, Capacity + 1>
+{
+    static const int capacity = Capacity; /**< Maximum number of keys which the page holds outside of an insertion. */
+    static const bool leaf = IsLeaf;
+
+    KeyType key_array[Capacity + 1]; /**< The keys, with one buffer space at the end used while splitting, like in Node_btree. */
+
+    page_id children_array[Capacity + 2]; /**< The children. There is one more child than keys, plus the buffer space. */
+};
+
+/// The layout of a leaf page of a PagedBTree: the header and the keys.
+template <class KeyType, class Traits, int Capacity> struct Page_node<KeyType, Traits, Capacity, true> : public Page_header, public Node_search_keys<Traits, Capacity + 1>
+{
+    static const int capacity = Capacity; /**< Maximum number of keys which the page holds outside of an insertion. */
+    static const bool leaf = true;
+
+    KeyType key_array[Capacity + 1]; /**< The keys, with one buffer space at the end used while splitting. */
+};
+
+/// Compile time geometry of the pages of a PagedBTree, the counterpart of node_geometry. The capacities fill a page of PageSize bytes, buffer space included.
+template <class KeyType, size_t PageSize, class Traits = key_traits<KeyType> > struct page_geometry
+{
+    static const size_t entry_size = sizeof(KeyType) + normalized_key_size<Traits>(); /**< Bytes taken by one key and its normalized form, if any. */
+
+    // Both with room for the padding between the header, the normalized keys and the keys.
+    static const int leaf_capacity = (int)((PageSize - sizeof(Page_header) - 2 * sizeof(void*)) / entry_size) - 1;
+    static const int inner_capacity = (int)((PageSize - sizeof(Page_header) - 2 * sizeof(void*) - sizeof(page_id)) / (entry_size + sizeof(page_id))) - 1;
+
+    typedef Page_node<KeyType, Traits, leaf_capacity, true> leaf_page;
+    typedef Page_node<KeyType, Traits, inner_capacity, false> inner_page;
+
+    static_assert(leaf_capacity >= 3 && inner_capacity >= 3, "The page size is too small to hold three keys. Increase PageSize.");
+    static_assert(sizeof(leaf_page) <= PageSize && sizeof(inner_page) <= PageSize && sizeof(Page_superblock) <= PageSize, "Page layout does not fit in the page size.");
+};
+
+
+/// A file of fixed size pages, mapped into memory as a whole.
+/** The file is mapped once, together with a reservation of address space for it to grow into (PAGE_FILE_RESERVE bytes by default), so that the address of a page never changes
+    while the file is open and growing the file is only a matter of extending it. Pages are read and written as plain memory. The kernel writes changed pages back on its own,
+    and sync forces them out. Reopening the file maps it again, so a tree stored in it is usable right away, without being read or rebuilt.
+    Page 0 is the superblock. Freed pages are kept in a list threaded through their headers, which starts in the superblock, and are handed out again before the file grows.
+    The file is in the byte order and layout of the machine which wrote it. */
+class Page_file
+{
+private:
+    int fd; /**< The open file. */
+    char* base; /**< Address at which the file is mapped. Page p starts at base + p * page_bytes. */
+    size_t page_bytes; /**< Size of a page. */
+    size_t reserved; /**< Bytes of address space mapped, which the file may not outgrow. */
+    size_t file_bytes; /**< Current size of the file. */
+    bool fresh; /**< Whether the file was created (or was empty) when it was opened. */
+
+public:
+    /** Constructor for the page file. It opens the file (creating it if needed) and maps it. A new file gets a superblock.
+    @param path             Path of the file.
+    @param page_size        Size of the pages. A file which already exists must have been created with the same page size.
+    @param reserve_bytes    Bytes of address space to reserve for the file. It cannot grow beyond that while it is open. */
+    Page_file(const char* path, size_t page_size, size_t reserve_bytes = PAGE_FILE_RESERVE)
+    {
+        page_bytes = page_size;
+        base = (char*)MAP_FAILED;
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            fail(std::string("Cannot open the page file ") + path + ": " + strerror(errno));
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+            fail(std::string("Cannot read the size of the page file: ") + strerror(errno));
+        file_bytes = (size_t)info.st_size;
+        fresh = file_bytes == 0;
+        if (file_bytes % page_bytes != 0)
+            fail("The size of the page file is not a multiple of the page size");
+        reserved = std::max(reserve_bytes, file_bytes);
+        base = (char*)mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+            fail(std::string("Cannot map the page file: ") + strerror(errno));
+        if (fresh)
+        {
+            extend(1);
+            Page_superblock* super = superblock();
+            memset(base, 0, page_bytes);
+            super->magic = PAGE_FILE_MAGIC;
+            super->version = PAGE_FILE_VERSION;
+            super->page_size = (uint32_t)page_bytes;
+            super->page_count = 1;
+        }
+        else if (file_bytes < page_bytes || superblock()->magic != PAGE_FILE_MAGIC || superblock()->version != PAGE_FILE_VERSION)
+            fail("The file is not a page file");
+        else if (superblock()->page_size != page_bytes)
+            fail("The page file was created with another page size");
+    }
+
+    /** Destructor for the page file. It writes every changed page back before closing the file. */
+    ~Page_file()
+    {
+        msync(base, file_bytes, MS_SYNC);
+        munmap(base, reserved);
+        close(fd);
+    }
+
+    Page_file(const Page_file&) = delete;
+    Page_file& operator=(const Page_file&) = delete;
+
+    /// Function to get the address of a page. It stays valid as long as the file is open.
+    char* page(page_id id) const
+    {
+        return base + (size_t)id * page_bytes;
+    }
+
+    /// Function to get the superblock of the file.
+    Page_superblock* superblock() const
+    {
+        return (Page_superblock*)base;
+    }
+
+    /// Function to get the address of a page for as long as it is used, see Page_guard. All pages of a mapped file are always there, so this is page.
+    char* pin(page_id id)
+    {
+        return page(id);
+    }
+
+    /// Function to say that a page got from pin is not used any more. Nothing to do for a mapped file, whose changed pages the kernel tracks.
+    void unpin(const char*, bool)
+    {
+    }
+
+    /// Whether the file was created (or was empty) when it was opened.
+    bool created() const
+    {
+        return fresh;
+    }
+
+    /// Function to get a page, from the list of free pages or else at the end of the file. The page is filled with zeros.
+    page_id allocate()
+    {
+        Page_superblock* super = superblock();
+        page_id id = super->free_head;
+        if (id != 0)
+        {
+            super->free_head = ((Page_header*)page(id))->next_leaf;
+            super->free_count--;
+        }
+        else
+        {
+            id = super->page_count;
+            if (id == (page_id)-1)
+                throw std::runtime_error("The page file has run out of page ids.");
+            extend((size_t)id + 1);
+            super->page_count++;
+        }
+        memset(page(id), 0, page_bytes);
+        return id;
+    }
+
+    /// Function to give a page back. It goes on the list of free pages.
+    void free(page_id id)
+    {
+        Page_superblock* super = superblock();
+        ((Page_header*)page(id))->next_leaf = super->free_head;
+        super->free_head = id;
+        super->free_count++;
+    }
+
+    /// Function to write every changed page back to the disk, and wait until it is there.
+    void sync()
+    {
+        if (msync(base, file_bytes, MS_SYNC) != 0)
+            throw std::runtime_error(std::string("Cannot write the page file back: ") + strerror(errno));
+    }
+
+    size_t page_size() const { return page_bytes; } /**< Size of a page in bytes. */
+    size_t used_pages() const { return superblock()->page_count - superblock()->free_count; } /**< Number of pages in use, the superblock included. */
+    size_t size_bytes() const { return file_bytes; } /**< Size of the file in bytes. */
+
+private:
+    /// Function to make the file at least pages pages long. It grows by doubling, so that the number of extensions stays logarithmic.
+    void extend(size_t pages)
+    {
+        size_t needed = pages * page_bytes;
+        if (needed <= file_bytes)
+            return;
+        if (needed > reserved)
+            throw std::runtime_error("The page file has outgrown the address space reserved for it.");
+        size_t grown = std::min(std::max(needed, 2 * file_bytes), reserved / page_bytes * page_bytes);
+        if (ftruncate(fd, (off_t)grown) != 0)
+            throw std::runtime_error(std::string("Cannot extend the page file: ") + strerror(errno));
+        file_bytes = grown;
+    }
+
+    /// Function to undo what the constructor did so far and throw a runtime_error with the reason.
+    void fail(const std::string& reason)
+    {
+        if (base != MAP_FAILED)
+            munmap(base, reserved);
+        if (fd >= 0)
+            close(fd);
+        throw std::runtime_error(reason);
+    }
+};
+
+
+/// A pool of page frames which caches the pages of a file, as the storage of a PagedBTree for trees larger than the memory given to them.
+/** The pool holds at most a fixed number of pages (frames) in memory. A page is read into a frame when it is pinned and not there already, and may be evicted once it is
+    unpinned. Eviction follows the CLOCK algorithm with usage counts (GCLOCK): every pin of a page raises its count, up to CLOCK_MAX_USAGE, and the clock hand lowers the
+    count of every unpinned frame it passes, evicting the first one found at zero. Pages read by every lookup, like the root and the inner pages below it, so stay in memory,
+    while leaves read once are the first to go. A changed (dirty) page is written back when it is evicted, and all of them are written back by sync.
+    The pool reads and writes pages with pread and pwrite. With direct I/O the pages also bypass the page cache of the kernel, so that the frames are the only copy in memory and
+    the memory used by the tree is capped by the number of frames. The superblock is kept in memory of its own, outside of the frames, and written back by sync.
+    Hits, misses, evictions and write-backs are counted, to size the pool. */
+class Buffer_pool
+{
+private:
+    /// The state of a frame of the pool.
+    struct frame_state
+    {
+        page_id page; /**< The page held by the frame, 0 if the frame is free. */
+        int pins; /**< Number of users of the page. A pinned page is never evicted. */
+        int usage; /**< Usage count, raised by pins and lowered by the clock hand. */
+        bool dirty; /**< Whether the page changed since it was read or last written back. */
+    };
+
+    int fd; /**< The open file. */
+    size_t page_bytes; /**< Size of a page. */
+    char* frames; /**< Memory of all frames, one page after the other, page aligned. */
+    char* super_page; /**< The superblock page, page aligned. */
+    std::vector<frame_state> states; /**< The state of every frame. */
+    std::unordered_map<page_id, int> table; /**< The frame of every page in the pool. */
+    size_t hand; /**< The frame which the clock hand looks at next. */
+    size_t hit_count; /**< Pins of pages which were in the pool. */
+    size_t miss_count; /**< Pins of pages which had to be read. */
+    size_t eviction_count; /**< Pages evicted to make room for others. */
+    size_t write_count; /**< Pages written back to the file. */
+    bool fresh; /**< Whether the file was created (or was empty) when it was opened. */
+
+public:
+    /** Constructor for the buffer pool. It opens the file (creating it if needed) and reads its superblock. A new file gets a superblock.
+    @param path         Path of the file.
+    @param page_size    Size of the pages. A file which already exists must have been created with the same page size.
+    @param frame_count  Number of pages held in memory at most. At least 8, as a split keeps a few pages pinned at the same time.
+    @param direct_io    Whether to bypass the page cache of the kernel. Falls back to buffered I/O where the file system does not support it, and for pages smaller than
+                        PAGE_BYTES. */
+    Buffer_pool(const char* path, size_t page_size, size_t frame_count, bool direct_io = false)
+    {
+        page_bytes = page_size;
+        frames = (char*)MAP_FAILED;
+        super_page = (char*)MAP_FAILED;
+        hand = 0;
+        hit_count = 0;
+        miss_count = 0;
+        eviction_count = 0;
+        write_count = 0;
+        fd = -1;
+#ifdef O_DIRECT
+        if (direct_io && page_size % PAGE_BYTES == 0) // direct I/O needs buffers, offsets and sizes aligned to the blocks of the device.
+            fd = open(path, O_RDWR | O_CREAT | O_DIRECT, 0644);
+#endif
+        if (fd < 0)
+            fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            fail(std::string("Cannot open the page file ") + path + ": " + strerror(errno));
+        if (frame_count < 8)
+            fail("A buffer pool needs at least 8 frames.");
+        states.assign(frame_count, frame_state());
+        frames = (char*)mmap(NULL, frame_count * page_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        super_page = (char*)mmap(NULL, page_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (frames == MAP_FAILED || super_page == MAP_FAILED)
+            fail("Cannot allocate the frames of the buffer pool.");
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+            fail(std::string("Cannot read the size of the page file: ") + strerror(errno));
+        fresh = info.st_size == 0;
+        Page_superblock* super = superblock();
+        if (fresh)
+        {
+            super->magic = PAGE_FILE_MAGIC;
+            super->version = PAGE_FILE_VERSION;
+            super->page_size = (uint32_t)page_bytes;
+            super->page_count = 1;
+            write_page(0, super_page);
+        }
+        else if ((size_t)info.st_size % page_bytes != 0 || pread(fd, super_page, page_bytes, 0) != (ssize_t)page_bytes || super->magic != PAGE_FILE_MAGIC
+            || super->version != PAGE_FILE_VERSION)
+            fail("The file is not a page file");
+        else if (super->page_size != page_bytes)
+            fail("The page file was created with another page size");
+    }
+
+    /** Destructor for the buffer pool. It writes every changed page and the superblock back before closing the file. */
+    ~Buffer_pool()
+    {
+        try
+        {
+            sync();
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+        munmap(frames, states.size() * page_bytes);
+        munmap(super_page, page_bytes);
+        close(fd);
+    }
+
+    Buffer_pool(const Buffer_pool&) = delete;
+    Buffer_pool& operator=(const Buffer_pool&) = delete;
+
+    /// Function to get the superblock of the file. It is always in memory.
+    Page_superblock* superblock() const
+    {
+        return (Page_superblock*)super_page;
+    }
+
+    /// Whether the file was created (or was empty) when it was opened.
+    bool created() const
+    {
+        return fresh;
+    }
+
+    /// Function to bring a page into the pool, reading it if needed, and keep it there until it is unpinned. Use it through Page_guard.
+    /** @return The address of the page in its frame, valid until the page is unpinned. */
+    char* pin(page_id id)
+    {
+        std::unordered_map<page_id, int>::iterator found = table.find(id);
+        if (found != table.end())
+        {
+            frame_state& state = states[found->second];
+            state.pins++;
+            state.usage = std::min(state.usage + 1, CLOCK_MAX_USAGE);
+            hit_count++;
+            return frames + (size_t)found->second * page_bytes;
+        }
+        miss_count++;
+        int victim = evict();
+        char* data = frames + (size_t)victim * page_bytes;
+        ssize_t got = pread(fd, data, page_bytes, (off_t)id * page_bytes);
+        if (got < 0)
+            throw std::runtime_error(std::string("Cannot read a page: ") + strerror(errno));
+        if ((size_t)got < page_bytes) // a page allocated at the end of the file, which was never written yet.
+            memset(data + got, 0, page_bytes - got);
+        frame_state& state = states[victim];
+        state.page = id;
+        state.pins = 1;
+        state.usage = 1;
+        state.dirty = false;
+        table[id] = victim;
+        return data;
+    }
+
+    /// Function to say that a page got from pin is not used any more by the caller.
+    /** @param data     The address returned by pin.
+        @param dirty    Whether the caller changed the page. */
+    void unpin(const char* data, bool dirty)
+    {
+        frame_state& state = states[(data - frames) / page_bytes];
+        state.pins--;
+        state.dirty = state.dirty || dirty;
+    }
+
+    /// Function to get a page, from the list of free pages or else at the end of the file. The page is filled with zeros when it is first pinned.
+    page_id allocate()
+    {
+        Page_superblock* super = superblock();
+        page_id id = super->free_head;
+        if (id != 0)
+        {
+            char* data = pin(id);
+            super->free_head = ((Page_header*)data)->next_leaf;
+            super->free_count--;
+            memset(data, 0, page_bytes);
+            unpin(data, true);
+        }
+        else
+        {
+            id = super->page_count;
+            if (id == (page_id)-1)
+                throw std::runtime_error("The page file has run out of page ids.");
+            super->page_count++;
+        }
+        return id;
+    }
+
+    /// Function to give a page back. It goes on the list of free pages.
+    void free(page_id id)
+    {
+        Page_superblock* super = superblock();
+        char* data = pin(id);
+        ((Page_header*)data)->next_leaf = super->free_head;
+        unpin(data, true);
+        super->free_head = id;
+        super->free_count++;
+    }
+
+    /// Function to write every changed page and the superblock back to the disk, and wait until they are there.
+    void sync()
+    {
+        for (size_t i = 0; i < states.size(); i++)
+        {
+            if (states[i].page != 0 && states[i].dirty)
+            {
+                write_page(states[i].page, frames + i * page_bytes);
+                states[i].dirty = false;
+            }
+        }
+        write_page(0, super_page);
+        if (fdatasync(fd) != 0)
+            throw std::runtime_error(std::string("Cannot write the page file back: ") + strerror(errno));
+    }
+
+    size_t page_size() const { return page_bytes; } /**< Size of a page in bytes. */
+    size_t used_pages() const { return superblock()->page_count - superblock()->free_count; } /**< Number of pages in use, the superblock included. */
+    size_t frame_count() const { return states.size(); } /**< Largest number of pages held in memory. */
+    size_t resident_pages() const { return table.size(); } /**< Number of pages in memory now. */
+    size_t hits() const { return hit_count; } /**< Number of pins of pages which were in memory. */
+    size_t misses() const { return miss_count; } /**< Number of pins of pages which had to be read. */
+    size_t evictions() const { return eviction_count; } /**< Number of pages evicted to make room for others. */
+    size_t write_backs() const { return write_count; } /**< Number of pages written to the file, superblock included. */
+
+private:
+    /// Function to find a frame for a page about to be read: a free frame, or else the frame chosen by the clock hand, whose page is written back first if it changed.
+    int evict()
+    {
+        for (size_t step = 0; step < states.size() * (CLOCK_MAX_USAGE + 1); step++)
+        {
+            size_t candidate = hand;
+            hand = (hand + 1) % states.size();
+            frame_state& state = states[candidate];
+            if (state.page == 0)
+                return (int)candidate;
+            if (state.pins > 0)
+                continue;
+            if (state.usage > 0)
+            {
+                state.usage--;
+                continue;
+            }
+            if (state.dirty)
+                write_page(state.page, frames + candidate * page_bytes);
+            table.erase(state.page);
+            state.page = 0;
+            eviction_count++;
+            return (int)candidate;
+        }
+        throw std::runtime_error("Every frame of the buffer pool is pinned.");
+    }
+
+    /// Function to write a page to its place in the file.
+    void write_page(page_id id, const char* data)
+    {
+        if (pwrite(fd, data, page_bytes, (off_t)id * page_bytes) != (ssize_t)page_bytes)
+            throw std::runtime_error(std::string("Cannot write a page: ") + strerror(errno));
+        write_count++;
+    }
+
+    /// Function to undo what the constructor did so far and throw a runtime_error with the reason.
+    void fail(const std::string& reason)
+    {
+        if (frames != MAP_FAILED)
+            munmap(frames, states.size() * page_bytes);
+        if (super_page != MAP_FAILED)
+            munmap(super_page, page_bytes);
+        if (fd >= 0)
+            close(fd);
+        throw std::runtime_error(reason);
+    }
+};
+
+
+/// A page pinned in the storage (Page_file or Buffer_pool) of a PagedBTree, seen as a page of the given type.
+/** The page stays at the same address for as long as the guard lives, and is unpinned when the guard is destroyed or released. A guard taken for writing marks the page as
+    changed, so that the storage writes it back. Guards can be moved, also to a guard of another page type, which is how a page is looked at as a header first and as a leaf or an
+    inner page once its level is known. */
+template <class Storage, class Node> class Page_guard
+{
+public:
+    Page_guard() : storage(NULL), node(NULL), page(0), dirty(false) {}
+
+    /** Constructor which pins a page.
+    @param from     The storage of the page.
+    @param id       The page.
+    @param write    Whether the page is going to be changed. */
+    Page_guard(Storage& from, page_id id, bool write = false) : storage(&from), node((Node*)from.pin(id)), page(id), dirty(write) {}
+
+    template <class Other> Page_guard(Page_guard<Storage, Other>&& other) : storage(other.storage), node((Node*)other.node), page(other.page), dirty(other.dirty)
+    {
+        other.node = NULL;
+    }
+
+    template <class Other> Page_guard& operator=(Page_guard<Storage, Other>&& other)
+    {
+        release();
+        storage = other.storage;
+        node = (Node*)other.node;
+        page = other.page;
+        dirty = other.dirty;
+        other.node = NULL;
+        return *this;
+    }
+
+    Page_guard(Page_guard&& other) : storage(other.storage), node(other.node), page(other.page), dirty(other.dirty)
+    {
+        other.node = NULL;
+    }
+
+    Page_guard& operator=(Page_guard&& other)
+    {
+        return operator=<Node>(std::move(other));
+    }
+
+    Page_guard(const Page_guard&) = delete;
+    Page_guard& operator=(const Page_guard&) = delete;
+
+    ~Page_guard()
+    {
+        release();
+    }
+
+    Node* operator->() const { return node; }
+    Node* get() const { return node; }
+    page_id id() const { return page; } /**< The page held, even after release. */
+
+    /// Function to say that the page is going to be changed, for a guard taken for reading.
+    void mark_dirty()
+    {
+        dirty = true;
+    }
+
+    /// Function to unpin the page before the guard goes away.
+    void release()
+    {
+        if (node != NULL)
+            storage->unpin((const char*)node, dirty);
+        node = NULL;
+    }
+
+private:
+    Storage* storage; /**< The storage of the page. */
+    Node* node; /**< The page, NULL once released. */
+    page_id page; /**< Id of the page. */
+    bool dirty; /**< Whether the page is marked as changed. */
+    template <class, class> friend class Page_guard;
+};
+
+
+/// A B+ tree stored in a page file, which survives the process and can be larger than the memory.
+/** Every node is a page of the file. Children are addressed by page id rather than by pointer, and nodes keep no parent: insertions and deletions remember the path from the
+    root in a stack instead. The search kernels and node level helpers are those of BTree. The root, the first and last leaves and the key count live in the superblock, so
+    opening a file which holds a tree gives back the tree as it was, without reading or inserting a single key.
+    The pages are reached through a Storage: a Page_file maps the whole file into memory and leaves caching to the kernel, a Buffer_pool holds a fixed number of pages in memory
+    and evicts the others. Either way every page is pinned by a Page_guard while it is used, so the tree only ever has the few pages of one path pinned at once.
+    An insertion splits full pages on the way back up like BTree does. A deletion which empties a leaf gives its page back to the free list and takes it out of its parent,
+    which is given back as well once it has no child left, and a root with a single child is replaced by it. Pages are not merged otherwise.
+    Keys are copied in and out of pages, so they have to be trivially copyable. The tree is used from one thread. What is on disk is consistent after sync (or closing the tree);
+    crash safety in between comes from a write-ahead log on top of the tree. */
+template <class KeyType, size_t PageSize = PAGE_BYTES, class Traits = key_traits<KeyType>, class Storage = Page_file> class PagedBTree
+{
+public:
+    typedef BTree<KeyType, PageSize, Traits> tree_type; /**< The in memory tree whose node level helpers are shared. */
+    typedef page_geometry<KeyType, PageSize, Traits> geometry;
+    typedef typename geometry::leaf_page leaf_page;
+    typedef typename geometry::inner_page inner_page;
+    template <class Node> using guard = Page_guard<Storage, Node>;
+    static constexpr int leaf_capacity = geometry::leaf_capacity;
+    static constexpr int inner_capacity = geometry::inner_capacity;
+    static const int max_height = 40; /**< Bound on the height of the tree, which is at most about log2 of the number of pages. */
+
+    static_assert(std::is_trivially_copyable<KeyType>::value, "Keys are copied to and from pages of a file, so they have to be trivially copyable.");
+
+private:
+    Storage file; /**< The storage of the pages of the tree. */
+
+    /// The path from the root to a leaf: the pages passed and the index of the child taken in each.
+    struct page_path
+    {
+        page_id pages[max_height];
+        int slots[max_height];
+        int depth; /**< Number of inner pages on the path. */
+    };
+
+public:
+    /** Constructor for the PagedBTree. It opens the tree stored in the given file, or creates an empty tree in a new file.
+    @param path         Path of the file.
+    @param options      Passed on to the constructor of the storage after the path and the page size: the address space to reserve for a Page_file, the number of frames
+                        (and whether to use direct I/O) for a Buffer_pool. */
+    template <class... Options> PagedBTree(const char* path, Options... options) : file(path, PageSize, options...)
+    {
+        Page_superblock* super = file.superblock();
+        if (super->key_size == 0)
+        {
+            super->key_size = sizeof(KeyType);
+            super->leaf_capacity = leaf_capacity;
+            super->inner_capacity = inner_capacity;
+        }
+        else if (super->key_size != sizeof(KeyType) || super->leaf_capacity != (uint32_t)leaf_capacity || super->inner_capacity != (uint32_t)inner_capacity)
+            throw std::runtime_error("The page file holds a tree of another key type or layout.");
+    }
+
+    PagedBTree(const PagedBTree&) = delete;
+    PagedBTree& operator=(const PagedBTree&) = delete;
+
+/// Function to add a key in the tree. Keys equal to keys already in the tree go after them.
+    void add_key(KeyType* toInsert)
+    {
+        Page_superblock* super = file.superblock();
+        if (super->root == 0)
+        {
+            guard<leaf_page> fresh = new_page<leaf_page>(0);
+            super->root = fresh.id();
+            super->first_leaf = fresh.id();
+            super->last_leaf = fresh.id();
+        }
+        page_path path;
+        guard<leaf_page> leaf = descend(*toInsert, true, path);
+        leaf.mark_dirty();
+        int position = tree_type::upper_index(leaf.get(), *toInsert);
+        for (int i = leaf->NumberOfValidKeys - 1; i >= position; i--)
+            tree_type::copy_entry(leaf.get(), i + 1, leaf.get(), i);
+        tree_type::set_key(leaf.get(), position, *toInsert);
+        leaf->NumberOfValidKeys++;
+        super->key_count++;
+        if (leaf->NumberOfValidKeys > leaf_capacity)
+            split_leaf(leaf, path);
+    }
+
+/// Function to remove a key matching the given one.
+/** @return Whether a matching key was found and removed. */
+    bool delete_key(KeyType* toDelete)
+    {
+        Page_superblock* super = file.superblock();
+        if (super->root == 0)
+            return false;
+        page_path path;
+        guard<leaf_page> leaf = descend(*toDelete, true, path);
+        int position = tree_type::upper_index(leaf.get(), *toDelete) - 1; // the last key not larger than the one deleted.
+        if (position < 0 && step_back(path, leaf)) // every key of the leaf is larger, but the leaf before may end with keys equal to it.
+            position = leaf->NumberOfValidKeys - 1;
+        if (position < 0 || !tree_type::matches(leaf.get(), position, *toDelete))
+            return false;
+        leaf.mark_dirty();
+        for (int i = position + 1; i < leaf->NumberOfValidKeys; i++)
+            tree_type::copy_entry(leaf.get(), i - 1, leaf.get(), i);
+        leaf->NumberOfValidKeys--;
+        super->key_count--;
+        if (leaf->NumberOfValidKeys == 0)
+            release_leaf(leaf, path);
+        return true;
+    }
+
+/// Function to look for a key matching a probe.
+/** @param probe    A key, or any probe which the key traits can compare keys with.
+    @param result   Set to a copy of the first key matching the probe, if there is one.
+    @return Whether a matching key was found. */
+    template <class Probe> bool find(const Probe& probe, KeyType& result)
+    {
+        guard<leaf_page> leaf;
+        int position;
+        if (!seek(probe, leaf, position) || !tree_type::matches(leaf.get(), position, probe))
+            return false;
+        result = leaf->key_array[position];
+        return true;
+    }
+
+/// Function to copy, in order, the keys not smaller than a probe into a vector, up to a limit.
+/** @param from     The probe to start from.
+    @param limit    The largest number of keys to add to out.
+    @param out      The vector to which the keys are appended.
+    @return The number of keys appended. */
+    template <class Probe> size_t scan(const Probe& from, size_t limit, std::vector<KeyType>& out)
+    {
+        guard<leaf_page> leaf;
+        int position;
+        size_t copied = 0;
+        if (!seek(from, leaf, position))
+            return 0;
+        while (copied < limit)
+        {
+            for (; position < leaf->NumberOfValidKeys && copied < limit; position++, copied++)
+                out.push_back(leaf->key_array[position]);
+            page_id next = leaf->next_leaf;
+            if (next == 0)
+                break;
+            leaf = guard<leaf_page>(file, next);
+            position = 0;
+        }
+        return copied;
+    }
+
+/// Function to write every change to the tree back to the disk, and wait until it is there.
+    void sync()
+    {
+        file.sync();
+    }
+
+/// Number of keys in the tree.
+    size_t size() const
+    {
+        return file.superblock()->key_count;
+    }
+
+/// Function to look at the storage of the tree, for its size, the number of pages in use and, for a buffer pool, its hits and misses.
+    const Storage& storage() const
+    {
+        return file;
+    }
+
+private:
+/// Function to create a page of the given type in a page of the file.
+/** @return A guard of the new page, taken for writing. */
+    template <class Node> guard<Node> new_page(int level)
+    {
+        guard<Node> created(file, file.allocate(), true);
+        new (created.get()) Node();
+        created->level = level;
+        return created;
+    }
+
+/// Function to go down from the root to the leaf where a key belongs. Every page is unpinned as soon as its child is known.
+/** @param probe    The key (or probe) to go down to.
+    @param upper    Whether to take, in every inner page, the child left of the first separator larger than the probe (where an insertion goes) rather than not smaller.
+    @param path     Filled with the inner pages passed and the child taken in each.
+    @return The leaf reached, pinned. */
+    template <class Probe> guard<leaf_page> descend(const Probe& probe, bool upper, page_path& path)
+    {
+        guard<Page_header> current(file, file.superblock()->root);
+        path.depth = 0;
+        while (current->level != 0)
+        {
+            const inner_page* inner = (const inner_page*)current.get();
+            int position = upper ? tree_type::upper_index(inner, probe) : tree_type::lower_index(inner, probe);
+            path.pages[path.depth] = current.id();
+            path.slots[path.depth] = position;
+            path.depth++;
+            current = guard<Page_header>(file, inner->children_array[position]);
+        }
+        return guard<leaf_page>(std::move(current));
+    }
+
+/// Function to find the first key not smaller than a probe, as a leaf and a position in it.
+/** @return Whether there is such a key. If there is, leaf holds its leaf, pinned. */
+    template <class Probe> bool seek(const Probe& probe, guard<leaf_page>& leaf, int& position)
+    {
+        if (file.superblock()->root == 0)
+            return false;
+        page_path path;
+        leaf = descend(probe, false, path);
+        position = tree_type::lower_index(leaf.get(), probe);
+        if (position == leaf->NumberOfValidKeys) // every key of the leaf is smaller, so the bound is the first key of the next leaf.
+        {
+            page_id next = leaf->next_leaf;
+            if (next == 0)
+                return false;
+            leaf = guard<leaf_page>(file, next);
+            position = 0;
+        }
+        return true;
+    }
+
+/// Function to move a path to the leaf before the one it leads to: up to the lowest page where the path did not take the first child, then down the rightmost children.
+/** @return Whether there is a leaf before. If there is, leaf holds it and path leads to it. */
+    bool step_back(page_path& path, guard<leaf_page>& leaf)
+    {
+        int level = path.depth - 1;
+        while (level >= 0 && path.slots[level] == 0)
+            level--;
+        if (level < 0)
+            return false;
+        path.slots[level]--;
+        guard<Page_header> current(file, guard<inner_page>(file, path.pages[level])->children_array[path.slots[level]]);
+        path.depth = level + 1;
+        while (current->level != 0)
+        {
+            const inner_page* inner = (const inner_page*)current.get();
+            path.pages[path.depth] = current.id();
+            path.slots[path.depth] = inner->NumberOfValidKeys;
+            path.depth++;
+            current = guard<Page_header>(file, inner->children_array[inner->NumberOfValidKeys]);
+        }
+        leaf = guard<leaf_page>(std::move(current));
+        return true;
+    }
+
+/// Function to split a leaf which has used its buffer space in two, and to add the new leaf to its parent, splitting the pages above as far as needed.
+    void split_leaf(guard<leaf_page>& leaf, page_path& path)
+    {
+        Page_superblock* super = file.superblock();
+        guard<leaf_page> right = new_page<leaf_page>(0);
+        int break_point = (leaf_capacity + 1) / 2;
+        for (int i = break_point; i < leaf->NumberOfValidKeys; i++)
+            tree_type::copy_entry(right.get(), i - break_point, leaf.get(), i);
+        right->NumberOfValidKeys = leaf->NumberOfValidKeys - break_point;
+        leaf->NumberOfValidKeys = break_point;
+        right->next_leaf = leaf->next_leaf;
+        right->prev_leaf = leaf.id();
+        if (leaf->next_leaf != 0)
+            guard<leaf_page>(file, leaf->next_leaf, true)->prev_leaf = right.id();
+        else
+            super->last_leaf = right.id();
+        leaf->next_leaf = right.id();
+        KeyType separator = right->key_array[0];
+        page_id added = right.id();
+        leaf.release();
+        right.release();
+        while (path.depth > 0) // add the separator and the new page to the parent, which may have to be split in turn.
+        {
+            path.depth--;
+            guard<inner_page> parent(file, path.pages[path.depth], true);
+            int position = path.slots[path.depth];
+            for (int i = parent->NumberOfValidKeys - 1; i >= position; i--)
+                tree_type::copy_entry(parent.get(), i + 1, parent.get(), i);
+            for (int i = parent->NumberOfValidKeys; i > position; i--)
+                parent->children_array[i + 1] = parent->children_array[i];
+            tree_type::set_key(parent.get(), position, separator);
+            parent->children_array[position + 1] = added;
+            parent->NumberOfValidKeys++;
+            if (parent->NumberOfValidKeys <= inner_capacity)
+                return;
+            guard<inner_page> sibling = new_page<inner_page>(parent->level);
+            break_point = (inner_capacity + 1) / 2;
+            separator = parent->key_array[break_point - 1]; // it goes up, and is kept by neither of the two pages.
+            for (int i = break_point; i < parent->NumberOfValidKeys; i++)
+                tree_type::copy_entry(sibling.get(), i - break_point, parent.get(), i);
+            for (int i = break_point; i <= parent->NumberOfValidKeys; i++)
+                sibling->children_array[i - break_point] = parent->children_array[i];
+            sibling->NumberOfValidKeys = parent->NumberOfValidKeys - break_point;
+            parent->NumberOfValidKeys = break_point - 1;
+            added = sibling.id();
+        }
+        page_id old_root = super->root; // the root was split, so the tree grows a level.
+        int old_level = guard<Page_header>(file, old_root)->level;
+        guard<inner_page> fresh = new_page<inner_page>(old_level + 1);
+        fresh->children_array[0] = old_root;
+        fresh->children_array[1] = added;
+        tree_type::set_key(fresh.get(), 0, separator);
+        fresh->NumberOfValidKeys = 1;
+        super->root = fresh.id();
+    }
+
+/// Function to give back the page of a leaf left without keys, unlinking it from the list of leaves and taking it out of the pages above.
+    void release_leaf(guard<leaf_page>& leaf, page_path& path)
+    {
+        Page_superblock* super = file.superblock();
+        if (leaf->prev_leaf != 0)
+            guard<leaf_page>(file, leaf->prev_leaf, true)->next_leaf = leaf->next_leaf;
+        else
+            super->first_leaf = leaf->next_leaf;
+        if (leaf->next_leaf != 0)
+            guard<leaf_page>(file, leaf->next_leaf, true)->prev_leaf = leaf->prev_leaf;
+        else
+            super->last_leaf = leaf->prev_leaf;
+        page_id current = leaf.id();
+        leaf.release();
+        file.free(current);
+        while (path.depth > 0) // take the child out of its parent. A parent left without children goes as well.
+        {
+            path.depth--;
+            guard<inner_page> parent(file, path.pages[path.depth], true);
+            if (parent->NumberOfValidKeys == 0)
+            {
+                parent.release();
+                file.free(path.pages[path.depth]);
+                continue;
+            }
+            int position = path.slots[path.depth];
+            int removed_key = position == 0 ? 0 : position - 1; // the separator in front of the child goes with it, or the one after it for the first child.
+            for (int i = removed_key + 1; i < parent->NumberOfValidKeys; i++)
+                tree_type::copy_entry(parent.get(), i - 1, parent.get(), i);
+            for (int i = position + 1; i <= parent->NumberOfValidKeys; i++)
+                parent->children_array[i - 1] = parent->children_array[i];
+            parent->NumberOfValidKeys--;
+            parent.release();
+            while (true) // a root with a single child is replaced by it.
+            {
+                guard<inner_page> root(file, super->root);
+                if (root->level == 0 || root->NumberOfValidKeys != 0)
+                    break;
+                page_id old_root = super->root;
+                super->root = root->children_array[0];
+                root.release();
+                file.free(old_root);
+            }
+            return;
+        }
+        super->root = 0; // the last leaf is gone, the tree is empty.
+    }
+};
+
+/// When a commit to a Write_ahead_log waits for its records to be on the disk.
+enum class Fsync_policy
+{
+    per_commit, /**< Every commit writes the log and calls fdatasync itself. Safe and slow: one disk flush per change. */
+    grouped, /**< A commit waits until its records are on the disk, but commits which arrive while a flush is running share the next flush (group commit). */
+    async /**< A commit returns at once. The log is flushed in the background every WAL_FLUSH_INTERVAL_MS, so a crash loses at most the changes of that interval. */
+};
+
+/// Function to compute the FNV-1a hash of some bytes, going on from the hash of the bytes before them. Used to detect records and checkpoints which were torn by a crash.
+inline uint64_t fnv1a(const void* data, size_t bytes, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char* byte = (const unsigned char*)data;
+    for (size_t i = 0; i < bytes; i++)
+        hash = (hash ^ byte[i]) * 1099511628211ull;
+    return hash;
+}
+
+/// Function to write all the given bytes to a file at its current offset, or throw a runtime_error.
+inline void write_fully(int fd, const char* data, size_t bytes)
+{
+    while (bytes > 0)
+    {
+        ssize_t written = write(fd, data, bytes);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            throw std::runtime_error(std::string("Cannot write to the log: ") + strerror(errno));
+        data += written;
+        bytes -= written;
+    }
+}
+
+/// Function to read a whole file into memory.
+inline std::vector<char> read_file(int fd)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+        throw std::runtime_error(std::string("Cannot read the size of a file: ") + strerror(errno));
+    std::vector<char> contents(info.st_size);
+    size_t done = 0;
+    while (done < contents.size())
+    {
+        ssize_t got = pread(fd, contents.data() + done, contents.size() - done, done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            throw std::runtime_error(std::string("Cannot read a file: ") + strerror(errno));
+        done += got;
+    }
+    return contents;
+}
+
+/// Function to make a rename or a new file in the directory of path durable, by syncing the directory.
+inline void sync_directory_of(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error(std::string("Cannot open the directory ") + directory + ": " + strerror(errno));
+    int result = fsync(fd);
+    close(fd);
+    if (result != 0)
+        throw std::runtime_error(std::string("Cannot sync the directory ") + directory + ": " + strerror(errno));
+}
+
+
+/// A write-ahead log of records in a file, with group commit.
+/** Every record gets a log sequence number (LSN), one more than the record before, and is appended to a buffer in memory. A commit makes the records up to its own durable: one
+    thread (the leader) takes the whole buffer, writes it and calls fdatasync, while the threads committing meanwhile append to a new buffer and wait. When the flush is done, all
+    threads whose records it held return, and one of the others leads the next flush, of everything gathered in the meantime. Under load, one flush thus serves as many commits
+    as arrive during a flush, and the cost of a flush is shared by all of them. How long a commit waits is set by the Fsync_policy.
+    A record is a header (LSN, checksum, kind and size) followed by its payload. Its meaning is up to the user of the log. On opening, replay reads the log back and stops at the
+    first record whose checksum does not match, which is where a crash tore the tail of the log; the torn tail is cut off. Once the changes of the records before some LSN are
+    stored elsewhere (by a checkpoint), truncate_before drops those records from the file.
+    A flush which fails to write cuts what it wrote off the file again and puts its records back in front of the buffer, so that the next flush writes them in order. If
+    fdatasync fails, or the file cannot be cut, the log is failed: the kernel may have dropped the pages written, so whether the records are on the disk cannot be known, and
+    every later commit and flush throws. */
+class Write_ahead_log
+{
+private:
+    /// The header of a record in the file.
+    struct record_header
+    {
+        uint64_t lsn; /**< Sequence number of the record. */
+        uint64_t checksum; /**< FNV-1a of the other fields and the payload. */
+        uint32_t kind; /**< Kind of the record, given by the user of the log. */
+        uint32_t bytes; /**< Size of the payload which follows. */
+    };
+
+    std::string path; /**< Path of the log file. */
+    int fd; /**< The log file, open for appending. */
+    Fsync_policy policy; /**< When commits wait for the disk. */
+    std::mutex lock; /**< Protects everything below. */
+    std::condition_variable flushed; /**< Signalled at the end of every flush. */
+    std::vector<char> buffer; /**< Records appended and not written yet. */
+    std::vector<char> writing; /**< Records being written by the current flush. */
+    uint64_t next_lsn; /**< LSN of the next record appended. */
+    uint64_t durable_lsn; /**< Every record with a smaller LSN is on the disk. */
+    bool flushing; /**< Whether a thread is writing and flushing the log. */
+    size_t file_bytes; /**< Bytes in the file, and being written to it. */
+    size_t flush_count; /**< Number of times the log was flushed to the disk. */
+    size_t record_count; /**< Number of records appended since the log was opened. */
+    std::string failure; /**< Why the log cannot be written anymore, or empty. */
+
+public:
+    /** Constructor for the log. It opens the log file, creating it if needed. Call replay before appending records.
+    @param file     Path of the log file.
+    @param when     When commits wait for their records to be on the disk. */
+    Write_ahead_log(const std::string& file, Fsync_policy when = Fsync_policy::grouped) : path(file), policy(when)
+    {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open the log " + path + ": " + strerror(errno));
+        next_lsn = 1;
+        durable_lsn = 1;
+        flushing = false;
+        file_bytes = 0;
+        flush_count = 0;
+        record_count = 0;
+    }
+
+    /** Destructor for the log. It writes the records not written yet and flushes them to the disk. */
+    ~Write_ahead_log()
+    {
+        try
+        {
+            flush();
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+        close(fd);
+    }
+
+    Write_ahead_log(const Write_ahead_log&) = delete;
+    Write_ahead_log& operator=(const Write_ahead_log&) = delete;
+
+    /// Function to read the records in the log file back, in order, cutting off a tail torn by a crash.
+    /** @param from     LSN of the first record to hand to apply. Records before it were already applied (by a checkpoint) and are skipped.
+        @param apply    Called as apply(kind, payload, bytes) for every record from the LSN from on.
+        @return The number of records handed to apply. */
+    template <class Apply> size_t replay(uint64_t from, Apply apply)
+    {
+        std::vector<char> contents = read_file(fd);
+        size_t offset = 0;
+        size_t applied = 0;
+        next_lsn = from;
+        record_header header;
+        while (read_record(contents, offset, header))
+        {
+            if (header.lsn >= from)
+            {
+                apply(header.kind, contents.data() + offset + sizeof(record_header), (size_t)header.bytes);
+                applied++;
+            }
+            next_lsn = std::max(next_lsn, header.lsn + 1);
+            offset += sizeof(record_header) + header.bytes;
+        }
+        if (offset < contents.size() && ftruncate(fd, offset) != 0)
+            throw std::runtime_error("Cannot cut the torn tail off the log " + path + ": " + strerror(errno));
+        durable_lsn = next_lsn;
+        file_bytes = offset;
+        return applied;
+    }
+
+    /// Function to append a record to the log. It is not durable before a commit of its LSN (or a later one) returns.
+    /** @return The LSN of the record. */
+    uint64_t append(uint32_t kind, const void* payload, size_t bytes)
+    {
+        record_header header;
+        header.kind = kind;
+        header.bytes = (uint32_t)bytes;
+        std::lock_guard<std::mutex> guard(lock);
+        header.lsn = next_lsn++;
+        header.checksum = 0;
+        header.checksum = fnv1a(payload, bytes, fnv1a(&header, sizeof(header)));
+        buffer.insert(buffer.end(), (const char*)&header, (const char*)(&header + 1));
+        buffer.insert(buffer.end(), (const char*)payload, (const char*)payload + bytes);
+        record_count++;
+        return header.lsn;
+    }
+
+    /// Function to wait, as the Fsync_policy says, until the record with the given LSN and all records before it are on the disk.
+    void commit(uint64_t lsn)
+    {
+        if (policy == Fsync_policy::async)
+            return;
+        std::unique_lock<std::mutex> guard(lock);
+        if (policy == Fsync_policy::per_commit)
+        {
+            while (flushing)
+                flushed.wait(guard);
+            write_out(guard);
+            return;
+        }
+        while (durable_lsn <= lsn)
+        {
+            if (flushing)
+                flushed.wait(guard);
+            else
+                write_out(guard);
+        }
+    }
+
+    /// Function to write every record appended so far to the disk, and wait until they are there.
+    void flush()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (flushing)
+            flushed.wait(guard);
+        if (!failure.empty())
+            throw std::runtime_error(failure);
+        if (durable_lsn < next_lsn)
+            write_out(guard);
+    }
+
+    /// Function to drop the records before an LSN from the log file, once their changes are stored elsewhere.
+    /** The records from the LSN on are copied to a new file, which replaces the log file atomically, so that a crash leaves either log whole. Appends wait meanwhile; the records
+        kept are those appended since the checkpoint began, which are few. */
+    void truncate_before(uint64_t lsn)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (flushing)
+            flushed.wait(guard);
+        write_out(guard);
+        std::vector<char> contents = read_file(fd);
+        size_t offset = 0;
+        size_t kept = 0;
+        record_header header;
+        while (read_record(contents, offset, header))
+        {
+            size_t bytes = sizeof(record_header) + header.bytes;
+            if (header.lsn >= lsn)
+            {
+                memmove(contents.data() + kept, contents.data() + offset, bytes);
+                kept += bytes;
+            }
+            offset += bytes;
+        }
+        std::string fresh_path = path + ".tmp";
+        int fresh = open(fresh_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (fresh < 0)
+            throw std::runtime_error("Cannot create the log " + fresh_path + ": " + strerror(errno));
+        try
+        {
+            write_fully(fresh, contents.data(), kept);
+            if (fdatasync(fresh) != 0 || rename(fresh_path.c_str(), path.c_str()) != 0)
+                throw std::runtime_error("Cannot replace the log " + path + ": " + strerror(errno));
+            sync_directory_of(path);
+        }
+        catch (const std::runtime_error&)
+        {
+            close(fresh);
+            unlink(fresh_path.c_str());
+            throw;
+        }
+        close(fd);
+        fd = fresh;
+        file_bytes = kept;
+    }
+
+    uint64_t next() { std::lock_guard<std::mutex> guard(lock); return next_lsn; } /**< LSN which the next record appended will get. */
+    size_t bytes() { std::lock_guard<std::mutex> guard(lock); return file_bytes + buffer.size(); } /**< Size of the log, including the records not written yet. */
+    size_t flushes() { std::lock_guard<std::mutex> guard(lock); return flush_count; } /**< Number of flushes to the disk so far. */
+    size_t records() { std::lock_guard<std::mutex> guard(lock); return record_count; } /**< Number of records appended since the log was opened. */
+    Fsync_policy fsync_policy() const { return policy; } /**< When commits wait for the disk. */
+
+private:
+    /// Function to check the record at an offset of the log read into memory.
+    /** @return Whether there is a whole record with a matching checksum there. If there is, header holds its header. */
+    static bool read_record(const std::vector<char>& contents, size_t offset, record_header& header)
+    {
+        if (contents.size() - offset < sizeof(record_header))
+            return false;
+        memcpy(&header, contents.data() + offset, sizeof(record_header));
+        if (contents.size() - offset - sizeof(record_header) < header.bytes)
+            return false;
+        uint64_t stored = header.checksum;
+        header.checksum = 0;
+        uint64_t computed = fnv1a(contents.data() + offset + sizeof(record_header), header.bytes, fnv1a(&header, sizeof(header)));
+        header.checksum = stored;
+        return stored == computed;
+    }
+
+    /// Function to lead a flush: write the buffer and flush it to the disk, with the lock released meanwhile so that other threads keep appending. The lock is held again after.
+    /** If the flush fails, the file is cut back to where it began and its records go back in front of the buffer, or the log is failed (see the class). Throws either way. */
+    void write_out(std::unique_lock<std::mutex>& guard)
+    {
+        if (!failure.empty())
+            throw std::runtime_error(failure);
+        flushing = true;
+        writing.swap(buffer);
+        uint64_t upto = next_lsn;
+        size_t start = file_bytes;
+        file_bytes += writing.size();
+        guard.unlock();
+        bool written = false, synced = false, cut = false;
+        std::string reason;
+        try
+        {
+            write_fully(fd, writing.data(), writing.size());
+            written = true;
+            if (fdatasync(fd) != 0)
+                throw std::runtime_error(std::string("Cannot flush the log: ") + strerror(errno));
+            synced = true;
+        }
+        catch (const std::runtime_error& error)
+        {
+            reason = error.what();
+            cut = ftruncate(fd, start) == 0; // a record written in part would end the log on replay, and cut off every record written after it.
+            if (!cut)
+                reason += std::string("; cannot cut it off the log: ") + strerror(errno);
+        }
+        guard.lock();
+        if (synced)
+        {
+            durable_lsn = upto;
+            flush_count++;
+            writing.clear();
+        }
+        else
+        {
+            writing.insert(writing.end(), buffer.begin(), buffer.end());
+            buffer.swap(writing);
+            writing.clear();
+            file_bytes = start;
+            if (written || !cut)
+                failure = reason;
+        }
+        flushing = false;
+        flushed.notify_all();
+        if (!synced)
+            throw std::runtime_error(reason);
+    }
+};
+
+
+/// A BTree whose inserts and deletes survive a crash, through a write-ahead log and checkpoints.
+/** Every add_key and delete_key is applied to an in-memory BTree and logged as a logical record holding the key, and returns once the record is durable, as the Fsync_policy of the
+    log says. With the grouped policy, the records of all threads committing at the same time go to the disk in one flush, so that many inserts share one fdatasync.
+    Checkpoints bound the log and the time to recover. A checkpoint is fuzzy: it takes a snapshot of the tree (see BTree::take_snapshot), which is O(1), and writes the keys of
+    the snapshot to a new checkpoint file while inserts and deletes go on. The checkpoint remembers the LSN of the first record not in the snapshot, and once it is on the disk the
+    records before that LSN are dropped from the log. A checkpoint is taken by checkpoint(), and by a background thread whenever the log grows past checkpoint_bytes.
+    Opening a DurableBTree recovers it: the keys of the last checkpoint are bulk loaded, and the records of the log after it are applied again.
+    The tree may be used from many threads; changes to it and reads of it are serialised by a mutex, only waiting for the disk happens in parallel. A change is visible to reads
+    before it is durable. Keys are copied to the log and checkpoints byte by byte, so they have to be trivially copyable. */
+template <class KeyType, size_t NodeSize = BLOCK_SIZE, class Traits = key_traits<KeyType> > class DurableBTree
+{
+public:
+    typedef BTree<KeyType, NodeSize, Traits> tree_type;
+
+    static_assert(std::is_trivially_copyable<KeyType>::value, "Keys are copied to a log and checkpoint files, so they have to be trivially copyable.");
+
+private:
+    /// The kinds of records in the log.
+    enum record_kind : uint32_t
+    {
+        insert_record = 1,
+        delete_record = 2
+    };
+
+    /// The header at the start of a checkpoint file, which the keys follow in order.
+    struct checkpoint_header
+    {
+        uint64_t magic; /**< CHECKPOINT_MAGIC. */
+        uint64_t key_size; /**< Size of the keys, to refuse checkpoints of another key type. */
+        uint64_t lsn; /**< LSN of the first record of the log whose change is not in the checkpoint. */
+        uint64_t count; /**< Number of keys. */
+        uint64_t checksum; /**< FNV-1a of the keys. */
+    };
+
+    tree_type tree; /**< The keys. */
+    std::mutex tree_lock; /**< Serialises the changes to the tree and the reads of it. */
+    Write_ahead_log log; /**< The log of the changes since the last checkpoint. */
+    std::string checkpoint_path; /**< Path of the checkpoint file. */
+    std::mutex checkpoint_lock; /**< Lets one checkpoint be taken at a time. */
+    size_t checkpoint_bytes; /**< Size of the log beyond which the background thread takes a checkpoint. */
+    size_t checkpoint_count; /**< Number of checkpoints taken. Protected by checkpoint_lock. */
+    std::thread background; /**< Flushes the log of the async policy, and takes checkpoints. */
+    std::mutex background_lock; /**< Protects stopping and failure. */
+    std::condition_variable wake; /**< Wakes the background thread up to stop. */
+    bool stopping; /**< Whether the background thread has to stop. */
+    std::string failure; /**< Error of the background thread, if any, reported by the next sync. */
+
+public:
+    /** Constructor for the DurableBTree. It opens the tree stored at the given path, recovering it from its last checkpoint and its log, or creates an empty tree there.
+    @param path             Prefix of the paths of the files of the tree: the log is path.wal, the checkpoint path.ckpt.
+    @param when             When inserts and deletes wait for their log records to be on the disk.
+    @param checkpoint_after Size of the log in bytes beyond which a checkpoint is taken in the background. */
+    DurableBTree(const std::string& path, Fsync_policy when = Fsync_policy::grouped, size_t checkpoint_after = CHECKPOINT_LOG_BYTES)
+        : log(path + ".wal", when), checkpoint_path(path + ".ckpt")
+    {
+        checkpoint_bytes = checkpoint_after;
+        checkpoint_count = 0;
+        stopping = false;
+        recover();
+        background = std::thread(&DurableBTree::run_background, this);
+    }
+
+    /** Destructor for the DurableBTree. It stops the background thread and flushes the log. */
+    ~DurableBTree()
+    {
+        {
+            std::lock_guard<std::mutex> guard(background_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        background.join();
+    }
+
+    DurableBTree(const DurableBTree&) = delete;
+    DurableBTree& operator=(const DurableBTree&) = delete;
+
+/// Function to add a key in the tree. It returns once the change is durable, as the Fsync_policy says.
+    void add_key(KeyType* toInsert)
+    {
+        uint64_t lsn;
+        {
+            std::lock_guard<std::mutex> guard(tree_lock);
+            tree.add_key(toInsert);
+            lsn = log.append(insert_record, toInsert, sizeof(KeyType));
+        }
+        log.commit(lsn);
+    }
+
+/// Function to remove a key matching the given one. It returns once the change is durable, as the Fsync_policy says.
+/** @return Whether a matching key was found and removed. */
+    bool delete_key(KeyType* toDelete)
+    {
+        uint64_t lsn;
+        {
+            std::lock_guard<std::mutex> guard(tree_lock);
+            if (!tree.delete_key(toDelete))
+                return false;
+            lsn = log.append(delete_record, toDelete, sizeof(KeyType));
+        }
+        log.commit(lsn);
+        return true;
+    }
+
+/// Function to look for a key matching a probe.
+/** @param probe    A key, or any probe which the key traits can compare keys with.
+    @param result   Set to a copy of the first key matching the probe, if there is one.
+    @return Whether a matching key was found. */
+    template <class Probe> bool find(const Probe& probe, KeyType& result)
+    {
+        std::lock_guard<std::mutex> guard(tree_lock);
+        typename tree_type::iterator found = tree.find(probe);
+        if (found == tree.end())
+            return false;
+        result = *found;
+        return true;
+    }
+
+/// Number of keys in the tree.
+    size_t size()
+    {
+        std::lock_guard<std::mutex> guard(tree_lock);
+        return tree.size();
+    }
+
+/// Function to make every change so far durable, whatever the Fsync_policy. Throws the error of a failed background checkpoint, if there was one.
+    void sync()
+    {
+        log.flush();
+        std::lock_guard<std::mutex> guard(background_lock);
+        if (!failure.empty())
+        {
+            std::string reason = failure;
+            failure.clear();
+            throw std::runtime_error(reason);
+        }
+    }
+
+/// Function to take a fuzzy checkpoint: write the keys of a snapshot of the tree to a new checkpoint file, and drop the records before the snapshot from the log.
+/** Inserts and deletes go on while the checkpoint is written. The new checkpoint replaces the old one atomically, so that a crash at any point leaves a checkpoint and a log
+    which recover the tree. */
+    void checkpoint()
+    {
+        std::lock_guard<std::mutex> one_at_a_time(checkpoint_lock);
+        typename tree_type::snapshot view;
+        checkpoint_header header;
+        {
+            std::lock_guard<std::mutex> guard(tree_lock);
+            view = tree.take_snapshot();
+            header.lsn = log.next(); // appends happen under tree_lock, so the snapshot holds exactly the changes of the records before this LSN.
+        }
+        header.magic = CHECKPOINT_MAGIC;
+        header.key_size = sizeof(KeyType);
+        header.count = 0;
+        header.checksum = fnv1a(NULL, 0);
+        std::string fresh_path = checkpoint_path + ".tmp";
+        int fd = open(fresh_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Cannot create the checkpoint " + fresh_path + ": " + strerror(errno));
+        try
+        {
+            std::vector<char> chunk((const char*)&header, (const char*)(&header + 1)); // written again at the end, with the count and checksum.
+            for (typename tree_type::snapshot::iterator it = view.begin(); it != view.end(); ++it)
+            {
+                chunk.insert(chunk.end(), (const char*)&*it, (const char*)(&*it + 1));
+                header.checksum = fnv1a(&*it, sizeof(KeyType), header.checksum);
+                header.count++;
+                if (chunk.size() >= (1 << 20))
+                {
+                    write_fully(fd, chunk.data(), chunk.size());
+                    chunk.clear();
+                }
+            }
+            view.release();
+            write_fully(fd, chunk.data(), chunk.size());
+            if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+                throw std::runtime_error("Cannot write the checkpoint " + fresh_path + ": " + strerror(errno));
+            if (fdatasync(fd) != 0 || rename(fresh_path.c_str(), checkpoint_path.c_str()) != 0)
+                throw std::runtime_error("Cannot replace the checkpoint " + checkpoint_path + ": " + strerror(errno));
+            sync_directory_of(checkpoint_path);
+        }
+        catch (const std::runtime_error&)
+        {
+            close(fd);
+            unlink(fresh_path.c_str());
+            throw;
+        }
+        close(fd);
+        log.truncate_before(header.lsn);
+        checkpoint_count++;
+    }
+
+/// Number of checkpoints taken since the tree was opened.
+    size_t checkpoints()
+    {
+        std::lock_guard<std::mutex> guard(checkpoint_lock);
+        return checkpoint_count;
+    }
+
+/// Function to look at the log of the tree, for its size and the number of records and flushes.
+    Write_ahead_log& write_ahead_log()
+    {
+        return log;
+    }
+
+private:
+/// Function to rebuild the tree from the checkpoint file and the log.
+    void recover()
+    {
+        uint64_t from = load_checkpoint();
+        log.replay(from, [this](uint32_t kind, const char* payload, size_t bytes)
+        {
+            KeyType key;
+            if (bytes != sizeof(KeyType))
+                throw std::runtime_error("The log holds records of another key type.");
+            memcpy(&key, payload, sizeof(KeyType));
+            if (kind == insert_record)
+                tree.add_key(&key);
+            else if (kind == delete_record)
+                tree.delete_key(&key);
+        });
+    }
+
+/// Function to bulk load the keys of the checkpoint file, if there is one.
+/** @return The LSN of the first record of the log which is not in the checkpoint. */
+    uint64_t load_checkpoint()
+    {
+        int fd = open(checkpoint_path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            if (errno == ENOENT)
+                return 1;
+            throw std::runtime_error("Cannot open the checkpoint " + checkpoint_path + ": " + strerror(errno));
+        }
+        std::vector<char> contents;
+        try
+        {
+            contents = read_file(fd);
+        }
+        catch (const std::runtime_error&)
+        {
+            close(fd);
+            throw;
+        }
+        close(fd);
+        checkpoint_header header;
+        if (contents.size() < sizeof(header))
+            throw std::runtime_error("The checkpoint " + checkpoint_path + " is too short.");
+        memcpy(&header, contents.data(), sizeof(header));
+        if (header.magic != CHECKPOINT_MAGIC || header.key_size != sizeof(KeyType) || contents.size() != sizeof(header) + header.count * sizeof(KeyType)
+            || fnv1a(contents.data() + sizeof(header), header.count * sizeof(KeyType)) != header.checksum)
+            throw std::runtime_error("The checkpoint " + checkpoint_path + " is damaged or holds keys of another type.");
+        std::vector<KeyType> keys(header.count);
+        if (header.count != 0)
+            memcpy((void*)keys.data(), contents.data() + sizeof(header), header.count * sizeof(KeyType));
+        tree.bulk_load(keys.begin(), keys.end());
+        return header.lsn;
+    }
+
+/// The loop of the background thread: every WAL_FLUSH_INTERVAL_MS, flush the log of the async policy and take a checkpoint if the log has grown too large.
+    void run_background()
+    {
+        std::unique_lock<std::mutex> guard(background_lock);
+        while (!stopping)
+        {
+            wake.wait_for(guard, std::chrono::milliseconds(WAL_FLUSH_INTERVAL_MS));
+            if (stopping)
+                break;
+            guard.unlock();
+            std::string error;
+            try
+            {
+                if (log.fsync_policy() == Fsync_policy::async)
+                    log.flush();
+                if (log.bytes() >= checkpoint_bytes)
+                    checkpoint();
+            }
+            catch (const std::runtime_error& caught)
+            {
+                error = caught.what();
+            }
+            guard.lock();
+            if (!error.empty())
+                failure = error;
+        }
+    }
+};
+
+#endif // BTREE_H
@@ -0,0 +1,1173 @@
+/** @file btree_tests.cc
+    @brief Tests of the trees in btree.h. Every tree is checked against a std::multiset holding the same keys. Each group of tests can be run on its own by naming it
+    on the command line, which is how ctest runs them; without arguments every group runs.
+
+    @author Utkarsh Sharma
+*/
+
+#include "btree.h"
+
+#include <map>
+#include <set>
+#include <random>
+#include <tuple>
+#include <csignal>
+#include <sys/resource.h>
+
+using namespace std;
+
+static int failures = 0; /**< Number of checks which failed so far. */
+
+#define CHECK(condition) do { if (!(condition)) { cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << endl; failures++; } } while (0)
+
+typedef tuple<int, int, int> key_tuple; /**< A key as (w_id, d_id, cust_id), which orders keys exactly like the trees do. */
+
+primary_key make_key(int w_id, int d_id, int cust_id)
+{
+    primary_key key;
+    key.valid = true;
+    key.w_id = w_id;
+    key.d_id = d_id;
+    key.cust_id = cust_id;
+    return key;
+}
+
+key_tuple as_tuple(const primary_key& key)
+{
+    return key_tuple(key.w_id, key.d_id, key.cust_id);
+}
+
+/// Function which returns a path for a scratch file of a test, in the directory given by TMPDIR.
+string scratch_path(const char* name)
+{
+    const char* directory = getenv("TMPDIR");
+    return string(directory != NULL ? directory : "/tmp") + "/btree_tests_" + to_string(getpid()) + "_" + name;
+}
+
+/// Function to check that iterating over a tree, forwards and backwards, visits the same keys as iterating over the reference set.
+template <class Tree> void check_same_keys(const Tree& tree, const multiset<key_tuple>& reference)
+{
+    CHECK(tree.size() == reference.size());
+    vector<key_tuple> forward, backward;
+    for (typename Tree::iterator it = tree.begin(); it != tree.end(); ++it)
+        forward.push_back(as_tuple(*it));
+    for (typename Tree::reverse_iterator it = tree.rbegin(); it != tree.rend(); ++it)
+        backward.push_back(as_tuple(*it));
+    CHECK(forward == vector<key_tuple>(reference.begin(), reference.end()));
+    CHECK(backward == vector<key_tuple>(reference.rbegin(), reference.rend()));
+}
+
+/// Random inserts, deletes and lookups on a tree with small nodes, eagerly and lazily deleting.
+void test_btree()
+{
+    for (int lazy = 0; lazy < 2; lazy++)
+    {
+        mt19937 random(lazy + 1);
+        BTree<primary_key, 256> tree;
+        tree.set_lazy_delete(lazy != 0);
+        multiset<key_tuple> reference;
+        for (int i = 0; i < 60000; i++)
+        {
+            primary_key key = make_key(random() % 3, random() % 4, random() % 2000);
+            int operation = random() % 10;
+            if (operation < 5)
+            {
+                tree.add_key(&key);
+                reference.insert(as_tuple(key));
+            }
+            else if (operation < 8)
+            {
+                multiset<key_tuple>::iterator victim = reference.find(as_tuple(key));
+                bool present = victim != reference.end();
+                if (present)
+                    reference.erase(victim);
+                CHECK(tree.delete_key(&key) == present);
+            }
+            else
+            {
+                BTree<primary_key, 256>::iterator lower = tree.lower_bound(key);
+                multiset<key_tuple>::iterator expected = reference.lower_bound(as_tuple(key));
+                CHECK((lower == tree.end()) == (expected == reference.end()));
+                if (lower != tree.end() && expected != reference.end())
+                    CHECK(as_tuple(*lower) == *expected);
+                CHECK((tree.search_key(&key) != NULL) == (reference.count(as_tuple(key)) != 0));
+            }
+        }
+        check_same_keys(tree, reference);
+        district_prefix district;
+        district.w_id = 1;
+        district.d_id = 2;
+        CHECK((size_t)distance(tree.lower_bound(district), tree.upper_bound(district))
+            == (size_t)distance(reference.lower_bound(key_tuple(1, 2, INT32_MIN)), reference.upper_bound(key_tuple(1, 2, INT32_MAX))));
+        tree.compact();
+        CHECK(tree.tombstones() == 0);
+        check_same_keys(tree, reference);
+        for (multiset<key_tuple>::iterator it = reference.begin(); it != reference.end(); ++it)
+        {
+            primary_key key = make_key(get<0>(*it), get<1>(*it), get<2>(*it));
+            CHECK(tree.delete_key(&key));
+        }
+        CHECK(tree.size() == 0 && tree.begin() == tree.end());
+    }
+}
+
+/// Keys whose fields take values all over the range of an int, negative and wider than the TPC-C ranges, are told apart and ordered by the default traits of primary keys.
+void test_ranges()
+{
+    BTree<primary_key> single;
+    primary_key stored = make_key(0, 256, 5), other = make_key(1, 0, 5);
+    single.add_key(&stored);
+    CHECK(single.search_key(&other) == NULL && single.search_key(&stored) != NULL);
+
+    const int values[] = {INT32_MIN, -256, -1, 0, 1, 10, 255, 256, 1 << 24, (1 << 24) + 1, INT32_MAX};
+    BTree<primary_key, 256> tree;
+    multiset<key_tuple> reference;
+    for (int w : values)
+        for (int d : values)
+            for (int c : {-1, 5})
+            {
+                primary_key key = make_key(w, d, c);
+                tree.add_key(&key);
+                reference.insert(as_tuple(key));
+            }
+    check_same_keys(tree, reference);
+    for (int w : values)
+        for (int d : values)
+        {
+            primary_key key = make_key(w, d, 5), absent = make_key(w, d, 6);
+            CHECK(tree.search_key(&key) != NULL && tree.search_key(&absent) == NULL);
+            warehouse_prefix warehouse;
+            warehouse.w_id = w;
+            CHECK(distance(tree.lower_bound(warehouse), tree.upper_bound(warehouse)) == 2 * (ptrdiff_t)(sizeof(values) / sizeof(values[0])));
+        }
+    tree.set_filter(true);
+    primary_key aliased = make_key(-1, 0, 7);
+    CHECK(tree.search_key(&aliased) == NULL);
+}
+
+/// Batches, bulk loading and multi_get.
+void test_batches()
+{
+    mt19937 random(7);
+    BTree<primary_key, 512> tree;
+    multiset<key_tuple> reference;
+    vector<primary_key> loaded;
+    for (int c = 0; c < 20000; c += 2)
+    {
+        loaded.push_back(make_key(1, 1, c));
+        reference.insert(key_tuple(1, 1, c));
+    }
+    tree.bulk_load(loaded.begin(), loaded.end(), 0.7);
+    check_same_keys(tree, reference);
+    for (int round = 0; round < 10; round++)
+    {
+        vector<primary_key> batch;
+        for (int i = 0; i < 1000; i++)
+            batch.push_back(make_key(1, random() % 2 + 1, random() % 30000));
+        for (size_t i = 0; i < batch.size(); i++)
+            reference.insert(as_tuple(batch[i]));
+        tree.insert_batch(std::move(batch));
+    }
+    check_same_keys(tree, reference);
+    vector<primary_key> upserts;
+    for (int c = 0; c < 40; c++)
+        upserts.push_back(make_key(1, 1, c));
+    tree.upsert_batch(std::move(upserts));
+    for (int c = 0; c < 40; c++)
+        CHECK(tree.find(make_key(1, 1, c)) != tree.end());
+    vector<primary_key> probes;
+    for (int i = 0; i < 5000; i++)
+        probes.push_back(make_key(1, random() % 3, random() % 30000));
+    vector<primary_key*> found = tree.multi_get(probes);
+    CHECK(found.size() == probes.size());
+    for (size_t i = 0; i < probes.size(); i++)
+    {
+        CHECK((found[i] != NULL) == (tree.find(probes[i]) != tree.end()));
+        if (found[i] != NULL)
+            CHECK(as_tuple(*found[i]) == as_tuple(probes[i]));
+    }
+    BTree<primary_key, 512> parallel;
+    vector<primary_key> sorted;
+    for (int c = 0; c < 100000; c++)
+        sorted.push_back(make_key(c / 50000, 0, c));
+    parallel.bulk_load(sorted.begin(), sorted.end(), 1.0, 4);
+    CHECK(parallel.size() == sorted.size());
+    size_t in_order = 0;
+    for (BTree<primary_key, 512>::iterator it = parallel.begin(); it != parallel.end(); ++it, in_order++)
+        if (it->cust_id != (int)in_order)
+            break;
+    CHECK(in_order == sorted.size());
+}
+
+/// Snapshots keep seeing the keys of the tree at the time they were taken, while the tree changes.
+void test_snapshots()
+{
+    BTree<primary_key, 256> tree;
+    for (int c = 0; c < 5000; c++)
+    {
+        primary_key key = make_key(0, 0, c);
+        tree.add_key(&key);
+    }
+    BTree<primary_key, 256>::snapshot before = tree.take_snapshot();
+    for (int c = 0; c < 5000; c += 2)
+    {
+        primary_key key = make_key(0, 0, c);
+        tree.delete_key(&key);
+    }
+    for (int c = 5000; c < 8000; c++)
+    {
+        primary_key key = make_key(0, 0, c);
+        tree.add_key(&key);
+    }
+    size_t seen = 0;
+    bool in_order = true;
+    for (BTree<primary_key, 256>::snapshot::iterator it = before.begin(); it != before.end(); ++it, seen++)
+        in_order = in_order && it->cust_id == (int)seen;
+    CHECK(seen == 5000 && in_order && before.size() == 5000);
+    CHECK(before.find(make_key(0, 0, 2)) != before.end());
+    CHECK(tree.find(make_key(0, 0, 2)) == tree.end());
+    CHECK(tree.size() == 5500);
+    before.release();
+    primary_key key = make_key(0, 0, 1);
+    tree.delete_key(&key);
+    CHECK(tree.snapshot_count() == 0);
+    tree.set_lazy_delete(true, 1.0);
+    BTree<primary_key, 256>::snapshot held = tree.take_snapshot();
+    for (int c = 3; c < 8000; c += 3)
+    {
+        key = make_key(0, 0, c);
+        tree.delete_key(&key);
+    }
+    tree.compact();
+    vector<primary_key> batch;
+    for (int c = 8000; c < 9000; c++)
+        batch.push_back(make_key(0, 0, c));
+    tree.insert_batch(std::move(batch));
+    CHECK((size_t)distance(held.begin(), held.end()) == held.size() && held.size() == 5499);
+    CHECK(held.find(make_key(0, 0, 3)) != held.end() && tree.find(make_key(0, 0, 3)) == tree.end());
+    size_t left = 0;
+    for (BTree<primary_key, 256>::iterator it = tree.begin(); it != tree.end(); ++it, left++)
+        CHECK(it->cust_id % 3 != 0 || it->cust_id >= 8000);
+    CHECK(left == tree.size() && tree.tombstones() == 0);
+}
+
+/// The counters of the tree follow the operations made on it.
+void test_stats()
+{
+    BTree<primary_key, 256> tree;
+    for (int c = 0; c < 3000; c++)
+    {
+        primary_key key = make_key(0, 0, c);
+        tree.add_key(&key);
+    }
+    for (int c = 0; c < 100; c++)
+    {
+        primary_key key = make_key(0, 0, c);
+        tree.search_key(&key);
+    }
+    Tree_stats stats = tree.stats();
+    if (BTREE_STATS)
+    {
+        CHECK(stats.inserts == 3000);
+        CHECK(stats.lookups == 100);
+    }
+    CHECK(stats.keys == 3000);
+    CHECK(stats.height >= 2);
+    CHECK(stats.json().find("\"inserts\"") != string::npos);
+    tree.reset_stats();
+    CHECK(tree.stats().inserts == 0);
+}
+
+/// Keys added in increasing order go to the leaf of the previous insertion without a descent and leave full leaves behind. Runs of several districts which interleave leave
+/// leaves fuller than halves, and random keys never leave a leaf less than half full.
+void test_appends()
+{
+    BTree<primary_key, 512> tree;
+    const int keys = 50000, capacity = BTree<primary_key, 512>::leaf_capacity;
+    for (int c = 0; c < keys; c++)
+    {
+        primary_key key = make_key(0, 0, c);
+        tree.add_key(&key);
+    }
+    Tree_stats stats = tree.stats();
+    CHECK(stats.leaves <= (uint64_t)(keys / capacity + 1));
+    if (BTREE_STATS)
+        CHECK(stats.hinted_inserts > (uint64_t)keys * 9 / 10);
+    int expected = 0;
+    for (BTree<primary_key, 512>::iterator it = tree.begin(); it != tree.end() && it->cust_id == expected; ++it)
+        expected++;
+    CHECK(expected == keys);
+
+    BTree<primary_key, 512> districts; // ten runs, one per district, with duplicates, deletes and a snapshot in between.
+    multiset<key_tuple> reference;
+    mt19937 random(23);
+    vector<int> next(10, 0);
+    BTree<primary_key, 512>::snapshot early;
+    size_t early_keys = 0;
+    for (int i = 0; i < 100000; i++)
+    {
+        int d = random() % 10;
+        primary_key key = make_key(1, d, next[d]++);
+        if (i % 10 == 0 && next[d] > 1)
+            key.cust_id = next[d] - 2;
+        districts.add_key(&key);
+        reference.insert(as_tuple(key));
+        if (i % 97 == 0)
+        {
+            primary_key victim = make_key(1, random() % 10, random() % (next[d] + 1));
+            bool present = reference.count(as_tuple(victim)) != 0;
+            if (present)
+                reference.erase(reference.find(as_tuple(victim)));
+            CHECK(districts.delete_key(&victim) == present);
+        }
+        if (i == 30000)
+        {
+            early = districts.take_snapshot();
+            early_keys = reference.size();
+        }
+    }
+    CHECK(early.size() == early_keys && (size_t)distance(early.begin(), early.end()) == early_keys);
+    early.release();
+    vector<key_tuple> in_tree;
+    for (BTree<primary_key, 512>::iterator it = districts.begin(); it != districts.end(); ++it)
+        in_tree.push_back(as_tuple(*it));
+    CHECK(in_tree == vector<key_tuple>(reference.begin(), reference.end()));
+    CHECK(districts.stats().leaves * capacity < reference.size() * 5 / 3); // the runs fill their leaves more than splitting them in halves would.
+
+    BTree<primary_key, 512> scattered; // no runs: every split is made in the middle, and the halves only grow afterwards.
+    for (int i = 0; i < 100000; i++)
+    {
+        primary_key key = make_key(random() % 10, random() % 10, random());
+        scattered.add_key(&key);
+    }
+    Tree_stats shape = scattered.stats();
+    CHECK(shape.leaves > 1000);
+    for (int tenth = 0; tenth < 5; tenth++)
+        CHECK(shape.leaf_fill[tenth] == 0);
+}
+
+/// freeze in every layout against a std::multiset: the shape of the run, iteration, lookups, bounds, multi_get and parallel_scan on the frozen tree, and changes made to it.
+template <class Traits> void check_frozen()
+{
+    typedef BTree<primary_key, 256, Traits> tree_type;
+    const Frozen_layout layouts[] = { Frozen_layout::breadth_first, Frozen_layout::van_emde_boas, Frozen_layout::implicit };
+    Scan_pool four(4);
+    for (Frozen_layout layout : layouts)
+    {
+        tree_type tree;
+        tree.set_lazy_delete(true, 1.0);
+        multiset<key_tuple> reference;
+        mt19937 random(24);
+        for (int i = 0; i < 20000; i++)
+        {
+            primary_key key = make_key(random() % 4, random() % 10, random() % 1000);
+            tree.add_key(&key);
+            reference.insert(as_tuple(key));
+            if (i % 10 == 0) // leaves tombstones behind.
+            {
+                reference.erase(reference.find(as_tuple(key)));
+                CHECK(tree.delete_key(&key));
+            }
+        }
+        size_t blocks = tree.node_allocator().used_blocks();
+        tree.freeze(layout);
+        CHECK(tree.frozen() == layout);
+        check_same_keys(tree, reference);
+        Tree_stats stats = tree.stats();
+        const int capacity = tree_type::leaf_capacity;
+        CHECK(tree.tombstones() == 0 && stats.height >= 4);
+        CHECK(stats.leaves == (reference.size() + capacity - 1) / capacity);
+        CHECK(tree.node_allocator().used_blocks() == stats.leaves + stats.inner_nodes && tree.node_allocator().used_blocks() < blocks);
+        vector<primary_key> probes;
+        for (int i = 0; i < 3000; i++)
+            probes.push_back(make_key(random() % 5, random() % 10, random() % 1000));
+        vector<primary_key*> found = tree.multi_get(probes);
+        bool same = true;
+        for (size_t i = 0; i < probes.size(); i++)
+        {
+            key_tuple probe = as_tuple(probes[i]);
+            bool present = reference.count(probe) != 0;
+            same = same && (found[i] != NULL) == present && (tree.search_key(&probes[i]) != NULL) == present;
+            typename tree_type::iterator lower = tree.lower_bound(probes[i]), upper = tree.upper_bound(probes[i]);
+            multiset<key_tuple>::iterator expected_lower = reference.lower_bound(probe), expected_upper = reference.upper_bound(probe);
+            same = same && (lower == tree.end() ? expected_lower == reference.end() : expected_lower != reference.end() && as_tuple(*lower) == *expected_lower);
+            same = same && (upper == tree.end() ? expected_upper == reference.end() : expected_upper != reference.end() && as_tuple(*upper) == *expected_upper);
+        }
+        CHECK(same);
+        district_prefix district;
+        district.w_id = 2;
+        district.d_id = 7;
+        pair<typename tree_type::iterator, typename tree_type::iterator> range = tree.equal_range(district);
+        CHECK((size_t)distance(range.first, range.second) == (size_t)distance(reference.lower_bound(key_tuple(2, 7, INT32_MIN)), reference.upper_bound(key_tuple(2, 7, INT32_MAX))));
+        auto predicate = [](const primary_key& key) { return key.cust_id % 7 == 0; };
+        vector<primary_key> scanned = tree.parallel_scan(predicate, SIZE_MAX, four);
+        vector<key_tuple> expected;
+        for (multiset<key_tuple>::iterator it = reference.begin(); it != reference.end(); ++it)
+            if (get<2>(*it) % 7 == 0)
+                expected.push_back(*it);
+        same = scanned.size() == expected.size();
+        for (size_t i = 0; same && i < scanned.size(); i++)
+            same = as_tuple(scanned[i]) == expected[i];
+        CHECK(same);
+        for (int i = 0; i < 5000; i++) // the first change thaws the tree.
+        {
+            primary_key key = make_key(random() % 4, random() % 10, random() % 1000);
+            if (i % 3 == 0)
+            {
+                multiset<key_tuple>::iterator victim = reference.find(as_tuple(key));
+                CHECK(tree.delete_key(&key) == (victim != reference.end()));
+                if (victim != reference.end())
+                    reference.erase(victim);
+            }
+            else
+            {
+                tree.add_key(&key);
+                reference.insert(as_tuple(key));
+            }
+        }
+        CHECK(tree.frozen() == Frozen_layout::none);
+        check_same_keys(tree, reference);
+    }
+    tree_type empty;
+    empty.freeze(Frozen_layout::implicit);
+    CHECK(empty.size() == 0 && empty.begin() == empty.end());
+    primary_key key = make_key(1, 1, 1);
+    empty.add_key(&key);
+    typename tree_type::snapshot held = empty.take_snapshot();
+    bool refused = false;
+    try
+    {
+        empty.freeze();
+    }
+    catch (const logic_error&)
+    {
+        refused = true;
+    }
+    CHECK(refused && empty.size() == 1);
+}
+
+/// freeze with whole keys and with normalized keys as separators.
+void test_frozen()
+{
+    check_frozen<primary_key_traits>();
+    check_frozen<key_traits<primary_key> >();
+}
+
+/// The filter of exact lookups against a std::multiset, through inserts, batches, lazy and eager deletes, a bulk load and a freeze: it never hides a key, and rules most absent
+/// keys out at about the false positive rate asked for.
+void test_filter()
+{
+    BTree<primary_key, 512> tree;
+    multiset<key_tuple> reference;
+    mt19937 random(25);
+    tree.set_filter(true, 0.01);
+    uint64_t absent = 0, let_through = 0;
+    auto check_lookups = [&](bool filtered)
+    {
+        vector<primary_key> probes;
+        for (int i = 0; i < 5000; i++)
+            probes.push_back(make_key(random() % 8, random() % 10, random() % 3000));
+        vector<primary_key*> found = tree.multi_get(probes);
+        bool same = true;
+        for (size_t i = 0; i < probes.size(); i++)
+        {
+            bool present = reference.count(as_tuple(probes[i])) != 0;
+            same = same && (found[i] != NULL) == present && tree.exists(probes[i]) == present && (tree.search_key(&probes[i]) != NULL) == present;
+            same = same && (tree.find(probes[i]) != tree.end()) == present;
+            if (filtered && !present)
+            {
+                absent++;
+                let_through += tree.lookup_filter().may_contain(BTree<primary_key, 512>::filter_hash(probes[i]));
+            }
+        }
+        CHECK(same);
+    };
+    for (int round = 0; round < 4; round++)
+    {
+        tree.set_lazy_delete(round % 2 == 1);
+        for (int i = 0; i < 20000; i++)
+        {
+            primary_key key = make_key(random() % 8, random() % 10, random() % 3000);
+            if (i % 3 == 0)
+            {
+                multiset<key_tuple>::iterator victim = reference.find(as_tuple(key));
+                CHECK(tree.delete_key(&key) == (victim != reference.end()));
+                if (victim != reference.end())
+                    reference.erase(victim);
+            }
+            else
+            {
+                tree.add_key(&key);
+                reference.insert(as_tuple(key));
+            }
+        }
+        vector<primary_key> batch;
+        for (int i = 0; i < 3000; i++)
+        {
+            batch.push_back(make_key(random() % 8, random() % 10, random() % 3000));
+            reference.insert(as_tuple(batch.back()));
+        }
+        tree.insert_batch(std::move(batch));
+        check_lookups(true);
+    }
+    tree.freeze(Frozen_layout::implicit);
+    check_lookups(true);
+    vector<primary_key> sorted;
+    for (multiset<key_tuple>::iterator it = reference.begin(); it != reference.end(); ++it)
+        sorted.push_back(make_key(get<0>(*it), get<1>(*it), get<2>(*it)));
+    tree.bulk_load(sorted.begin(), sorted.end());
+    check_lookups(true);
+    CHECK(tree.lookup_filter().capacity() >= tree.size() && tree.lookup_filter().memory_bytes() < tree.lookup_filter().capacity() * 2);
+    CHECK(let_through < absent * 3 / 100);
+    if (BTREE_STATS)
+    {
+        Tree_stats stats = tree.stats();
+        CHECK(stats.filtered_lookups > absent * 3 && stats.filter_false_positives < stats.filtered_lookups / 10);
+    }
+    tree.set_filter(false);
+    uint64_t filtered = tree.stats().filtered_lookups;
+    check_lookups(false);
+    CHECK(tree.stats().filtered_lookups == filtered);
+    CHECK(Bloom_filter::rate_at(10) < 0.015 && Bloom_filter::rate_at(16) < 0.002);
+}
+
+/// Random inserts, upserts and erases on a BTreeMap, checked against a std::map, with handles to values which have to survive the splits and frees of leaves.
+template <class Traits> void check_map()
+{
+    mt19937 random(5);
+    BTreeMap<primary_key, string, 512, Traits> tree;
+    map<key_tuple, string> reference;
+    primary_key held_key = make_key(1, 1, -1);
+    tree.insert(held_key, "held");
+    string* handle = tree.find(held_key);
+    for (int i = 0; i < 50000; i++)
+    {
+        primary_key key = make_key(random() % 3, random() % 3, random() % 3000);
+        string value = to_string(i);
+        int operation = random() % 10;
+        if (operation < 4)
+        {
+            bool added = reference.insert(make_pair(as_tuple(key), value)).second;
+            CHECK(tree.insert(key, value) == added);
+        }
+        else if (operation < 6)
+        {
+            bool added = reference.count(as_tuple(key)) == 0;
+            reference[as_tuple(key)] = value;
+            CHECK(tree.upsert(key, value) == added);
+        }
+        else if (operation < 8)
+            CHECK(tree.erase(key) == (reference.erase(as_tuple(key)) != 0));
+        else
+        {
+            string copy;
+            map<key_tuple, string>::iterator expected = reference.find(as_tuple(key));
+            CHECK(tree.get(key, copy) == (expected != reference.end()));
+            if (expected != reference.end())
+                CHECK(copy == expected->second);
+        }
+    }
+    CHECK(tree.find(held_key) == handle && *handle == "held");
+    CHECK(tree.find_and_modify(held_key, [](string& value) { value += " and changed"; }));
+    CHECK(*handle == "held and changed");
+    CHECK(tree.erase(held_key));
+    CHECK(tree.size() == reference.size());
+    vector<pair<key_tuple, string> > contents;
+    for (typename BTreeMap<primary_key, string, 512, Traits>::iterator it = tree.begin(); it != tree.end(); ++it)
+        contents.push_back(make_pair(as_tuple(it.key()), it.value()));
+    CHECK((contents == vector<pair<key_tuple, string> >(reference.begin(), reference.end())));
+    district_prefix district;
+    district.w_id = 2;
+    district.d_id = 1;
+    typename BTreeMap<primary_key, string, 512, Traits>::iterator first = tree.lower_bound(district);
+    map<key_tuple, string>::iterator expected = reference.lower_bound(key_tuple(2, 1, INT32_MIN));
+    CHECK(first != tree.end() && as_tuple(first.key()) == expected->first);
+    for (map<key_tuple, string>::iterator it = reference.begin(); it != reference.end(); ++it)
+        CHECK(tree.erase(make_key(get<0>(it->first), get<1>(it->first), get<2>(it->first))));
+    CHECK(tree.size() == 0 && tree.begin() == tree.end() && tree.values().used_blocks() == 0 && tree.node_allocator().used_blocks() == 0);
+}
+
+/// BTreeMap with normalized separators, and with whole keys as separators.
+void test_map()
+{
+    check_map<key_traits<primary_key> >();
+    check_map<primary_key_traits>();
+    CHECK((BTreeMap<primary_key, string>::inner_capacity > BTree<primary_key>::inner_capacity * 9 / 5));
+    CHECK((BTreeMap<primary_key, string, BLOCK_SIZE, primary_key_packed_traits>::inner_capacity > 2 * BTree<primary_key, BLOCK_SIZE, primary_key_packed_traits>::inner_capacity));
+}
+
+/// The last name of TPC-C customer number n (from 0 to 999), made of three syllables.
+string tpcc_last_name(int n)
+{
+    static const char* const syllables[] = { "BAR", "OUGHT", "ABLE", "PRI", "PRES", "ESE", "ANTI", "CALLY", "ATION", "EING" };
+    return string(syllables[n / 100]) + syllables[n / 10 % 10] + syllables[n % 10];
+}
+
+/// StringBTree against a std::map with keys of many lengths, a customer by last name index, and the gain of prefix compression on keys with long common prefixes.
+void test_strings()
+{
+    mt19937 random(6);
+    StringBTree<uint64_t, 512> tree;
+    map<string, uint64_t> reference;
+    for (int i = 0; i < 100000; i++)
+    {
+        string key = "warehouse/" + to_string(random() % 4) + "/";
+        for (int length = random() % 50; length > 0; length--)
+            key += (char)('a' + random() % 3); // few letters, so keys share long prefixes.
+        key.resize(min(key.size(), StringBTree<uint64_t, 512>::max_key_length));
+        int operation = random() % 10;
+        if (operation < 4)
+            CHECK(tree.insert(key, i) == reference.insert(make_pair(key, i)).second);
+        else if (operation < 5)
+        {
+            bool added = reference.count(key) == 0;
+            reference[key] = i;
+            CHECK(tree.upsert(key, i) == added);
+        }
+        else if (operation < 8)
+            CHECK(tree.erase(key) == (reference.erase(key) != 0));
+        else
+        {
+            uint64_t value = 0;
+            map<string, uint64_t>::iterator expected = reference.find(key);
+            CHECK(tree.get(key, value) == (expected != reference.end()));
+            if (expected != reference.end())
+                CHECK(value == expected->second);
+        }
+    }
+    CHECK(tree.size() == reference.size());
+    vector<pair<string, uint64_t> > contents;
+    for (StringBTree<uint64_t, 512>::iterator it = tree.begin(); it != tree.end(); ++it)
+        contents.push_back(make_pair(it.key(), it.value()));
+    CHECK((contents == vector<pair<string, uint64_t> >(reference.begin(), reference.end())));
+    StringBTree<uint64_t, 512>::iterator first = tree.lower_bound("warehouse/2/b");
+    CHECK(first != tree.end() && first.key() == reference.lower_bound("warehouse/2/b")->first);
+    bool rejected = false;
+    try
+    {
+        tree.insert(string(StringBTree<uint64_t, 512>::max_key_length + 1, 'x'), 0);
+    }
+    catch (const length_error&)
+    {
+        rejected = true;
+    }
+    CHECK(rejected && !tree.contains(string(StringBTree<uint64_t, 512>::max_key_length + 1, 'x')));
+    for (map<string, uint64_t>::iterator it = reference.begin(); it != reference.end(); ++it)
+        CHECK(tree.erase(it->first));
+    CHECK(tree.size() == 0 && tree.begin() == tree.end() && tree.node_allocator().used_blocks() == 0);
+
+    StringBTree<primary_key> customers; // the customers of a district by (last name, first name, id), which TPC-C looks up by last name alone.
+    multiset<tuple<string, string, int> > by_name;
+    for (int c = 0; c < 3000; c++)
+    {
+        string last = tpcc_last_name(c < 1000 ? c : random() % 1000), first = "FIRST" + to_string(random() % 500);
+        char id[8];
+        snprintf(id, sizeof(id), "%05d", c);
+        CHECK(customers.insert(last + '\0' + first + '\0' + id, make_key(1, 1, c)));
+        by_name.insert(make_tuple(last, first, c));
+    }
+    string wanted = tpcc_last_name(371) + '\0';
+    vector<int> found, expected;
+    for (StringBTree<primary_key>::iterator it = customers.lower_bound(wanted); it != customers.end() && it.key().compare(0, wanted.size(), wanted) == 0; ++it)
+        found.push_back(it.value().cust_id);
+    for (multiset<tuple<string, string, int> >::iterator it = by_name.lower_bound(make_tuple(tpcc_last_name(371), string(), 0)); it != by_name.end() && get<0>(*it) == tpcc_last_name(371); ++it)
+        expected.push_back(get<2>(*it));
+    CHECK(!found.empty() && found == expected);
+
+    StringBTree<uint64_t> names; // 42 byte keys, of which a node keeps only the few bytes past the prefix of its fences. Uncompressed, at most 69 would fit in a node.
+    for (int i = 0; i < 100000; i++)
+    {
+        char id[8];
+        snprintf(id, sizeof(id), "%06d", (int)(i * 7919ll % 100000));
+        names.insert("customer_by_last_name/district_0001/" + string(id), i);
+    }
+    CHECK(names.size() == 100000 && names.node_allocator().used_blocks() * 100 < names.size());
+}
+
+/// PostingBTree against a std::map of row sets, on few keys with long posting lists and on many keys with short ones, and a district index looked up by warehouse.
+void test_postings()
+{
+    for (int keys = 4; keys <= 4000; keys *= 1000)
+    {
+        mt19937_64 random(keys);
+        PostingBTree<int> index;
+        map<int, set<uint64_t> > reference;
+        for (int i = 0; i < 200000; i++)
+        {
+            int key = random() % keys;
+            uint64_t row = i % 2 == 0 ? (uint64_t)i * 3 : random() % 600000; // half of the rows come in increasing order, like new row ids.
+            int operation = random() % 10;
+            if (operation < 6)
+                CHECK(index.insert(key, row) == reference[key].insert(row).second);
+            else if (operation < 9)
+            {
+                bool present = reference.count(key) != 0 && reference[key].erase(row) != 0;
+                if (reference.count(key) != 0 && reference[key].empty())
+                    reference.erase(key);
+                CHECK(index.erase(key, row) == present);
+            }
+            else
+                CHECK(index.contains(key, row) == (reference.count(key) != 0 && reference[key].count(row) != 0));
+        }
+        size_t rows = 0;
+        for (map<int, set<uint64_t> >::iterator it = reference.begin(); it != reference.end(); ++it)
+        {
+            vector<uint64_t> found;
+            CHECK(index.find_all(it->first, found) == it->second.size() && index.count(it->first) == it->second.size());
+            CHECK(found == vector<uint64_t>(it->second.begin(), it->second.end()));
+            rows += it->second.size();
+        }
+        CHECK(index.size() == rows && index.keys() == reference.size());
+        for (map<int, set<uint64_t> >::iterator it = reference.begin(); it != reference.end(); ++it)
+            for (set<uint64_t>::iterator row = it->second.begin(); row != it->second.end(); ++row)
+                CHECK(index.erase(it->first, *row));
+        CHECK(index.size() == 0 && index.keys() == 0 && index.overflow_pages().used_blocks() == 0);
+    }
+
+    PostingBTree<district_prefix> by_district; // the customers of 3 warehouses of 10 districts, by district.
+    for (int c = 0; c < 90000; c++)
+    {
+        district_prefix district;
+        district.w_id = c % 3;
+        district.d_id = c / 3 % 10;
+        CHECK(by_district.insert(district, c));
+    }
+    warehouse_prefix warehouse;
+    warehouse.w_id = 1;
+    vector<uint64_t> found;
+    CHECK(by_district.count(warehouse) == 30000 && by_district.find_all(warehouse, found) == 30000);
+    CHECK(found.front() == 1 && found.back() == 89998);
+    CHECK(by_district.keys() == 30 && by_district.overflow_pages().used_blocks() * 1024 < by_district.size() * 2); // deltas of 3 or 30 take a byte per row.
+    size_t pages = by_district.overflow_pages().used_blocks();
+    district_prefix small;
+    small.w_id = 7;
+    small.d_id = 1;
+    CHECK(by_district.insert(small, 5) && by_district.insert(small, 1) && !by_district.insert(small, 5) && by_district.count(small) == 2);
+    CHECK(by_district.overflow_pages().used_blocks() == pages); // the two rows stay inline.
+}
+
+/// parallel_scan and parallel_for_each against a sequential filter, on the shared pool and on a pool of 4 threads, with tombstones left by lazy deletes.
+void test_parallel()
+{
+    BTree<primary_key> tree;
+    tree.set_lazy_delete(true, 1.0);
+    mt19937 random(21);
+    for (int c = 0; c < 200000; c++)
+    {
+        primary_key key = make_key(random() % 20, random() % 10, c);
+        tree.add_key(&key);
+        if (c % 5 == 0)
+            tree.delete_key(&key);
+    }
+    auto predicate = [](const primary_key& key) { return key.d_id == 3 && key.cust_id % 7 != 0; };
+    vector<key_tuple> expected;
+    for (BTree<primary_key>::iterator it = tree.begin(); it != tree.end(); ++it)
+        if (predicate(*it))
+            expected.push_back(as_tuple(*it));
+    Scan_pool four(4);
+    Scan_pool* pools[] = { &Scan_pool::shared(), &four };
+    for (Scan_pool* pool : pools)
+    {
+        for (size_t limit : { (size_t)0, (size_t)1, (size_t)1000, expected.size(), SIZE_MAX })
+        {
+            vector<primary_key> found = tree.parallel_scan(predicate, limit, *pool);
+            CHECK(found.size() == min(limit, expected.size()));
+            bool same = true;
+            for (size_t i = 0; i < found.size(); i++)
+                same = same && as_tuple(found[i]) == expected[i];
+            CHECK(same);
+        }
+        vector<vector<key_tuple> > buffers(pool->size()); // one per thread, so visits need no lock.
+        CHECK(tree.parallel_for_each(predicate, [&](const primary_key& key, int worker) { buffers[worker].push_back(as_tuple(key)); return true; }, *pool));
+        vector<key_tuple> visited;
+        for (size_t w = 0; w < buffers.size(); w++)
+            visited.insert(visited.end(), buffers[w].begin(), buffers[w].end());
+        sort(visited.begin(), visited.end());
+        CHECK(visited == expected);
+        atomic<int> visits(0);
+        CHECK(!tree.parallel_for_each(predicate, [&](const primary_key&, int) { return ++visits < 10; }, *pool));
+        CHECK(visits >= 10 && visits < (int)expected.size());
+        bool thrown = false;
+        try
+        {
+            tree.parallel_scan([](const primary_key& key) -> bool { if (key.cust_id == 4242) throw runtime_error("predicate failed"); return false; }, SIZE_MAX, *pool);
+        }
+        catch (const runtime_error&)
+        {
+            thrown = true;
+        }
+        CHECK(thrown);
+        CHECK(tree.parallel_scan(predicate, SIZE_MAX, *pool).size() == expected.size()); // the pool still works after the failure.
+    }
+    BTree<primary_key> empty;
+    CHECK(empty.parallel_scan(predicate, SIZE_MAX, four).empty());
+}
+
+/// PartitionedBTree with each partition function against a multiset, through single key operations, batches, merged iteration and scatter-gather lookups.
+template <class Partition> void check_partitioned(PartitionedBTree<primary_key, 512, key_traits<primary_key>, Partition>& tree)
+{
+    typedef PartitionedBTree<primary_key, 512, key_traits<primary_key>, Partition> tree_type;
+    mt19937 random(22);
+    multiset<key_tuple> reference;
+    vector<primary_key> batch;
+    for (int c = 0; c < 30000; c++)
+    {
+        primary_key key = make_key(random() % 12, random() % 10, random() % 3000);
+        if (c % 3 == 0)
+            tree.add_key(&key);
+        else
+            batch.push_back(key);
+        reference.insert(as_tuple(key));
+    }
+    tree.insert_batch(move(batch));
+    for (int c = 0; c < 5000; c++)
+    {
+        primary_key key = make_key(random() % 12, random() % 10, random() % 3000);
+        bool present = reference.count(as_tuple(key)) != 0;
+        if (present)
+            reference.erase(reference.find(as_tuple(key)));
+        CHECK(tree.delete_key(&key) == present);
+    }
+    CHECK(tree.size() == reference.size());
+    vector<key_tuple> merged;
+    for (typename tree_type::iterator it = tree.begin(); it != tree.end(); ++it)
+        merged.push_back(as_tuple(*it));
+    CHECK(merged == vector<key_tuple>(reference.begin(), reference.end()));
+
+    district_prefix district;
+    district.w_id = 7;
+    district.d_id = 4;
+    pair<typename tree_type::iterator, typename tree_type::iterator> range = tree.equal_range(district);
+    vector<key_tuple> in_district;
+    for (typename tree_type::iterator it = range.first; it != range.second; ++it)
+        in_district.push_back(as_tuple(*it));
+    CHECK(in_district == vector<key_tuple>(reference.lower_bound(key_tuple(7, 4, INT32_MIN)), reference.upper_bound(key_tuple(7, 4, INT32_MAX))));
+    primary_key from = make_key(11, 9, 1500);
+    size_t after = 0;
+    for (typename tree_type::iterator it = tree.lower_bound(from); it != tree.end(); ++it)
+        after++;
+    CHECK(after == (size_t)distance(reference.lower_bound(as_tuple(from)), reference.end()));
+
+    vector<primary_key> probes;
+    for (int i = 0; i < 2000; i++)
+        probes.push_back(make_key(random() % 12, random() % 10, random() % 3000));
+    vector<primary_key*> found = tree.multi_get(probes);
+    bool same = true;
+    for (size_t i = 0; i < probes.size(); i++)
+    {
+        primary_key probe = probes[i];
+        same = same && (found[i] != NULL) == (reference.count(as_tuple(probe)) != 0) && (found[i] == NULL || found[i] == tree.search_key(&probe));
+    }
+    CHECK(same);
+    vector<warehouse_prefix> warehouses(13);
+    for (int w = 0; w < 13; w++)
+        warehouses[w].w_id = w;
+    vector<primary_key*> firsts = tree.multi_get(warehouses);
+    same = true;
+    for (int w = 0; w < 13; w++)
+    {
+        multiset<key_tuple>::iterator first = reference.lower_bound(key_tuple(w, INT32_MIN, INT32_MIN));
+        bool any = first != reference.end() && get<0>(*first) == w;
+        same = same && (firsts[w] != NULL) == any && (!any || as_tuple(*firsts[w]) == *first);
+    }
+    CHECK(same);
+
+    vector<primary_key> odd = tree.parallel_scan([](const primary_key& key) { return key.cust_id % 2 == 1; }, 100);
+    vector<key_tuple> expected;
+    for (multiset<key_tuple>::iterator it = reference.begin(); it != reference.end() && expected.size() < 100; ++it)
+        if (get<2>(*it) % 2 == 1)
+            expected.push_back(*it);
+    CHECK(odd.size() == expected.size());
+    for (size_t i = 0; i < odd.size() && i < expected.size(); i++)
+        CHECK(as_tuple(odd[i]) == expected[i]);
+}
+
+void test_partitioned()
+{
+    PartitionedBTree<primary_key, 512> by_warehouse(4, warehouse_partition(), 2);
+    check_partitioned(by_warehouse);
+    for (int w = 0; w < 12; w++)
+    {
+        warehouse_prefix warehouse;
+        warehouse.w_id = w;
+        pair<PartitionedBTree<primary_key, 512>::tree_type::iterator, PartitionedBTree<primary_key, 512>::tree_type::iterator> own = by_warehouse.shard(w % 4).equal_range(warehouse);
+        CHECK(own.first != own.second); // every warehouse lives in shard w_id % 4 only.
+        for (int s = 0; s < 4; s++)
+            CHECK(s == w % 4 || by_warehouse.shard(s).lower_bound(warehouse) == by_warehouse.shard(s).upper_bound(warehouse));
+    }
+    vector<std::thread::id> owner(4);
+    vector<char> stable(4, 1); // written by the owner of the shard only.
+    for (int run = 0; run < 20; run++)
+        by_warehouse.for_each_shard([&](PartitionedBTree<primary_key, 512>::tree_type&, size_t index)
+        {
+            if (run == 0)
+                owner[index] = this_thread::get_id();
+            stable[index] = stable[index] && owner[index] == this_thread::get_id();
+        });
+    CHECK(stable == vector<char>(4, 1));
+    CHECK(owner[0] == this_thread::get_id() && owner[1] == owner[0] && owner[2] == owner[3] && owner[2] != owner[0]); // the calling thread and one more, with two shards each.
+
+    PartitionedBTree<primary_key, 512, key_traits<primary_key>, hash_partition<primary_key> > by_hash(5);
+    check_partitioned(by_hash);
+    for (size_t s = 0; s < by_hash.shard_count(); s++)
+        CHECK(by_hash.shard(s).size() > by_hash.size() / 10);
+    vector<primary_key> bounds = { make_key(3, 0, 0), make_key(6, 5, 0), make_key(9, 0, 0) };
+    PartitionedBTree<primary_key, 512, key_traits<primary_key>, range_partition<primary_key> > by_range(4, range_partition<primary_key>(bounds));
+    check_partitioned(by_range);
+    CHECK(by_range.shard(0).rbegin()->w_id < 3 && by_range.shard(3).begin()->w_id >= 9);
+}
+
+/// Threads adding and deleting keys of their own warehouse at the same time, while other threads read.
+void test_concurrent()
+{
+    ConcurrentBTree<primary_key, 512> tree;
+    const int writers = 4, keys_per_writer = 20000;
+    atomic<bool> done(false);
+    vector<thread> threads;
+    for (int w = 0; w < writers; w++)
+        threads.push_back(thread([&tree, w]()
+        {
+            for (int c = 0; c < keys_per_writer; c++)
+            {
+                primary_key key = make_key(w, 0, c);
+                tree.add_key(&key);
+            }
+            for (int c = 0; c < keys_per_writer; c += 2)
+            {
+                primary_key key = make_key(w, 0, c);
+                CHECK(tree.delete_key(&key));
+            }
+        }));
+    thread reader([&tree, &done]()
+    {
+        vector<primary_key> keys;
+        while (!done.load())
+        {
+            keys.clear();
+            warehouse_prefix warehouse;
+            warehouse.w_id = 1;
+            tree.scan(warehouse, 100, keys);
+            for (size_t i = 1; i < keys.size(); i++)
+                CHECK(keys[i - 1].cust_id < keys[i].cust_id);
+        }
+    });
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    done.store(true);
+    reader.join();
+    vector<primary_key> all;
+    warehouse_prefix first;
+    first.w_id = 0;
+    tree.scan(first, SIZE_MAX, all);
+    CHECK(all.size() == (size_t)writers * keys_per_writer / 2);
+    for (size_t i = 0; i < all.size(); i++)
+        CHECK(all[i].w_id == (int)(i / (keys_per_writer / 2)) && all[i].cust_id == (int)(i % (keys_per_writer / 2)) * 2 + 1);
+    primary_key result;
+    CHECK(tree.find(make_key(2, 0, 101), result) && result.cust_id == 101);
+    CHECK(!tree.find(make_key(2, 0, 100), result));
+}
+
+/// Changes a PagedBTree over a few openings of its file, checking it against the reference set every time.
+template <class Tree, class... Options> void check_paged(const char* name, Options... options)
+{
+    string path = scratch_path(name);
+    unlink(path.c_str());
+    mt19937 random(11);
+    multiset<key_tuple> reference;
+    for (int session = 0; session < 4; session++)
+    {
+        Tree tree(path.c_str(), options...);
+        CHECK(tree.size() == reference.size());
+        for (int i = 0; i < 15000; i++)
+        {
+            primary_key key = make_key(random() % 3, random() % 2, random() % 5000);
+            int operation = random() % 10;
+            if (operation < (session == 3 ? 2 : 6))
+            {
+                tree.add_key(&key);
+                reference.insert(as_tuple(key));
+            }
+            else if (operation < 8)
+            {
+                multiset<key_tuple>::iterator victim = reference.find(as_tuple(key));
+                bool present = victim != reference.end();
+                if (present)
+                    reference.erase(victim);
+                CHECK(tree.delete_key(&key) == present);
+            }
+            else
+            {
+                primary_key result;
+                CHECK(tree.find(key, result) == (reference.count(as_tuple(key)) != 0));
+            }
+        }
+        vector<primary_key> keys;
+        warehouse_prefix first;
+        first.w_id = 0;
+        tree.scan(first, SIZE_MAX, keys);
+        vector<key_tuple> scanned;
+        for (size_t i = 0; i < keys.size(); i++)
+            scanned.push_back(as_tuple(keys[i]));
+        CHECK(scanned == vector<key_tuple>(reference.begin(), reference.end()));
+    }
+    unlink(path.c_str());
+}
+
+/// PagedBTree on a memory mapped file and on a buffer pool much smaller than the tree.
+void test_paged()
+{
+    check_paged<PagedBTree<primary_key> >("mapped.pages");
+    check_paged<PagedBTree<primary_key, 512> >("small.pages");
+    check_paged<PagedBTree<primary_key, PAGE_BYTES, key_traits<primary_key>, Buffer_pool> >("pooled.pages", (size_t)8);
+    string path = scratch_path("wrong_size.pages");
+    {
+        PagedBTree<primary_key> tree(path.c_str());
+        primary_key key = make_key(0, 0, 1);
+        tree.add_key(&key);
+    }
+    bool refused = false;
+    try
+    {
+        PagedBTree<primary_key, 2 * PAGE_BYTES> tree(path.c_str());
+    }
+    catch (const runtime_error&)
+    {
+        refused = true;
+    }
+    CHECK(refused);
+    unlink(path.c_str());
+}
+
+/// A DurableBTree recovers its keys from the checkpoint and the log, and ignores a torn record at the end of the log.
+void test_durable()
+{
+    string path = scratch_path("durable");
+    string log = path + ".wal", checkpoint = path + ".ckpt";
+    unlink(log.c_str());
+    unlink(checkpoint.c_str());
+    {
+        DurableBTree<primary_key> tree(path);
+        vector<thread> threads;
+        for (int w = 0; w < 4; w++)
+            threads.push_back(thread([&tree, w]()
+            {
+                for (int c = 0; c < 1000; c++)
+                {
+                    primary_key key = make_key(w, 0, c);
+                    tree.add_key(&key);
+                }
+            }));
+        for (size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+        tree.checkpoint();
+        for (int c = 0; c < 500; c++)
+        {
+            primary_key key = make_key(0, 0, c);
+            CHECK(tree.delete_key(&key));
+        }
+        CHECK(tree.checkpoints() == 1);
+    }
+    {
+        DurableBTree<primary_key> tree(path, Fsync_policy::per_commit);
+        CHECK(tree.size() == 3500);
+        primary_key result;
+        CHECK(!tree.find(make_key(0, 0, 10), result));
+        CHECK(tree.find(make_key(3, 0, 999), result) && result.cust_id == 999);
+        primary_key key = make_key(9, 9, 9);
+        tree.add_key(&key);
+    }
+    struct stat status;
+    CHECK(stat(log.c_str(), &status) == 0);
+    CHECK(truncate(log.c_str(), status.st_size - 3) == 0); // tears the last record, as a crash in the middle of writing it would.
+    {
+        DurableBTree<primary_key> tree(path);
+        CHECK(tree.size() == 3500);
+        primary_key result;
+        CHECK(!tree.find(make_key(9, 9, 9), result));
+        primary_key key = make_key(9, 9, 8);
+        tree.add_key(&key);
+    }
+    {
+        DurableBTree<primary_key> tree(path);
+        primary_key result;
+        CHECK(tree.size() == 3501 && tree.find(make_key(9, 9, 8), result));
+    }
+    unlink(log.c_str());
+    unlink(checkpoint.c_str());
+
+    { // a flush which fails half way through its records leaves no part of them in the file, and the next flush writes them again in order.
+        Write_ahead_log wal(log, Fsync_policy::per_commit);
+        wal.replay(1, [](uint32_t, const char*, size_t) {});
+        char payload[100] = {};
+        for (int i = 0; i < 10; i++)
+            wal.commit(wal.append(1, payload, sizeof(payload)));
+        size_t kept = wal.bytes();
+        for (int i = 0; i < 10; i++)
+            wal.append(1, payload, sizeof(payload));
+        struct rlimit limit, small;
+        getrlimit(RLIMIT_FSIZE, &limit);
+        small = limit;
+        small.rlim_cur = kept + 500; // the write stops in the middle of the fifth record.
+        void (*previous)(int) = signal(SIGXFSZ, SIG_IGN);
+        setrlimit(RLIMIT_FSIZE, &small);
+        bool failed = false;
+        try
+        {
+            wal.flush();
+        }
+        catch (const runtime_error&)
+        {
+            failed = true;
+        }
+        setrlimit(RLIMIT_FSIZE, &limit);
+        signal(SIGXFSZ, previous);
+        struct stat after;
+        CHECK(failed && stat(log.c_str(), &after) == 0 && (size_t)after.st_size == kept);
+        CHECK(wal.bytes() == kept + 10 * (sizeof(payload) + 24) && wal.flushes() == 10); // the records, with headers of 24 bytes, wait in the buffer again.
+        wal.commit(wal.append(2, payload, sizeof(payload)));
+    }
+    {
+        Write_ahead_log wal(log);
+        uint32_t kinds = 0;
+        CHECK(wal.replay(1, [&kinds](uint32_t kind, const char*, size_t) { kinds += kind; }) == 21 && kinds == 22 && wal.next() == 22);
+    }
+    unlink(log.c_str());
+}
+
+int main(int argc, char** argv)
+{
+    const pair<const char*, void (*)()> tests[] = {
+        make_pair("btree", test_btree),
+        make_pair("ranges", test_ranges),
+        make_pair("batches", test_batches),
+        make_pair("snapshots", test_snapshots),
+        make_pair("stats", test_stats),
+        make_pair("appends", test_appends),
+        make_pair("frozen", test_frozen),
+        make_pair("filter", test_filter),
+        make_pair("map", test_map),
+        make_pair("strings", test_strings),
+        make_pair("postings", test_postings),
+        make_pair("parallel", test_parallel),
+        make_pair("partitioned", test_partitioned),
+        make_pair("concurrent", test_concurrent),
+        make_pair("paged", test_paged),
+        make_pair("durable", test_durable),
+    };
+    bool ran = false;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        if (argc > 1 && strcmp(argv[1], tests[i].first) != 0)
+            continue;
+        int before = failures;
+        tests[i].second();
+        cout << tests[i].first << ": " << (failures == before ? "passed" : "FAILED") << endl;
+        ran = true;
+    }
+    if (!ran)
+    {
+        cerr << "No test named " << argv[1] << endl;
+        return 2;
+    }
+    return failures == 0 ? 0 : 1;
+}